@@ -30,6 +30,19 @@
 #define	DEBUG	0
 #endif
 
+/*
+ * Building with -DFUZZ=FUZZ_<file> (and clang -fsanitize=fuzzer, or
+ * AFL++'s afl-clang-fast -fsanitize=fuzzer) replaces main() with a
+ * libFuzzer entry point that feeds its input to the parser of that
+ * /proc file; see LLVMFuzzerTestOneInput().  Linux only.
+ */
+#define	FUZZ_NET_DEV		1
+#define	FUZZ_SNMP		2
+#define	FUZZ_NETSTAT		3
+#define	FUZZ_UDP		4
+#define	FUZZ_SOFTNET		5
+#define	FUZZ_INTERRUPTS		6
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -38,6 +51,7 @@
 #include <limits.h>
 #include <fcntl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <net/if.h>
 #include <sys/time.h>
@@ -45,6 +59,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <signal.h>
+#include <math.h>
 
 #ifdef OS_SOLARIS
 #include <sys/sockio.h>
@@ -82,15 +97,44 @@
 #include <linux/sockios.h>
 #include <linux/types.h>
 #include <linux/ethtool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+#include <linux/gen_stats.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <pthread.h>
+#include <semaphore.h>
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define	USE_URING	1
+#endif
+#endif
 #define	PROC_NET_DEV_PATH	"/proc/net/dev"
 #define	PROC_NET_SNMP_PATH	"/proc/net/snmp"
 #define	PROC_NET_NETSTAT_PATH	"/proc/net/netstat"
+#define	PROC_NET_UDP_PATH	"/proc/net/udp"
+#define	PROC_NET_UDP6_PATH	"/proc/net/udp6"
+#define	PROC_NET_SOFTNET_PATH	"/proc/net/softnet_stat"
+#define	PROC_INTERRUPTS_PATH	"/proc/interrupts"
+#define	SYS_CLASS_NET_PATH	"/sys/class/net"
+#define	PROC_SELF_IO_PATH	"/proc/self/io"
 #define	PROC_NET_BUFSIZ		(128 * 1024)
+#define	PROC_NET_DEV_HEADER	\
+	"Inter-|   Receive                                   " \
+	"             |  Transmit\n" \
+	" face |bytes    packets errs drop fifo frame compressed" \
+	" multicast|bytes    packets errs drop fifo colls carrier" \
+	" compressed\n"
 #define	PROC_UPTIME		"/proc/uptime"
-#define UINT32_MAX		(4294967295U)
-/* Needs to be fixed if not built under ILP32 */
-typedef unsigned long long	uint64_t;
-typedef unsigned int		uint32_t;
 extern char *optarg;
 extern int optind, opterr, optopt;
 #endif /* OS_LINUX */
@@ -122,9 +166,9 @@ typedef uint32_t		duplex_t;
 #define	LOOP_MAX 1
 
 #ifdef OS_LINUX
-#define	GETOPT_OPTIONS		"hi:sS:znplvxtuaMmU"
+#define	GETOPT_OPTIONS		"hi:sS:znplvxtuaMmUDCIcqbT:H:L:g:w:r:R:A:o:P:d:X:E:QB:W"
 #else
-#define	GETOPT_OPTIONS		"hi:sznpklvxtuaMmU"
+#define	GETOPT_OPTIONS		"hi:sznpklvxtuaMmUT:H:L:g:w:"
 #endif
 
 /*
@@ -136,10 +180,143 @@ typedef struct udp_stats {
 	uint64_t outDatagrams;
 	uint64_t inErrors;
 	uint64_t outErrors;
+	uint64_t noPorts;
+	uint64_t rcvbufErrors;
+	uint64_t sndbufErrors;
+	uint64_t inCsumErrors;
 } udpstats_t;
 
 static udpstats_t *g_udp_old, *g_udp_new;
 
+#ifdef OS_LINUX
+/*
+ * UDP socket stats, from /proc/net/udp{,6}
+ */
+typedef struct udp_sock {
+	uint64_t inode;
+	uint64_t drops;			/* drops since socket creation */
+	uint64_t ddrops;		/* drops since previous sample */
+	uint32_t rxq;			/* rx_queue bytes */
+	uint32_t txq;			/* tx_queue bytes */
+	uint32_t addr[4];		/* local address, as in /proc */
+	int family;			/* AF_INET or AF_INET6 */
+	int port;			/* local port */
+} udpsock_t;
+
+typedef struct udp_sock_table {
+	udpsock_t *socks;
+	int count;
+	int size;			/* allocated entries in socks */
+	int *hash;			/* inode hash - index + 1 into socks */
+	int hash_size;			/* power of 2 */
+} udpsocktab_t;
+
+static udpsocktab_t g_usock_old, g_usock_new;
+
+#define	UDP_TOP_SOCKETS		10	/* max sockets shown by -D */
+
+/*
+ * Per-CPU NET_RX softirq stats, from /proc/net/softnet_stat
+ */
+typedef struct softnet_stats {
+	int cpu;
+	uint64_t processed;		/* packets processed */
+	uint64_t dropped;		/* netdev backlog full */
+	uint64_t squeezed;		/* time_squeeze - ran out of budget */
+	uint64_t rps;			/* received_rps - RPS IPIs */
+	uint64_t flow_limit;		/* flow_limit_count */
+} softnetstats_t;
+
+typedef struct softnet_sample {
+	struct timeval tv;
+	softnetstats_t *cpus;
+	int count;
+	int size;
+} softnet_t;
+
+static softnet_t g_softnet_a, g_softnet_b;
+static softnet_t *g_softnet_old = &g_softnet_a;
+static softnet_t *g_softnet_new = &g_softnet_b;
+
+/* A CPU processing this many times its share of packets is "hot" */
+#define	SOFTNET_HOT_FACTOR	2
+
+/*
+ * Per-CPU interrupt counts for interface IRQs, from /proc/interrupts
+ */
+typedef struct irq_stats {
+	struct nicdata *nicp;		/* interface this IRQ belongs to */
+	uint64_t *old;			/* per-CPU counts, previous sample */
+	uint64_t *new;			/* per-CPU counts, this sample */
+	int primed;			/* old is a real sample */
+} irqstats_t;
+
+static irqstats_t **g_irq_table;	/* indexed by IRQ number */
+static int g_irq_table_size;
+static int g_irq_ncpus;			/* CPU columns in /proc/interrupts */
+static int *g_irq_cpu_ids;		/* CPU number of each column */
+static struct timeval g_irq_tv_old, g_irq_tv_new;
+
+#define	IRQ_TOP_CPUS		4	/* busiest CPUs shown by -I */
+
+/*
+ * Assumed CPU cost of taking one interrupt (entry, handler, exit and
+ * cache disturbance), for the -c overhead estimate.
+ */
+#define	INTR_COST_NSEC		2000
+
+/*
+ * Queueing discipline stats, from an rtnetlink RTM_GETQDISC dump
+ */
+typedef struct qdisc_counters {
+	uint64_t bytes;
+	uint32_t packets;
+	uint32_t drops;
+	uint32_t overlimits;
+	uint32_t requeues;
+} qdisccounters_t;
+
+typedef struct qdisc_stats {
+	int ifindex;
+	uint32_t handle;
+	uint32_t parent;
+	char kind[IFNAMSIZ];
+	qdisccounters_t old;
+	qdisccounters_t new;
+	uint32_t qlen;			/* packets queued now */
+	uint32_t backlog;		/* bytes queued now */
+	int primed;			/* old is a real sample */
+} qdiscstats_t;
+
+static qdiscstats_t *g_qdiscs;		/* in the kernel's dump order */
+static int g_qdisc_count;
+static int g_qdisc_size;
+static int g_qdisc_cursor;		/* next expected entry in a dump */
+static struct timeval g_qdisc_tv_old, g_qdisc_tv_new;
+static char **g_ifindex_names;		/* if_indextoname() cache */
+static int g_ifindex_names_size;
+
+/*
+ * Bond (or team) interfaces and their members, from IFLA_MASTER
+ */
+typedef struct bond_member {
+	char *name;
+	struct nicdata *nicp;		/* found lazily */
+} bondmember_t;
+
+typedef struct bond {
+	struct bond *next;
+	int ifindex;
+	char *name;
+	struct nicdata *nicp;		/* found lazily */
+	bondmember_t *members;
+	int nmembers;
+} bond_t;
+
+static bond_t *g_bonds;
+static int g_bonds_stale = B_TRUE;	/* need to (re-)discover */
+#endif /* OS_LINUX */
+
 typedef struct tcp_stats {
 	struct timeval tv;		/* tv_sec, tv_usec */
 	uint64_t inDataInorderSegs;
@@ -180,14 +357,39 @@ typedef struct nic_stats {
 	uint64_t nocp;			/* total nocanput */
 	uint64_t defer;			/* total defers */
 	uint64_t sat;			/* saturation value */
+	int64_t skew;			/* -W: us after its tick it was taken */
 } nicstats_t;
 
+/*
+ * Moving averages of rates, for -L; like the load average, each is an
+ * exponentially weighted moving average over a span of intervals.  Up to
+ * EWMA_SPANS spans may be chosen.
+ */
+#define	EWMA_SPANS	3
+enum ewma_metric { EW_RBYTES, EW_WBYTES, EW_PACKETS, EW_UTIL, EW_COUNT };
+
+static int g_ewma_spans[EWMA_SPANS];
+static int g_ewma_nspans;
+static double g_ewma_alpha[EWMA_SPANS];	/* 1 - e^(-1/span) */
+
 typedef struct nicdata {
 	struct nicdata *next;	/* pointer to next */
 	char *name;		/* interface name (e.g. "lo0") */
 	uint32_t flags;
 #ifdef OS_LINUX
 	int report;		/* non-zero means we intend to print */
+	int *irqs;		/* IRQs of the interface's device */
+	int nirqs;
+	int irqs_resolved;	/* irqs/nirqs have been looked up */
+	time_t speed_time;	/* when ETHTOOL_GSET last gave speed */
+	struct nic_coalesce {	/* ETHTOOL_GCOALESCE settings */
+		uint32_t rx_usecs;
+		uint32_t rx_frames;
+		uint32_t tx_usecs;
+		uint32_t tx_frames;
+		int adaptive_rx;
+		int adaptive_tx;
+	} coalesce;
 #endif
 #ifdef OS_SOLARIS
 	kstat_t *ls_ksp;
@@ -198,10 +400,427 @@ typedef struct nicdata {
 #endif
 	uint64_t speed;			/* speed of interface */
 	duplex_t duplex;
+	struct nic_hist *hist;		/* -H histograms, once looked up */
+	double ewma[EW_COUNT][EWMA_SPANS];	/* -L averages */
+	int ewma_primed;
+	uint32_t groups;		/* -g groups we are in, by bit */
+	struct store_stream *store;	/* -w, one per tier */
+	struct nic_stats *sink_old;	/* -o, counters at each's last */
+	int state_slot;			/* -P entry, plus one; or 0 */
 	struct nic_stats old;	/* stats from previous lookup */
 	struct nic_stats new;	/* stats from current lookup */
 } nicdata_t;
 
+/*
+ * Per second rates of an interface, or of a number of them, as printed
+ */
+typedef struct nic_rates {
+	double rbps;		/* read bytes per sec */
+	double wbps;		/* write bytes per sec */
+	double rpps;		/* read packets per sec */
+	double wpps;		/* write packets per sec */
+	double sats;		/* saturation value per sec */
+	double ierrs;
+	double oerrs;
+	double colls;
+	double nocps;
+	double defers;
+	double util;		/* utilisation */
+	double rutil;		/* In (read) utilisation */
+	double wutil;		/* Out (write) utilisation */
+	double ewma[EW_COUNT][EWMA_SPANS];	/* -L averages of these */
+	int64_t skew;		/* -W: of the sample, in us */
+} nicrates_t;
+
+/*
+ * -T ranks interfaces by one of these
+ */
+typedef enum { TOP_BYTES, TOP_UTIL, TOP_PPS, TOP_ERRORS, TOP_SAT } topkey_t;
+
+typedef struct top_entry {
+	struct nicdata *nicp;
+	nicrates_t rates;
+	double key;		/* top_key() of rates */
+} topentry_t;
+
+/*
+ * Histograms of rates, for -H
+ */
+#define	HIST_VERSION	1
+#define	HIST_SUB	8		/* buckets per doubling */
+#define	HIST_MIN_EXP	(-6)		/* smallest bucket starts at 2^-6 */
+#define	HIST_MIN	(1.0 / 64)
+#define	HIST_OCTAVES	48		/* ... and the largest at 2^42 */
+#define	HIST_BUCKETS	(1 + HIST_SUB * HIST_OCTAVES)
+
+enum hist_metric { HM_RBYTES, HM_WBYTES, HM_RPACKETS, HM_WPACKETS,
+	HM_UTIL, HM_SAT, HM_IERR, HM_OERR, HM_COUNT };
+
+static char *g_hist_names[HM_COUNT] = {	/* for -p and saved files */
+	"rKB", "wKB", "rPk", "wPk", "Util", "Sat", "IErr", "OErr" };
+static char *g_hist_labels[HM_COUNT] = {
+	"rKB/s", "wKB/s", "rPk/s", "wPk/s", "%Util", "Sat", "IErr", "OErr" };
+
+typedef struct hist {
+	uint64_t samples;
+	double max;			/* exact, not bucketed */
+	uint32_t count[HIST_BUCKETS];
+} hist_t;
+
+typedef struct nic_hist {
+	struct nic_hist *next;
+	char *name;
+	hist_t metric[HM_COUNT];
+} nichist_t;
+
+static int g_hist;			/* -H: keep histograms of rates */
+static nichist_t *g_hists;		/* one per interface ever seen */
+static char *g_hist_file;		/* where -H saves them */
+static int g_caught_usr1;		/* print the histograms */
+static int g_caught_term;		/* print & save them, then exit */
+
+static int g_ewma;			/* -L: show moving averages */
+static int g_ngroups;			/* -g groups defined */
+static int g_top_n;			/* -T: show the N busiest only */
+static topkey_t g_top_key;		/* -T: what "busiest" means */
+static topentry_t *g_top_entries;	/* one per interface */
+static topentry_t **g_top_list;		/* g_top_entries, being ranked */
+static int g_top_size;			/* allocated size of these */
+
+/*
+ * Long-term counter store (-w).  Each tier (every sample, 10 second and
+ * 5 minute) is a file holding a ring of fixed-size blocks, after a file
+ * header block.  A block holds one interface's samples: the first as
+ * plain varints, later ones as zigzag varints of the delta-of-delta of
+ * the timestamp (in ms) and of each counter, so a steady rate costs a
+ * byte or so per counter.  A coarser tier is a rollup: it keeps the
+ * first sample of each period, so that (the counters being cumulative)
+ * the mean rates between its samples fall out of the difference; and
+ * with each, the peak rate of each counter over any one sample since
+ * the last, so that bursts within a period are not lost.  Every sample
+ * ends with its -W skew (how long after its tick it was taken, in us;
+ * 0 without -W), as a zigzag varint.
+ *
+ * The file header holds the sequence number of the next block to be
+ * started, which is also where it goes in the ring; it is written
+ * before the block is, so opening the store never has to scan it.
+ *
+ * Appends write the new payload bytes first and then the block header,
+ * whose length and CRCs cover them; a crash before the header is
+ * written leaves the block as it was, and a torn block fails its CRC
+ * and is ignored.  Once a tier's ring is full the oldest block is
+ * reused, which bounds the disk space used.
+ */
+#define	STORE_FILE_MAGIC	0x4e535431	/* "NST1" */
+#define	STORE_BLOCK_MAGIC	0x4e534231	/* "NSB1" */
+#define	STORE_VERSION		3
+#define	STORE_BLOCK_SIZE	1024
+#define	STORE_PAYLOAD		(STORE_BLOCK_SIZE - sizeof (storehdr_t))
+#define	STORE_COUNTERS		10
+#define	STORE_MAX_SAMPLE	((2 * STORE_COUNTERS + 2) * 10)	/* varints */
+#define	STORE_TIERS		3
+#define	STORE_BUDGET_MB		64		/* default disk budget */
+#define	STORE_MIN_BLOCKS	16
+
+typedef struct store_file_hdr {		/* block 0 of a tier file */
+	uint32_t magic;			/* STORE_FILE_MAGIC */
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t nblocks;		/* data blocks that follow */
+	uint32_t period_ms;		/* 0 for every sample */
+	uint32_t reserved;
+	uint64_t next_seq;		/* of the next block to be started */
+} storefilehdr_t;
+
+typedef struct store_hdr {		/* start of each data block */
+	uint32_t magic;			/* STORE_BLOCK_MAGIC */
+	uint32_t hdr_crc;		/* of this header, hdr_crc as 0 */
+	uint64_t seq;			/* block number, ever increasing */
+	int64_t first_ms;		/* time of first sample */
+	int64_t last_ms;		/* time of last sample */
+	uint64_t speed;			/* of the interface, constant */
+	uint32_t payload_crc;		/* of payload[0, used) */
+	uint16_t used;			/* payload bytes */
+	uint16_t nsamples;
+	uint32_t duplex;
+	uint32_t reserved;
+	char name[40];			/* interface */
+} storehdr_t;
+
+typedef struct store_tier {
+	char *name;			/* file name within the directory */
+	uint32_t period_ms;
+	int budget_16ths;		/* share of the disk budget */
+	int fd;
+	uint32_t nblocks;
+	uint64_t next_seq;		/* for the next new block */
+	struct store_stream **owner;	/* writer of each block, if any */
+} storetier_t;
+
+typedef struct store_stream {		/* one interface, one tier */
+	int block;			/* block being appended, or -1 */
+	storehdr_t hdr;
+	int64_t prev_ms;		/* previous sample, for deltas */
+	int64_t prev_dms;
+	uint64_t prev[STORE_COUNTERS];
+	int64_t prev_d[STORE_COUNTERS];
+	uint64_t peak[STORE_COUNTERS];	/* coarser tiers: highest per sec */
+} storestream_t;
+
+static storetier_t g_store_tiers[STORE_TIERS] = {
+	{ "raw",	0,		12,	-1,	0,	0,	NULL },
+	{ "10s",	10 * 1000,	3,	-1,	0,	0,	NULL },
+	{ "5m",		5 * 60 * 1000,	1,	-1,	0,	0,	NULL },
+};
+static char *g_store_dir;		/* -w directory */
+static uint64_t g_store_budget;		/* -w size, bytes */
+static uint32_t g_crc_table[256];
+
+/*
+ * Where interface lines go, and how: the standard output in g_style,
+ * or an -o file in its own.  Each keeps its own count of lines since
+ * its last header.
+ */
+typedef struct output {
+	FILE *fp;
+	int style;			/* STYLE_* */
+	int ewma;			/* with the -L columns */
+	int skew;			/* -W: parseable lines end with it */
+	int line;			/* output line counter */
+	int async;			/* lines go to the writer (-A) */
+} output_t;
+
+static output_t g_output;		/* the standard output */
+
+#ifdef OS_LINUX
+/*
+ * Asynchronous output (-A).  A writer thread formats and writes the
+ * output, so neither a stalled reader nor the printing of thousands of
+ * interface lines delays sampling.  Headers and interface lines are
+ * queued as records of their rates, for the writer to print.  What
+ * little else is printed (the TCP, UDP and other sections, -d, -H) the
+ * main thread prints to a memory stream, g_output.fp, and each record
+ * notes how much of that text comes before it.  flush_output() ends
+ * each sample's output by copying both to a buffer that is committed
+ * to a ring, from which the writer takes it.  There is one producer
+ * (the main thread) and one consumer (the writer), so head only ever
+ * moves forward in one and tail in either: when the ring is full, the
+ * producer drops the oldest buffer by advancing tail itself, with a
+ * compare-and-swap that the writer's claim of the same buffer wins or
+ * loses as a whole.  Written buffers go back to the producer through a
+ * second ring, which can never fill.
+ */
+#define	OUTREC_NAME	64		/* and -g names are shorter */
+
+typedef struct out_record {		/* a line for the writer */
+	size_t text;			/* bytes of text before it */
+	int header;			/* print_header(), not print_rates() */
+	time_t t;
+	char name[OUTREC_NAME];
+	nicrates_t rates;
+} outrec_t;
+
+typedef struct outbuf {
+	char *data;			/* text printed by the main thread */
+	size_t len;
+	size_t size;			/* allocated */
+	outrec_t *recs;			/* lines, in order with the text */
+	int nrecs;
+	int maxrecs;			/* allocated */
+} outbuf_t;
+
+static int g_async;			/* -A: backlog, in samples */
+static FILE *g_async_mem;		/* open_memstream(), g_output.fp */
+static char *g_async_mem_buf;
+static size_t g_async_mem_len;
+static outrec_t *g_async_recs;		/* this sample's, so far */
+static int g_async_nrecs;
+static int g_async_maxrecs;		/* allocated */
+static outbuf_t **g_async_ring;		/* committed, g_async slots */
+static uint32_t g_async_head;		/* written by the producer */
+static uint32_t g_async_tail;		/* by either, with CAS */
+static outbuf_t **g_async_free;		/* written, g_async + 2 slots */
+static uint32_t g_async_free_head;	/* written by the writer */
+static uint32_t g_async_free_tail;	/* by the producer */
+static uint64_t g_async_dropped;	/* samples, in total */
+static int g_async_done;
+static sem_t g_async_sem;		/* posted once per commit */
+static pthread_t g_async_thread;
+
+#ifdef USE_URING
+/*
+ * Batched reads (-Q).  The /proc files read every sample are read
+ * together through an io_uring: one io_uring_enter() submits a read of
+ * each and waits for them all, then another for those not yet at EOF
+ * (a /proc read returns no more than a page or so), and so on.
+ * load_proc_file() adds each file the first time it reads it, and
+ * after that returns what uring_read_all() read.  The buffers are
+ * registered, to be read with READ_FIXED, if RLIMIT_MEMLOCK allows.
+ */
+#define	URING_FILES	16		/* also the ring size */
+
+typedef struct uring_file {
+	int fd;
+	char **bufp;			/* load_proc_file()'s */
+	int *sizep;
+	int len;			/* read so far */
+	int done;			/* at EOF */
+	int loaded;			/* by uring_read_all(), not yet used */
+} uringfile_t;
+
+typedef struct uring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	int fixed;			/* registered buffers, if B_TRUE */
+	struct iovec iov[URING_FILES];	/* ... these */
+} uring_t;
+
+static uring_t g_uring = {
+	-1, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	B_FALSE, { { NULL, 0 } }
+};
+static uringfile_t g_uring_files[URING_FILES];
+static int g_uring_nfiles;
+#endif /* USE_URING */
+
+/*
+ * Output sinks (-o).  Each writes interface statistics to a file, or
+ * "-" for standard output, in its own format, every so many intervals.
+ * Its rates come from the counters at its own previous output, so over
+ * a longer interval they are the exact average, and nothing is read
+ * from the system more than once per interval.
+ */
+#define	MAX_SINKS	8
+#define	SINK_MAGIC	0x4e534331	/* "NSC1" */
+#define	SINK_VERSION	1
+
+typedef enum sink_format {
+	SINK_TEXT,			/* as STYLE_FULL */
+	SINK_EXTENDED,			/* as STYLE_EXTENDED */
+	SINK_PARSEABLE,			/* as STYLE_PARSEABLE */
+	SINK_EXTENDED_PARSEABLE,	/* as STYLE_EXTENDED_PARSEABLE */
+	SINK_JSON,			/* an object per interface per line */
+	SINK_BINARY			/* sinkrec_t counter records */
+} sinkformat_t;
+
+typedef struct sink {
+	sinkformat_t format;
+	char *path;
+	output_t out;			/* fp is NULL for stdout */
+	int seconds;			/* its interval */
+	int every;			/* base intervals per output */
+	int count;			/* base intervals since the last */
+	time_t period;			/* -W: seconds / its interval */
+} sink_t;
+
+typedef struct sink_file_hdr {		/* start of a binary capture */
+	uint32_t magic;			/* SINK_MAGIC */
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t counters;		/* STORE_COUNTERS */
+} sinkfilehdr_t;
+
+typedef struct sink_record {		/* one interface, one sample */
+	int64_t ms;			/* since the epoch */
+	uint64_t speed;
+	uint32_t duplex;
+	uint32_t reserved;
+	char name[40];
+	uint64_t c[STORE_COUNTERS];	/* in store_counters() order */
+} sinkrec_t;
+
+static sink_t g_sinks[MAX_SINKS];
+static int g_nsinks;
+
+/*
+ * State file (-P).  This keeps the latest counters of every interface,
+ * so that a run can start from those left by the previous one instead
+ * of from boot; "nicstat -P file" then prints true rates since it was
+ * last run, without sleeping.  The file is mapped, and updated in
+ * place each sample, under flock(2) as runs may overlap.  A saved
+ * baseline is only used if it is from this boot, for the same ifindex
+ * (not a since re-created interface of the same name), older than the
+ * new sample, and no counter has gone backwards.  With -L, the moving
+ * averages are saved too (after they are updated, when printing), and
+ * taken up with the baseline if they were of it and of the same spans.
+ */
+#define	STATE_MAGIC		0x4e535331	/* "NSS1" */
+#define	STATE_VERSION		2
+#define	STATE_MIN_ENTRIES	16
+#define	STATE_BOOT_SLOP		5	/* seconds /proc/uptime may jitter */
+
+typedef struct state_hdr {
+	uint32_t magic;			/* STATE_MAGIC */
+	uint32_t version;
+	uint32_t entry_size;
+	uint32_t nentries;		/* in use */
+	uint32_t capacity;		/* that the file has room for */
+	uint32_t reserved;
+	uint64_t boot_time;		/* when they were saved */
+} statehdr_t;
+
+typedef struct state_entry {
+	char name[40];
+	uint32_t ifindex;
+	uint32_t reserved;
+	int64_t ms;			/* of the sample, since the epoch */
+	uint64_t c[STORE_COUNTERS];	/* in store_counters() order */
+	int64_t ewma_ms;		/* -L: sample the averages are of */
+	int32_t ewma_spans[EWMA_SPANS];	/* their spans; 0 if unused */
+	uint32_t reserved2;
+	double ewma[EW_COUNT][EWMA_SPANS];
+} stateentry_t;
+
+static char *g_state_file;		/* -P */
+static int g_state_fd = -1;
+static statehdr_t *g_state;		/* mapped */
+static size_t g_state_size;		/* bytes mapped */
+
+/*
+ * Self-instrumentation (-d).  The wall and CPU time of each phase of a
+ * sample are added up with clock_gettime(), and printed after it with
+ * the read and write system calls made (from /proc/self/io), the ioctls
+ * made, the maximum RSS and how late the sample was started.  Each
+ * phase costs a pair of clock reads.
+ */
+enum phase {
+	PH_READ,			/* read /proc/net/dev */
+	PH_PARSE,			/* parse it */
+	PH_SPEED,			/* get_speed_duplex(), get_coalesce() */
+	PH_SNMP,			/* load_snmp(), load_netstat() */
+	PH_OTHER,			/* -D, -C, -I, -q, -b sources */
+	PH_RECORD,			/* -w, -P, -o */
+	PH_PRINT,			/* print_stats() */
+	PH_COUNT
+};
+
+#define	DIAG_TEXT	1
+#define	DIAG_JSON	2
+
+typedef struct phase_time {
+	int64_t wall;			/* ns */
+	int64_t cpu;
+} phasetime_t;
+
+static int g_diag;			/* -d: DIAG_TEXT or DIAG_JSON */
+static int g_timing;			/* time the phases, for -d or -E */
+static phasetime_t g_phases[PH_COUNT];	/* this sample */
+static uint64_t g_ioctls;		/* SIOCETHTOOL made, ever */
+static int64_t g_late;			/* ns the sample started late */
+static int g_self_io_fd = -1;		/* /proc/self/io */
+static char *g_phase_names[PH_COUNT] = {
+	"read", "parse", "speed", "snmp", "other", "record", "print"
+};
+#endif /* OS_LINUX */
+
 typedef struct if_list {
 	struct if_list *next;
 	char *name;
@@ -234,6 +853,11 @@ typedef struct if_list {
 #define	NIC_NO_KSTATS		0x00000200	/* Can't even get packets */
 #define	NIC_NO_LINKSTATE	0x00000400	/* No :::link_state */
 #define	NIC_NO_GSET		0x00000800	/* ETHTOOL_GSET fails */
+#define	NIC_NO_GCOALESCE	0x00002000	/* ETHTOOL_GCOALESCE fails */
+#define	NIC_SELECTION		0x00004000	/* NIC_IGNORED is valid */
+#define	NIC_IGNORED		0x00008000	/* excluded by -i */
+#define	NIC_GROUPS_KNOWN	0x00100000	/* nicdata.groups is valid */
+#define	NIC_SPEED_LISTED	0x00200000	/* speed is from -S */
 #define	NIC_NO_SFLAG		0x00000200	/* No -S for this i'face */
 #define	NIC_UP		(NIC_KS_UP | NIC_LIF_UP)
 
@@ -259,6 +883,8 @@ struct if_speed_list {
 	int duplex;
 };
 static struct if_speed_list *g_if_speed_list = NULL;
+static int g_speed_auto = B_FALSE;	/* -S auto */
+static long g_speed_auto_ms = 500;	/* of sysfs reads per sample */
 #endif /* OS_LINUX */
 
 /*
@@ -273,19 +899,25 @@ enum { STYLE_FULL = 0, STYLE_FULL_UTIL, STYLE_SUMMARY, STYLE_PARSEABLE,
 	STYLE_EXTENDED_PARSEABLE, STYLE_NONE };
 
 static int g_nicdata_count = 0;		/* number of if's we are tracking */
+static time_t g_sample_time;		/* of the sample being printed */
 static int g_style;			/* output style */
 static int g_skipzero;			/* skip zero value lines */
 static int g_nonlocal;			/* list only non-local (exclude lo0) */
 static int g_someif;			/* trace some interfaces only */
 static int g_list;
 static int g_udp;			/* show UDP stats */
+static int g_udp_sock;			/* show UDP drops & sockets */
+static int g_softnet;			/* show per-CPU softnet stats */
+static int g_irq;			/* show NIC interrupt distribution */
+static int g_coalesce;			/* show interrupt coalescing */
+static int g_qdisc;			/* show qdisc statistics */
+static int g_bond;			/* show bonds with their members */
 static int g_tcp;			/* show TCP stats */
 static int g_opt_x;
 static int g_opt_p;
 static int g_verbose;
 static int g_forever;			/* run forever */
-static char **g_tracked;		/* tracked interfaces */
-static int g_line;			/* output line counter */
+static uint64_t g_allocs;		/* allocate() and new_string() calls */
 static char *g_progname;			/* ptr to argv[0] */
 static int g_caught_cont;		/* caught SIGCONT - were suspended */
 static int g_opt_m;			/* show results in Mbps (megabits) */
@@ -311,9 +943,25 @@ static dladm_handle_t g_handle = NULL;
 #endif /* OS_SOLARIS */
 
 #ifdef OS_LINUX
+static char *g_proc_root = "";		/* -X: where /proc and /sys are */
+static int g_uring_wanted;		/* -Q: read /proc with io_uring */
+static int g_align;			/* -W: sample on the wall clock */
+static struct timespec g_tick;		/* -W: when this sample was due */
+static int64_t g_skew;			/* -W: us it was taken after that */
+static int g_bench_samples;		/* -E: samples to time */
+static int g_bench_ifs;			/* -E: interfaces to make up */
+static char *g_bench_dir;		/* where they were made up */
 static unsigned long g_boot_time;	/* when we booted */
-static FILE *g_snmp = NULL;
-static FILE *g_netstat = NULL;
+static struct timeval g_boot_tv;	/* ... to the 1/100s uptime gives */
+static int g_snmp_fd = -1;		/* PROC_NET_SNMP_PATH */
+static int g_netstat_fd = -1;		/* PROC_NET_NETSTAT_PATH */
+static int g_udp_fd = -1;		/* PROC_NET_UDP_PATH */
+static int g_udp6_fd = -1;		/* PROC_NET_UDP6_PATH */
+static int g_softnet_fd = -1;		/* PROC_NET_SOFTNET_PATH */
+static int g_interrupts_fd = -1;	/* PROC_INTERRUPTS_PATH */
+static int g_rtnl = -1;			/* rtnetlink socket */
+static int g_rtnl_events = -1;		/* rtnetlink RTMGRP_LINK listener */
+static uint32_t g_rtnl_seq;
 #endif /* OS_LINUX */
 
 /*
@@ -356,15 +1004,22 @@ static void
 usage(void)
 {
 	(void) fprintf(stderr,
-	    "USAGE: nicstat [-hvnsxpztualMU] [-i int[,int...]]\n   "
+	    "USAGE: nicstat [-hvnsxpztualMU] [-i int[,int...]] [-T n[:key]]\n   "
+	    "[-L span[,span...]] [-g name[=int[,int...]]] [-H file[,file...]]\n   "
+	    "[-w dir[:MB]] "
 #ifdef OS_LINUX
-	    "[-S int:mbps[,int:mbps...]] "
+	    "[-S int:mbps[,int:mbps...]] [-DCIcqb]\n   "
+	    "[-r dir[:peak] [-R from[,to]]] [-A n] [-o format[:secs]=file]\n   "
+	    "[-P file] [-d text|json] "
+	    "[-B procfs|sysfs|rtnetlink] [-Q] [-X root] [-W]\n   "
+	    "[-E samples[:interfaces[:threads]]] "
 #endif
 	    "[interval [count]]\n"
 	    "\n"
 	    "         -h                 # help\n"
 	    "         -v                 # show version (" NICSTAT_VERSION ")\n"
-	    "         -i interface       # track interface only\n"
+	    "         -i interface       # track interface only; may be a\n"
+	    "                            # glob, or \"!glob\" to exclude\n"
 	    "         -n                 # show non-local interfaces only"
 					" (exclude lo0)\n"
 	    "         -s                 # summary output\n"
@@ -373,13 +1028,59 @@ usage(void)
 	    "         -z                 # skip zero value lines\n"
 	    "         -t                 # show TCP statistics\n"
 	    "         -u                 # show UDP statistics\n"
+#ifdef OS_LINUX
+	    "         -D                 # show UDP drops & busiest sockets\n"
+	    "         -C                 # show per-CPU softnet statistics\n"
+	    "         -I                 # show interface interrupts per CPU\n"
+	    "         -c                 # show packets per interrupt and\n"
+	    "                            # interrupt coalescing settings\n"
+	    "         -q                 # show queueing discipline statistics\n"
+	    "         -b                 # show bonds, with their members\n"
+#endif
 	    "         -a                 # equivalent to \"-x -u -t\"\n"
 	    "         -l                 # list interface(s)\n"
 	    "         -M                 # output in Mbits/sec\n"
 	    "         -U                 # separate %%rUtil and %%wUtil\n"
+	    "         -T n[:key]         # show the n busiest interfaces only,\n"
+	    "                            # by bytes, util, pps, errors or sat\n"
+	    "         -g name[=int,...]  # add a line totalling the listed\n"
+	    "                            # interfaces (default all); repeatable\n"
+	    "         -w dir[:MB]        # also record counters to a store\n"
+	    "                            # of at most MB (default 64)\n"
+#ifdef OS_LINUX
+	    "         -r dir[:peak]      # print statistics recorded by -w,\n"
+	    "                            # or the peak rates of each interval\n"
+	    "         -R from[,to]       # ... for this time range; epoch\n"
+	    "                            # seconds or -N[smhd] ago\n"
+	    "         -A n               # write output from a thread, keeping\n"
+	    "                            # at most n samples if it stalls\n"
+	    "         -o fmt[:secs]=file # also write to file (- for stdout)\n"
+	    "                            # every secs, as text, extended,\n"
+	    "                            # [x]parseable, json or binary\n"
+	    "         -P file            # keep counters in file, and start\n"
+	    "                            # from those of the previous run\n"
+	    "         -d text|json       # also print nicstat's own costs\n"
+	    "         -B collector       # read interface statistics from\n"
+	    "                            # procfs, sysfs or rtnetlink, not\n"
+	    "                            # the cheapest of them\n"
+	    "         -Q                 # read /proc files together, with\n"
+	    "                            # io_uring\n"
+	    "         -X root            # read /proc and /sys below root\n"
+	    "         -W                 # sample on multiples of the\n"
+	    "                            # interval by the wall clock\n"
+	    "         -E n[:ifs[:thr]]   # time n samples back to back, of\n"
+	    "                            # ifs made-up interfaces if given,\n"
+	    "                            # parsing them with thr threads\n"
+#endif
+	    "         -L span[,span...]  # add moving averages of KB/s, Pk/s\n"
+	    "                            # and %%Util over spans intervals\n"
+	    "         -H file[,file...]  # print rate percentiles at exit or\n"
+	    "                            # SIGUSR1; merge & save to file\n"
 #ifdef OS_LINUX
 	    "         -S int:mbps[fd|hd] # tell nicstat the interface\n"
 	    "                            # speed (Mbits/sec) and duplex\n"
+	    "         -S auto[:ms]       # ... as read from sysfs, for up to\n"
+	    "                            # ms (500) each interval\n"
 #endif
 	    "    eg,\n");
 	(void) fprintf(stderr,
@@ -388,7 +1089,8 @@ usage(void)
 	    "       nicstat 1 5          # print 5 times only\n"
 	    "       nicstat -z 1         # print every 1 second, skip zero"
 					" lines\n"
-	    "       nicstat -i hme0 1    # print hme0 only every 1 second\n");
+	    "       nicstat -i hme0 1    # print hme0 only every 1 second\n"
+	    "       nicstat -i 'e*,!eth1' 1  # print e* except eth1\n");
 	exit(1);
 }
 
@@ -403,6 +1105,7 @@ new_string(char *s)
 	new = strdup(s);
 	if (! new)
 		die(1, "strdup", g_progname);
+	g_allocs++;
 	return (new);
 }
 
@@ -417,8 +1120,28 @@ allocate(size_t bytes)
 	p = calloc(1, bytes);
 	if (p == NULL)
 		die(1, "calloc");
+	g_allocs++;
+	return (p);
+}
+
+#ifdef OS_LINUX
+/*
+ * proc_path() -	A /proc or /sys path, below the -X root if there is
+ *			one
+ */
+static char *
+proc_path(char *path)
+{
+	char *p;
+
+	if (*g_proc_root == '\0')
+		return (path);
+	p = allocate(strlen(g_proc_root) + strlen(path) + 1);
+	(void) strcpy(p, g_proc_root);
+	(void) strcat(p, path);
 	return (p);
 }
+#endif /* OS_LINUX */
 
 /*
  * Return floating difference in timevals
@@ -435,20 +1158,236 @@ tv_diff(struct timeval *new, struct timeval *old)
 	return (new_d - old_d);
 }
 
+inline static double
+max(double d1, double d2)
+{
+	if (d1 > d2)
+		return (d1);
+	return (d2);
+}
+
+inline static double
+min(double d1, double d2)
+{
+	if (d1 < d2)
+		return (d1);
+	return (d2);
+}
+
+/*
+ * nic_tdiff - return the time between an interface's old and new samples
+ */
+static double
+nic_tdiff(struct nicdata *nicp)
+{
+	double tdiff;
+
+#ifdef OS_LINUX
+	if (nicp->old.tv.tv_sec == 0)
+		/* Not initialised, so numbers will be since boot */
+		nicp->old.tv = g_boot_tv;
+#endif
+	tdiff = tv_diff(&nicp->new.tv, &nicp->old.tv);
+	if (tdiff == 0)
+		tdiff = 1;
+	return (tdiff);
+}
+
+/*
+ * Interface selection (-i, -g).  Each pattern is a shell-style glob
+ * ("eth*", "bond[0-9]", "en?1"), optionally prefixed by "!" to exclude
+ * matching interfaces.  The patterns are compiled once into a trie keyed
+ * on their literal prefixes (the text up to the first wildcard), so an
+ * interface name is walked through the trie a character at a time and
+ * only the patterns hanging off the nodes it passes need any glob
+ * matching.  Plain interface names become exact-match trie leaves.
+ */
+typedef struct if_pattern {
+	struct if_pattern *next;	/* next with the same prefix */
+	char *glob;			/* remainder after the prefix */
+	int exclude;			/* "!pattern" */
+} ifpattern_t;
+
+typedef struct if_trie {
+	struct if_trie *child;		/* first child */
+	struct if_trie *sibling;	/* next child of our parent */
+	char c;				/* character leading here */
+	ifpattern_t *patterns;		/* patterns whose prefix ends here */
+} iftrie_t;
+
+typedef struct if_match {
+	iftrie_t root;
+	int includes;			/* number of non-"!" patterns */
+} ifmatch_t;
+
+static ifmatch_t g_if_match;		/* -i patterns */
+
+/*
+ * Interface groups (-g), each printed as a line summing its members
+ */
+#define	MAX_GROUPS	32		/* bits in nicdata.groups */
+
+typedef struct nic_group {
+	char *name;
+	ifmatch_t match;
+	int all;			/* no patterns, so all but loopback */
+	nicrates_t sum;			/* of this sample's members */
+	nicrates_t load;		/* bytes/s each way, for %Util */
+	uint64_t speed;			/* summed speed of the members */
+	int members;
+} nicgroup_t;
+
+static nicgroup_t g_groups[MAX_GROUPS];
+
+/*
+ * glob_match() -	Match a string against a shell-style glob, supporting
+ *			"*", "?", "[set]", "[a-z]" and "[!set]"
+ */
+static int
+glob_match(char *glob, char *s)
+{
+	char *star_g, *star_s;
+	char *p;
+	int negate, found;
+
+	star_g = star_s = NULL;
+	while (*s) {
+		switch (*glob) {
+		case '*':
+			/* Remember where to backtrack to */
+			star_g = ++glob;
+			star_s = s;
+			continue;
+		case '?':
+			glob++;
+			s++;
+			continue;
+		case '[':
+			p = glob + 1;
+			negate = (*p == '!' || *p == '^');
+			if (negate)
+				p++;
+			found = B_FALSE;
+			while (*p && *p != ']') {
+				if (p[1] == '-' && p[2] && p[2] != ']') {
+					if (*s >= p[0] && *s <= p[2])
+						found = B_TRUE;
+					p += 3;
+				} else if (*p++ == *s)
+					found = B_TRUE;
+			}
+			if (*p == ']') {
+				if (found == negate)
+					break;
+				glob = p + 1;
+				s++;
+				continue;
+			}
+			/* No closing "]", so it is just a character */
+			/* FALLTHROUGH */
+		default:
+			if (*glob == *s) {
+				glob++;
+				s++;
+				continue;
+			}
+			break;
+		}
+		/* Mismatch; let the last "*" swallow one more character */
+		if (star_g == NULL)
+			return (B_FALSE);
+		glob = star_g;
+		s = ++star_s;
+	}
+	while (*glob == '*')
+		glob++;
+	return (*glob == '\0');
+}
+
+/*
+ * compile_if_patterns() -	Add a list of patterns to a matcher's trie
+ */
+static void
+compile_if_patterns(ifmatch_t *mp, char **list)
+{
+	iftrie_t *node, *cp;
+	ifpattern_t *pat;
+	char *s;
+
+	for (; *list; list++) {
+		pat = allocate(sizeof (ifpattern_t));
+		s = *list;
+		if (*s == '!') {
+			pat->exclude = B_TRUE;
+			s++;
+		} else
+			mp->includes++;
+		/* Descend the literal prefix, adding nodes as needed */
+		node = &mp->root;
+		for (; *s && ! strchr("*?[", *s); s++) {
+			for (cp = node->child; cp; cp = cp->sibling)
+				if (cp->c == *s)
+					break;
+			if (cp == NULL) {
+				cp = allocate(sizeof (iftrie_t));
+				cp->c = *s;
+				cp->sibling = node->child;
+				node->child = cp;
+			}
+			node = cp;
+		}
+		pat->glob = s;
+		pat->next = node->patterns;
+		node->patterns = pat;
+	}
+}
+
+/*
+ * if_matches() -	Return true if an interface name matches any pattern
+ *			(or there are only "!" patterns) and does not match
+ *			any "!" pattern
+ */
+static int
+if_matches(ifmatch_t *mp, char *if_name)
+{
+	iftrie_t *node;
+	ifpattern_t *pat;
+	char *s;
+	int included;
+
+	included = (mp->includes == 0);
+	node = &mp->root;
+	for (s = if_name; ; s++) {
+		for (pat = node->patterns; pat; pat = pat->next) {
+			if (pat->exclude == B_FALSE && included)
+				continue;
+			if (*pat->glob == '\0' ? *s == '\0' :
+			    glob_match(pat->glob, s)) {
+				if (pat->exclude)
+					return (B_FALSE);
+				included = B_TRUE;
+			}
+		}
+		if (*s == '\0')
+			break;
+		for (node = node->child; node; node = node->sibling)
+			if (node->c == *s)
+				break;
+		if (node == NULL)
+			break;
+	}
+	return (included);
+}
+
 /*
  * if_is_ignored - return true if interface is to be ignored
  */
 static int
 if_is_ignored(char *if_name)
 {
-	char **p;
-
 	if (! g_someif)
 		return (B_FALSE);
-	for (p = g_tracked; *p; p++)
-		if (streql(if_name, *p))
-			return (B_FALSE);
-	return (B_TRUE);
+	return (! if_matches(&g_if_match, if_name));
 }
 
 #ifdef OS_SOLARIS
@@ -634,28 +1573,49 @@ fetch_boot_time()
 
 #ifdef OS_LINUX
 /*
- * fetch_boot_time - return the boot time in secs.
+ * set_boot_tv - set g_boot_tv from the uptime in /proc, as of *now.
  *
- * Gets the boot time from /proc.
+ * Given the time a sample was taken, its since-boot rates are over
+ * exactly the uptime.
  */
-static unsigned long
-fetch_boot_time()
+static void
+set_boot_tv(struct timeval *now)
 {
-	char buf[64];
-	int uptime_fd, bufsiz, scanned;
-	unsigned long uptime;
+	char buf[64], *end;
+	int uptime_fd, bufsiz;
+	double uptime;
+	int64_t us;
 
-	uptime_fd = open(PROC_UPTIME, O_RDONLY, 0);
+	uptime_fd = open(proc_path(PROC_UPTIME), O_RDONLY, 0);
 	if (uptime_fd < 0)
 		die(1, "error opening %s for read", PROC_UPTIME);
 	bufsiz = read(uptime_fd, buf, sizeof (buf) - 1);
 	if (bufsiz < 0)
 		die(1, "read: %s", PROC_UPTIME);
+	(void) close(uptime_fd);
 	buf[bufsiz] = '\0';
-	scanned = sscanf(buf, "%lu.", &uptime);
-	if (scanned != 1)
+	uptime = strtod(buf, &end);
+	if (end == buf)
 		die(0, "cannot get uptime from %s", PROC_UPTIME);
-	return (time(0) - uptime);
+	us = (int64_t)now->tv_sec * 1000000 + now->tv_usec -
+	    (int64_t)(uptime * 100 + 0.5) * 10000;
+	g_boot_tv.tv_sec = us / 1000000;
+	g_boot_tv.tv_usec = us % 1000000;
+}
+
+/*
+ * fetch_boot_time - return the boot time in secs.
+ *
+ * Gets the boot time from /proc.
+ */
+static unsigned long
+fetch_boot_time()
+{
+	struct timeval now;
+
+	(void) gettimeofday(&now, NULL);
+	set_boot_tv(&now);
+	return (g_boot_tv.tv_sec);
 }
 #endif /* OS_LINUX */
 
@@ -1255,82 +2215,120 @@ update_nicdata_list()
 #endif /* OS_SOLARIS */
 
 #ifdef OS_LINUX
+/*
+ * The nicdata list is also hashed by name, so that an interface not
+ * where find_nicdatap() expects it in the list (as when interfaces come
+ * and go, or are read in another order) is still found without a search
+ * of the whole list.  Open addressing, with at most half the slots used.
+ */
+static struct nicdata **g_nic_hash;
+static int g_nic_hash_size;		/* power of 2 */
+static int g_nic_hash_count;
+
+/*
+ * nic_hash_name() -	FNV-1a hash of an interface name
+ */
+static uint32_t
+nic_hash_name(char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619U;
+	return (h);
+}
+
+/*
+ * nic_hash_lookup() -	Find an interface by name; NULL if it is new
+ */
+static struct nicdata *
+nic_hash_lookup(char *if_name)
+{
+	struct nicdata *p;
+	int h;
+
+	if (g_nic_hash == NULL)
+		return (NULL);
+	h = nic_hash_name(if_name) & (g_nic_hash_size - 1);
+	while ((p = g_nic_hash[h]) != NULL) {
+		if (streql(p->name, if_name))
+			return (p);
+		h = (h + 1) & (g_nic_hash_size - 1);
+	}
+	return (NULL);
+}
+
+/*
+ * nic_hash_add() -	Hash a new interface, growing the table as needed
+ */
+static void
+nic_hash_add(struct nicdata *nicp)
+{
+	struct nicdata **old;
+	int old_size, h, i;
+
+	if (g_nic_hash_size < (g_nic_hash_count + 1) * 2) {
+		old = g_nic_hash;
+		old_size = g_nic_hash_size;
+		g_nic_hash_size = old_size ? old_size * 2 : 256;
+		g_nic_hash = allocate(g_nic_hash_size *
+		    sizeof (struct nicdata *));
+		g_nic_hash_count = 0;
+		for (i = 0; i < old_size; i++)
+			if (old[i] != NULL)
+				nic_hash_add(old[i]);
+		free(old);
+	}
+	h = nic_hash_name(nicp->name) & (g_nic_hash_size - 1);
+	while (g_nic_hash[h] != NULL)
+		h = (h + 1) & (g_nic_hash_size - 1);
+	g_nic_hash[h] = nicp;
+	g_nic_hash_count++;
+}
+
 /*
  * find_nicdatap - find a struct nicdata * from linked list
  *
- * We search the linked list starting from *lastp (or *headp if *lastp
- * is NULL).  All entries are searched until either:
- *
- * - matching if_name found, and we return the struct pointer
- *
- * - no match, so we initialise a new struct, add to the end of
- *   the list (or after *lastp if non-null) and return a pointer to it
+ * Interfaces are usually read in the order of the list, so the entry
+ * after *lastp (or *headp if *lastp is NULL) is tried first; then the
+ * name hash.  If there is no match, we initialise a new struct, add it
+ * to the end of the list (or after *lastp if non-null) and return a
+ * pointer to it.  The list at *headp is always g_nicdatap, which the
+ * hash is of.
  *
  * SIDE EFFECT - *lastp is always set to a pointer to the
  * matched (or newly-created) struct.  This allows an efficient
  * sequential update of the list.
  */
-
-enum search_state {HEAD, LAST, LAST_LOOPED};
-
 static struct nicdata *
 find_nicdatap(struct nicdata **headp, struct nicdata **lastp, char *if_name)
 {
-	struct nicdata *prevp, *p;
-	enum search_state state;
-
-	prevp = NULL;
-
-	if (*lastp && (*lastp)->next) {
-		state = LAST;
-		p = (*lastp)->next;
-	} else {
-		state = HEAD;
-		p = *headp;
-	}
-	while (p) {
-		/* Check for a match */
-		if (streql(p->name, if_name)) {
-			/* We have a match */
-			*lastp = p;
-			return (p);
-		}
-		prevp = p;
-		p = p->next;
-		if (p == NULL) {
-			switch (state) {
-			case HEAD:
-			case LAST_LOOPED:
-				/* Will terminate loop */
-				break;
-			case LAST:
-				/* Start from head */
-				state = LAST_LOOPED;
-				p = *headp;
-				break;
-			}
-		} else
-			if (state == LAST_LOOPED &&
-			    p == *lastp)
-				/* No match */
-				break;
+	struct nicdata *p;
+
+	p = *lastp ? (*lastp)->next : *headp;
+	if (p == NULL || ! streql(p->name, if_name))
+		p = nic_hash_lookup(if_name);
+	if (p != NULL) {
+		*lastp = p;
+		return (p);
 	}
 
 	/* We get here if we have no match */
 	p = allocate(sizeof (struct nicdata));
 	p->name = new_string(if_name);
+	nic_hash_add(p);
 
-	if (state == HEAD) {
-		/* prevp will point to the last struct in the list */
-		if (prevp)
-			prevp->next = p;
-		else
-			*headp = p;
-	} else {
+	if (*lastp) {
 		/* Insert new entry after **lastp */
-		prevp = (*lastp)->next;
+		p->next = (*lastp)->next;
+		(*lastp)->next = p;
+	} else if (*headp == NULL) {
+		*headp = p;
+	} else {
+		/* At the end */
+		for (*lastp = *headp; (*lastp)->next; *lastp = (*lastp)->next)
+			;
 		(*lastp)->next = p;
-		p->next = prevp;
 	}
 
 	*lastp = p;
@@ -1377,6 +2375,7 @@ update_stats()
 	struct timeval now_tv;
 
 	(void) gettimeofday(&now_tv, NULL);
+	g_sample_time = now_tv.tv_sec;
 
 	if (g_tcp) {
 		/* Update TCP stats */
@@ -1464,7 +2463,12 @@ update_stats()
 			nicp->new.sat += fetch32(nicp->op_ksp, "noxmtbuf", 0);
 			break;
 		}
-		nicp->speed = fetch64(nicp->op_ksp, "ifspeed", 0);
+		if ((g_hist || g_store_dir || g_top_key == TOP_ERRORS) &&
+		    ! g_opt_x) {
+			nicp->new.ierr = fetch32(nicp->op_ksp, "ierrors", 0);
+			nicp->new.oerr = fetch32(nicp->op_ksp, "oerrors", 0);
+		}
+		nicp->speed = fetch64(nicp->op_ksp, "ifspeed", 0);
 		nicp->duplex = fetch32(nicp->op_ksp, "link_duplex", 0);
 	}
 
@@ -1473,963 +2477,6623 @@ update_stats()
 
 #ifdef OS_LINUX
 /*
- * load_netstat() -	Reads PROC_NET_NETSTAT_PATH to get TCP stat(s)
+ * snmp_fields() -	Get named values from a /proc/net/snmp style buffer
+ *
+ * Those files have pairs of lines, a line of field names then a line of
+ * their values, each starting with the same prefix - "Tcp: " and the
+ * like.  Fields are found by name, as kernels add and remove them; any
+ * not found are left alone.  Returns the number found.
  */
-
-static void
-load_netstat(FILE *netstat)
+static int
+snmp_fields(char *buf, char *prefix, char **names, long long *values)
 {
-	char buf[2048];
-	char *p;
-	int remaining;
-	long long ll[2];
+	char *hp, *hend, *vp, *vend, *endp;
+	int plen, len, found, i;
+	long long v;
+
+	plen = strlen(prefix);
+	hp = buf;
+	while (strncmp(hp, prefix, plen) != 0) {
+		if ((hp = strchr(hp, '\n')) == NULL)
+			return (0);
+		hp++;
+	}
+	if ((hend = strchr(hp, '\n')) == NULL)
+		return (0);
+	vp = hend + 1;
+	if (strncmp(vp, prefix, plen) != 0)
+		return (0);
+	if ((vend = strchr(vp, '\n')) == NULL)
+		vend = vp + strlen(vp);
 
-	if (fseek(netstat, 0, SEEK_SET) != 0)
-		die(1, "fseek: %s", PROC_NET_NETSTAT_PATH);
-	remaining = 1;
-	while (remaining) {
-		p = fgets(buf, sizeof (buf), netstat);
-		if (! p)
+	found = 0;
+	hp += plen;
+	vp += plen;
+	for (;;) {
+		while (*hp == ' ')
+			hp++;
+		while (*vp == ' ')
+			vp++;
+		if (hp >= hend || vp >= vend)
 			break;
-		if (g_tcp && strncmp("TcpExt: SyncookiesSent SyncookiesRecv "
-		    "SyncookiesFailed EmbryonicRsts PruneCalled RcvPruned "
-		    "OfoPruned OutOfWindowIcmps LockDroppedIcmps "
-		    "ArpFilter TW TWRecycled TWKilled PAWSPassive "
-		    "PAWSActive PAWSEstab DelayedACKs DelayedACKLocked "
-		    "DelayedACKLost ListenOverflows ListenDrops ",
-		    p, 273) == 0) {
-			/* We are after field 20 and 21 */
-			int n = fscanf(netstat, "TcpExt: %*d %*d %*d "
-				"%*d %*d %*d %*d %*d %*d %*d "
-				"%*d %*d %*d %*d %*d %*d %*d "
-				"%*d %*d %lld %lld ",
-				&ll[0], &ll[1]);
-			if (n == 2)
-				g_tcp_new->listenDrop = ll[0] + ll[1];
-			remaining--;
-		}
+		v = strtoll(vp, &endp, 10);
+		if (endp == vp)
+			break;
+		vp = endp;
+		len = strcspn(hp, " \n");
+		for (i = 0; names[i]; i++)
+			if (strncmp(hp, names[i], len) == 0 &&
+			    names[i][len] == '\0') {
+				values[i] = v;
+				found++;
+			}
+		hp += len;
 	}
+	return (found);
 }
 
+/*
+ * load_netstat() -	Reads PROC_NET_NETSTAT_PATH to get TCP stat(s)
+ */
+static void
+load_netstat(char *buf)
+{
+	static char *names[] = { "ListenOverflows", "ListenDrops", NULL };
+	long long ll[2];
+
+	if (snmp_fields(buf, "TcpExt: ", names, ll) == 2)
+		g_tcp_new->listenDrop = ll[0] + ll[1];
+}
 
 /*
  * load_snmp() -	Reads PROC_NET_SNMP_PATH to get TCP & UDP stats
  */
-
 static void
-load_snmp(FILE *snmp)
+load_snmp(char *buf)
 {
-	char buf[2048];
-	char *p;
-	int remaining;
-	long long ll[14];
-
-	/* Load TCP and/or UDP stats from /proc/net/snmp */
-	if (fseek(snmp, 0, SEEK_SET) != 0)
-		die(1, "fseek: %s", PROC_NET_SNMP_PATH);
-	remaining = 0;
-	if (g_tcp)
-		remaining++;
-	if (g_udp)
-		remaining++;
-	while (remaining) {
-		p = fgets(buf, sizeof (buf), snmp);
-		if (! p)
-			break;
-		if (g_tcp && strncmp("Tcp: RtoAlgorithm RtoMin RtoMax MaxConn "
-				"ActiveOpens PassiveOpens AttemptFails "
-				"EstabResets CurrEstab InSegs OutSegs "
-				"RetransSegs InErrs OutRsts", p, 141) == 0) {
-			int n;
-			n = fscanf(snmp, "Tcp: %lld %lld %lld %lld "
-			    "%lld %lld %lld %lld %lld %lld "
-			    "%lld %lld %lld %lld\n",
-			    &ll[0], &ll[1], &ll[2], &ll[3],
-			    &ll[4], &ll[5], &ll[6], &ll[7],
-			    &ll[8], &ll[9], &ll[10], &ll[11],
-			    &ll[12], &ll[13]);
-			if (n == 14) {
-				g_tcp_new->inDataInorderSegs = ll[9];
-				g_tcp_new->outDataSegs = ll[10];
-				g_tcp_new->estabResets = ll[7];
-				g_tcp_new->outRsts = ll[13];
-				g_tcp_new->attemptFails = ll[6];
-				/* Note: bytes */
-				g_tcp_new->retransBytes = ll[11];
-				g_tcp_new->passiveOpens = ll[5];
-				g_tcp_new->activeOpens = ll[4];
-			}
-			remaining--;
-		} else if (g_udp && strncmp("Udp: InDatagrams NoPorts "
-				"InErrors OutDatagrams RcvbufErrors "
-				"SndbufErrors\n", p, 72) == 0) {
-			int n;
-			n = fscanf(snmp, "Udp: %lld %lld %lld %lld "
-			    "%lld %lld\n",
-			    &ll[0], &ll[1], &ll[2], &ll[3],
-			    &ll[4], &ll[5]);
-			if (n == 6) {
-				g_udp_new->inDatagrams = ll[0];
-				g_udp_new->outDatagrams = ll[3];
-				g_udp_new->inErrors = ll[2]; /* + ll[4]? */
-				g_udp_new->outErrors = ll[5];
-			}
-			remaining--;
-		}
+	static char *tcp_names[] = {
+		"InSegs", "OutSegs", "EstabResets", "OutRsts",
+		"AttemptFails", "RetransSegs", "PassiveOpens", "ActiveOpens",
+		NULL
+	};
+	static char *udp_names[] = {
+		"InDatagrams", "OutDatagrams", "InErrors", "SndbufErrors",
+		"NoPorts", "RcvbufErrors",
+		/* InCsumErrors first appeared in Linux 3.10 */
+		"InCsumErrors", NULL
+	};
+	long long ll[8];
+
+	(void) memset(ll, 0, sizeof (ll));
+	if (g_tcp && snmp_fields(buf, "Tcp: ", tcp_names, ll) == 8) {
+		g_tcp_new->inDataInorderSegs = ll[0];
+		g_tcp_new->outDataSegs = ll[1];
+		g_tcp_new->estabResets = ll[2];
+		g_tcp_new->outRsts = ll[3];
+		g_tcp_new->attemptFails = ll[4];
+		/* Note: bytes */
+		g_tcp_new->retransBytes = ll[5];
+		g_tcp_new->passiveOpens = ll[6];
+		g_tcp_new->activeOpens = ll[7];
+	}
+	(void) memset(ll, 0, sizeof (ll));
+	if (g_udp && snmp_fields(buf, "Udp: ", udp_names, ll) >= 6) {
+		g_udp_new->inDatagrams = ll[0];
+		g_udp_new->outDatagrams = ll[1];
+		/* InErrors includes RcvbufErrors */
+		g_udp_new->inErrors = ll[2];
+		g_udp_new->outErrors = ll[3];
+		g_udp_new->sndbufErrors = ll[3];
+		g_udp_new->noPorts = ll[4];
+		g_udp_new->rcvbufErrors = ll[5];
+		g_udp_new->inCsumErrors = ll[6];
 	}
 }
 
 #endif /* OS_LINUX */
 
 #ifdef OS_LINUX
+#ifdef USE_URING
+/*
+ * uring_close() -	Stop using the io_uring, after a failure
+ */
 static void
-get_speed_duplex(nicdata_t *nicp)
+uring_close(char *what)
 {
-	struct ifreq ifr;
-	struct ethtool_cmd edata;
-	int status;
+	int i;
 
-	if (find_interface_speed(nicp))
-		return;
+	diag(1, "-Q: %s, reading /proc without io_uring", what);
+	(void) close(g_uring.fd);
+	g_uring.fd = -1;
+	for (i = 0; i < g_uring_nfiles; i++)
+		g_uring_files[i].loaded = B_FALSE;
+}
 
-	if (nicp->flags & NIC_NO_GSET) {
-		if (nicp->speed > 0)
-			/* Already got something */
-			return;
-		if (nicp->flags & NIC_NO_SFLAG)
-			return;
-		if (! find_interface_speed(nicp))
-			nicp->flags |= NIC_NO_SFLAG;
+/*
+ * uring_open() -	Set up the io_uring for -Q; if the kernel does not
+ *			have io_uring, or will not let us use it, carry on
+ *			without
+ */
+static void
+uring_open()
+{
+	struct io_uring_params params;
+	size_t sq_size, cq_size;
+	char *sq, *cq;
+	int fd;
+
+	(void) memset(&params, 0, sizeof (params));
+	fd = syscall(__NR_io_uring_setup, URING_FILES, &params);
+	if (fd < 0) {
+		diag(1, "-Q: io_uring_setup, reading /proc without io_uring");
 		return;
 	}
-
-	/* Try SIOCETHTOOL */
-	strncpy(ifr.ifr_name, nicp->name, sizeof (ifr.ifr_name));
-	ifr.ifr_data = (void *) &edata;
-	edata.cmd = ETHTOOL_GSET;
-	status = ioctl(g_sock, SIOCETHTOOL, &ifr);
-	if (status < 0) {
-		nicp->flags |= NIC_NO_GSET;
-		get_speed_duplex(nicp);
+	sq_size = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	cq_size = params.cq_off.cqes +
+	    params.cq_entries * sizeof (struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq_size > sq_size)
+			sq_size = cq_size;
+		cq_size = sq_size;
+	}
+	sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	cq = sq;
+	if (sq != MAP_FAILED && ! (params.features & IORING_FEAT_SINGLE_MMAP))
+		cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	g_uring.sqes = mmap(NULL,
+	    params.sq_entries * sizeof (struct io_uring_sqe),
+	    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+	    IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED ||
+	    g_uring.sqes == MAP_FAILED) {
+		diag(1, "-Q: mmap, reading /proc without io_uring");
+		(void) close(fd);
 		return;
 	}
-	nicp->speed = (long long) edata.speed * 1000000;
-	nicp->duplex = edata.duplex;
+	g_uring.sq_head = (unsigned *)(sq + params.sq_off.head);
+	g_uring.sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	g_uring.sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	g_uring.sq_array = (unsigned *)(sq + params.sq_off.array);
+	g_uring.cq_head = (unsigned *)(cq + params.cq_off.head);
+	g_uring.cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	g_uring.cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	g_uring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	g_uring.fd = fd;
 }
-#endif /* OS_LINUX */
 
-#ifdef OS_LINUX
+/*
+ * uring_file() -	Find the file load_proc_file() is reading, adding
+ *			it if it is new and there is room
+ */
+static uringfile_t *
+uring_file(int fd, char **bufp, int *sizep)
+{
+	uringfile_t *up;
+	int i;
+
+	for (i = 0; i < g_uring_nfiles; i++)
+		if (g_uring_files[i].fd == fd)
+			return (&g_uring_files[i]);
+	if (g_uring_nfiles == URING_FILES)
+		return (NULL);
+	up = &g_uring_files[g_uring_nfiles++];
+	up->fd = fd;
+	up->bufp = bufp;
+	up->sizep = sizep;
+	up->loaded = B_FALSE;
+	return (up);
+}
 
 /*
- * update_stats - update stats for interfaces we are tracking
+ * uring_register() -	(Re-)register the buffers, if any have moved
+ *
+ * Registered buffers are pinned, and count against RLIMIT_MEMLOCK; if
+ * that is too low, plain READs are used.
  */
 static void
-update_stats(int net_dev)
+uring_register()
 {
-	struct nicdata *nicp, *lastp;
-	struct timeval now_tv;
-	static int validated_format = 0;
-	static char proc_net_buffer[PROC_NET_BUFSIZ];
-	char *bufp;
-	int bufsiz, buf_remain, ret, n, skip_to_newline;
-	unsigned long long ll[16];
-	char if_name[32];
-	int loopback;
-
-	/*
-	 * Load PROC_NET_DEV
-	 */
-	if (lseek(net_dev, 0, SEEK_SET) != 0)
-		die(1, "lseek: %s", PROC_NET_DEV_PATH);
-	bufsiz = read(net_dev, (void *) proc_net_buffer,
-	    sizeof (proc_net_buffer));
-	if (bufsiz < 0)
-		die(1, "read: %s", PROC_NET_DEV_PATH);
-	else if (bufsiz < 200)
-		die(0, "%s: invalid format\n", PROC_NET_DEV_PATH);
-
-	/*
-	 * Validate if we have not previously done so
-	 */
-	if (! validated_format) {
-		if (strncmp(proc_net_buffer,
-		    "Inter-|   Receive                                   "
-		    "             |  Transmit\n"
-		    " face |bytes    packets errs drop fifo frame compressed"
-		    " multicast|bytes    packets errs drop fifo colls carrier"
-		    " compressed\n", 200) != 0)
-			die(0, "%s: invalid format\n",
-			    PROC_NET_DEV_PATH);
-		else
-			validated_format++;
+	uringfile_t *up;
+	int i, moved;
+
+	moved = B_FALSE;
+	for (i = 0; i < g_uring_nfiles; i++) {
+		up = &g_uring_files[i];
+		if (g_uring.iov[i].iov_base != *up->bufp ||
+		    g_uring.iov[i].iov_len != (size_t)*up->sizep) {
+			g_uring.iov[i].iov_base = *up->bufp;
+			g_uring.iov[i].iov_len = *up->sizep;
+			moved = B_TRUE;
+		}
 	}
+	if (! moved)
+		return;
+	if (g_uring.fixed)
+		(void) syscall(__NR_io_uring_register, g_uring.fd,
+		    IORING_UNREGISTER_BUFFERS, NULL, 0);
+	g_uring.fixed = syscall(__NR_io_uring_register, g_uring.fd,
+	    IORING_REGISTER_BUFFERS, g_uring.iov, g_uring_nfiles) == 0;
+}
 
-	/* Terminate our string */
-	bufp = proc_net_buffer + 200;
-	buf_remain = bufsiz - 200;
-	bufp[buf_remain + 1] = '\0';
-
-	(void) gettimeofday(&now_tv, NULL);
-
-	skip_to_newline = 0;
-	g_nicdata_count = 0;
-	lastp = NULL;
-	while (*bufp) {
-		if (skip_to_newline) {
-			/* Need to skip over previous data */
-			for (; *bufp; bufp++)
-				if (*bufp == '\n') {
-					bufp++;
-					break;
+/*
+ * uring_read_all() -	Read every file load_proc_file() has seen, for
+ *			it to return instead of reading
+ */
+static void
+uring_read_all()
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	uringfile_t *up;
+	unsigned tail, head;
+	int i, n, got;
+
+	for (i = 0; i < g_uring_nfiles; i++) {
+		up = &g_uring_files[i];
+		up->len = 0;
+		up->done = B_FALSE;
+		up->loaded = B_FALSE;
+	}
+	for (;;) {
+		/* Room for a page or so more in each, as load_proc_file() */
+		for (i = 0; i < g_uring_nfiles; i++) {
+			up = &g_uring_files[i];
+			if (*up->bufp == NULL) {
+				*up->sizep = PROC_NET_BUFSIZ;
+				*up->bufp = allocate(*up->sizep);
+			}
+			if (! up->done && *up->sizep - up->len < 4096) {
+				*up->sizep *= 2;
+				*up->bufp = realloc(*up->bufp, *up->sizep);
+				if (*up->bufp == NULL)
+					die(1, "realloc");
 			}
-			if (! *bufp)
-				break;
 		}
-		skip_to_newline = 1;
+		uring_register();
 
-		/* Get the interface name */
-		while (*bufp == ' ')
-			bufp++;
-		/* Check the format */
-		n = strcspn(bufp, ":");
-		if (n >= sizeof (if_name))
-			die(0, "%s: interface name too long",
-				PROC_NET_DEV_PATH);
-		(void) strncpy(if_name, bufp, n);
-		if_name[n] = '\0';
-		/*
-		 * Skip interface if not specifically interested in it
-		 */
-		if (if_is_ignored(if_name)) {
-			continue;
+		tail = *g_uring.sq_tail;
+		for (i = n = 0; i < g_uring_nfiles; i++) {
+			up = &g_uring_files[i];
+			if (up->done)
+				continue;
+			sqe = &g_uring.sqes[tail & *g_uring.sq_mask];
+			(void) memset(sqe, 0, sizeof (*sqe));
+			sqe->opcode = g_uring.fixed ? IORING_OP_READ_FIXED :
+			    IORING_OP_READ;
+			sqe->fd = up->fd;
+			sqe->addr = (uintptr_t)(*up->bufp + up->len);
+			sqe->len = *up->sizep - up->len - 1;
+			sqe->off = up->len;
+			sqe->buf_index = i;
+			sqe->user_data = i;
+			g_uring.sq_array[tail & *g_uring.sq_mask] =
+			    tail & *g_uring.sq_mask;
+			tail++;
+			n++;
 		}
-		/*
-		 * If g_nonlocal, skip "lo"
-		 */
-		loopback = streql("lo", if_name);
-		if (g_nonlocal && loopback)
-			continue;
-
-		/* Scan in values */
-		bufp += n + 1;
-		ret = sscanf(bufp, "%llu %llu %llu %llu %llu %llu %llu"
-			" %llu %llu %llu %llu %llu %llu %llu %llu %llu\n",
-			&ll[0], &ll[1], &ll[2], &ll[3], &ll[4], &ll[5],
-			&ll[6], &ll[7], &ll[8], &ll[9], &ll[10], &ll[11],
-			&ll[12], &ll[13], &ll[14], &ll[15]);
-		if (ret != 16)
-			die(0, "%s: invalid format", PROC_NET_DEV_PATH);
-		/*
-		 * Skip interface if it has never seen a packet
-		 */
-		if (ll[1] == 0 && ll[9] == 0)
-			continue;
+		if (n == 0)
+			break;
+		__atomic_store_n(g_uring.sq_tail, tail, __ATOMIC_RELEASE);
+		while (syscall(__NR_io_uring_enter, g_uring.fd, n, n,
+		    IORING_ENTER_GETEVENTS, NULL, 0) < 0)
+			if (errno != EINTR) {
+				uring_close("io_uring_enter");
+				return;
+			}
 
-		/*
-		 * OK, we'll keep this one
-		 */
-		g_nicdata_count++;
-		nicp = find_nicdatap(&g_nicdatap, &lastp, if_name);
-		nicp->new.tv.tv_sec = now_tv.tv_sec;
-		nicp->new.tv.tv_usec = now_tv.tv_usec;
-		nicp->new.rbytes = ll[0];
-		nicp->new.rpackets = ll[1];
-		nicp->new.wbytes = ll[8];
-		nicp->new.wpackets = ll[9];
-		nicp->new.sat = ll[2];
-		nicp->new.sat += ll[3];
-		nicp->new.sat += ll[11];
-		nicp->new.sat += ll[12];
-		nicp->new.sat += ll[13];
-		nicp->new.sat += ll[14];
-		if (g_opt_x) {
-			nicp->new.ierr = ll[2];
-			nicp->new.oerr = ll[10];
-			nicp->new.coll = ll[13];
+		for (got = 0; got < n; ) {
+			head = *g_uring.cq_head;
+			while (head != __atomic_load_n(g_uring.cq_tail,
+			    __ATOMIC_ACQUIRE)) {
+				cqe = &g_uring.cqes[head & *g_uring.cq_mask];
+				up = &g_uring_files[cqe->user_data];
+				if (cqe->res > 0) {
+					up->len += cqe->res;
+				} else {
+					/* load_proc_file() reads it if < 0 */
+					up->done = B_TRUE;
+					up->loaded = cqe->res == 0;
+					(*up->bufp)[up->len] = '\0';
+				}
+				head++;
+				got++;
+			}
+			__atomic_store_n(g_uring.cq_head, head,
+			    __ATOMIC_RELEASE);
+			if (got < n && syscall(__NR_io_uring_enter,
+			    g_uring.fd, 0, n - got, IORING_ENTER_GETEVENTS,
+			    NULL, 0) < 0 && errno != EINTR) {
+				uring_close("io_uring_enter");
+				return;
+			}
 		}
-		if (loopback)
-			nicp->flags |= NIC_LOOPBACK;
-		get_speed_duplex(nicp);
-		nicp->report = 1;
-	}
-	if (g_tcp || g_udp)
-		load_snmp(g_snmp);
-	if (g_tcp) {
-		g_tcp_new->tv = now_tv;
-		load_netstat(g_netstat);
 	}
-	if (g_udp)
-		g_udp_new->tv = now_tv;
 }
-#endif /* OS_LINUX */
+#endif /* USE_URING */
 
 /*
- * precision -	figure an optimal floating precision for a printf()
+ * load_proc_file() -	Read all of a /proc file into a growable buffer
+ *
+ * Many /proc files are generated on the fly, and do not have a known
+ * size; so keep reading until EOF, growing *bufp as needed.  The
+ * buffer is NUL-terminated; the length read is returned.  With -Q, it
+ * is usually already read.
  */
-static inline int
-precision(double value)
+static int
+load_proc_file(int fd, char *path, char **bufp, int *sizep)
 {
-	if (value < 100)
-		return (2);
-	else if (value < 100000)
-		return (1);
-	return (0);
+	int len, n;
+#ifdef USE_URING
+	uringfile_t *up;
+
+	if (g_uring.fd >= 0 && (up = uring_file(fd, bufp, sizep)) != NULL &&
+	    up->loaded) {
+		up->loaded = B_FALSE;
+		return (up->len);
+	}
+#endif
+
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		die(1, "lseek: %s", path);
+	if (*bufp == NULL) {
+		*sizep = PROC_NET_BUFSIZ;
+		*bufp = allocate(*sizep);
+	}
+	len = 0;
+	for (;;) {
+		if (*sizep - len < 4096) {
+			*sizep *= 2;
+			*bufp = realloc(*bufp, *sizep);
+			if (*bufp == NULL)
+				die(1, "realloc");
+		}
+		n = read(fd, *bufp + len, *sizep - len - 1);
+		if (n < 0)
+			die(1, "read: %s", path);
+		if (n == 0)
+			break;
+		len += n;
+	}
+	(*bufp)[len] = '\0';
+	return (len);
 }
 
-static inline int
-precision4(double value)
+/*
+ * udp_sock_add() -	Append a socket to a table, and hash it by inode
+ */
+static udpsock_t *
+udp_sock_add(udpsocktab_t *tab)
 {
-	if (value < 10)
-		return (2);
-	else if (value < 100)
-		return (1);
-	return (0);
+	if (tab->count == tab->size) {
+		tab->size = tab->size ? tab->size * 2 : 256;
+		tab->socks = realloc(tab->socks, tab->size * sizeof (udpsock_t));
+		if (tab->socks == NULL)
+			die(1, "realloc");
+	}
+	return (&tab->socks[tab->count++]);
 }
 
-static inline int
-precision_p(double value)
+static void
+udp_sock_hash(udpsocktab_t *tab)
 {
-	if (value < 100)
-		if (value < 10)
-			return (3);
-		else
-			return (2);
-	else if (value < 10000)
-		return (1);
-	return (0);
+	int i, h;
+
+	if (tab->hash_size < tab->count * 2) {
+		while (tab->hash_size < tab->count * 2)
+			tab->hash_size = tab->hash_size ?
+				tab->hash_size * 2 : 512;
+		free(tab->hash);
+		tab->hash = allocate(tab->hash_size * sizeof (int));
+	} else if (tab->hash)
+		(void) memset(tab->hash, 0, tab->hash_size * sizeof (int));
+	for (i = 0; i < tab->count; i++) {
+		h = tab->socks[i].inode & (tab->hash_size - 1);
+		while (tab->hash[h])
+			h = (h + 1) & (tab->hash_size - 1);
+		tab->hash[h] = i + 1;
+	}
 }
 
-static char g_timestr[16];
+static udpsock_t *
+udp_sock_lookup(udpsocktab_t *tab, uint64_t inode)
+{
+	int h, i;
+
+	if (tab->hash == NULL)
+		return (NULL);
+	h = inode & (tab->hash_size - 1);
+	while ((i = tab->hash[h]) != 0) {
+		if (tab->socks[i - 1].inode == inode)
+			return (&tab->socks[i - 1]);
+		h = (h + 1) & (tab->hash_size - 1);
+	}
+	return (NULL);
+}
 
+/*
+ * parse_udp_socks() -	Single pass parse of a /proc/net/udp{,6} buffer
+ *
+ * Each line looks like:
+ *
+ *  sl  local_address rem_address   st tx_queue rx_queue tr tm->when
+ *	retrnsmt   uid  timeout inode ref pointer drops
+ *
+ * and the addresses are hex words, in host byte order.
+ */
 static void
-update_timestr(time_t *tptr)
+parse_udp_socks(char *bufp, int family, udpsocktab_t *tab)
 {
-	struct tm *tm;
-	time_t t;
+	udpsock_t *sp, *oldp;
+	char *p, *endp, word[9];
+	int i, n, nwords, field;
+
+	nwords = (family == AF_INET6) ? 4 : 1;
+	/* Skip header */
+	p = strchr(bufp, '\n');
+	while (p && *++p) {
+		/* "sl:" */
+		p = strchr(p, ':');
+		if (! p)
+			break;
+		sp = udp_sock_add(tab);
+		(void) memset(sp, 0, sizeof (udpsock_t));
+		sp->family = family;
+		p++;
+		while (*p == ' ')
+			p++;
+		for (i = 0; i < nwords; i++) {
+			for (n = 0; n < 8 && isxdigit(p[n]); n++)
+				word[n] = p[n];
+			if (n < 8)
+				goto bad_line;
+			word[8] = '\0';
+			sp->addr[i] = strtoul(word, NULL, 16);
+			p += 8;
+		}
+		if (*p++ != ':')
+			goto bad_line;
+		sp->port = strtoul(p, &endp, 16);
+		/* rem_address & st */
+		p = endp;
+		for (field = 0; field < 2; field++) {
+			while (*p == ' ')
+				p++;
+			while (*p && *p != ' ' && *p != '\n')
+				p++;
+		}
+		sp->txq = strtoul(p, &endp, 16);
+		if (*endp != ':')
+			goto bad_line;
+		sp->rxq = strtoul(endp + 1, &p, 16);
+		/* tr:tm->when, retrnsmt, uid, timeout */
+		for (field = 0; field < 4; field++) {
+			while (*p == ' ')
+				p++;
+			while (*p && *p != ' ' && *p != '\n')
+				p++;
+		}
+		sp->inode = strtoull(p, &p, 10);
+		/* ref, pointer */
+		for (field = 0; field < 2; field++) {
+			while (*p == ' ')
+				p++;
+			while (*p && *p != ' ' && *p != '\n')
+				p++;
+		}
+		sp->drops = strtoull(p, &p, 10);
+		oldp = udp_sock_lookup(&g_usock_old, sp->inode);
+		if (oldp && oldp->drops <= sp->drops)
+			sp->ddrops = sp->drops - oldp->drops;
+		else
+			/*
+			 * New since the last sample - all its drops are;
+			 * the first sample is not shown (no baseline)
+			 */
+			sp->ddrops = sp->drops;
+		p = strchr(p, '\n');
+		continue;
 
-	if (tptr)
-		t = *tptr;
-	else
-		t = time(NULL);
-	tm = localtime(&t);
-	(void) strftime(g_timestr, sizeof (g_timestr), "%H:%M:%S", tm);
+	bad_line:
+		tab->count--;
+		p = strchr(p, '\n');
+	}
 }
 
-static uint32_t
-tcpudpstat(uint32_t new, uint32_t old)
+/*
+ * load_udp_socks() -	Read per-socket UDP stats into g_usock_new
+ */
+static void
+load_udp_socks(void)
 {
-	if (new < old)
-		return((UINT32_MAX - old) + new);
-	else
-		return(new - old);
+	static char *udp_buf = NULL, *udp6_buf = NULL;
+	static int udp_bufsiz, udp6_bufsiz;
+
+	g_usock_new.count = 0;
+	if (g_udp_fd >= 0) {
+		(void) load_proc_file(g_udp_fd, PROC_NET_UDP_PATH,
+		    &udp_buf, &udp_bufsiz);
+		parse_udp_socks(udp_buf, AF_INET, &g_usock_new);
+	}
+	if (g_udp6_fd >= 0) {
+		(void) load_proc_file(g_udp6_fd, PROC_NET_UDP6_PATH,
+		    &udp6_buf, &udp6_bufsiz);
+		parse_udp_socks(udp6_buf, AF_INET6, &g_usock_new);
+	}
+	udp_sock_hash(&g_usock_new);
 }
 
-#define	TCPSTAT(field)	tcpudpstat(((g_tcp_new)->field), ((g_tcp_old)->field))
-#define	UDPSTAT(field)	tcpudpstat(((g_udp_new)->field), ((g_udp_old)->field))
-
+/*
+ * parse_softnet() -	Parse a PROC_NET_SOFTNET_PATH buffer into
+ *			g_softnet_new; buf is modified
+ *
+ * There is one line per online CPU, of hex fields:
+ *
+ *	processed dropped time_squeeze 0 0 0 0 0 cpu_collision
+ *	received_rps flow_limit_count [backlog_len cpu_index]
+ *
+ * Older kernels lack the trailing fields; in which case the line number
+ * is taken as the CPU number (correct unless CPUs are offline).  Lines
+ * of fewer than three fields are skipped.
+ */
 static void
-print_tcp()
+parse_softnet(char *buf)
 {
-	double tdiff;
-	uint64_t resets;
-	double retrans_rate;
-	uint64_t outbytes;
-	double inkb, outkb, inseg, outseg, reset, attfail, inconn,
-		outconn, drops;
-	tcpstats_t *tsp;
+	static int warned = 0;
+	unsigned long long field[16];
+	softnetstats_t *sp;
+	char *p, *eol, *endp;
+	int n;
+
+	g_softnet_new->count = 0;
+	for (p = buf; p && *p; p = eol) {
+		if ((eol = strchr(p, '\n')) != NULL)
+			*eol++ = '\0';
+		for (n = 0; n < 16; n++) {
+			field[n] = strtoull(p, &endp, 16);
+			if (endp == p)
+				break;
+			p = endp;
+		}
+		if (n < 3) {
+			if (! warned) {
+				diag(0, "%s: skipping lines of unexpected "
+				    "format", PROC_NET_SOFTNET_PATH);
+				warned = 1;
+			}
+			continue;
+		}
+		if (g_softnet_new->count == g_softnet_new->size) {
+			g_softnet_new->size += 64;
+			g_softnet_new->cpus = realloc(g_softnet_new->cpus,
+			    g_softnet_new->size * sizeof (softnetstats_t));
+			if (g_softnet_new->cpus == NULL)
+				die(1, "realloc");
+		}
+		sp = &g_softnet_new->cpus[g_softnet_new->count];
+		(void) memset(sp, 0, sizeof (softnetstats_t));
+		sp->cpu = n >= 13 ? (int)field[12] : g_softnet_new->count;
+		sp->processed = field[0];
+		sp->dropped = field[1];
+		sp->squeezed = field[2];
+		if (n >= 10)
+			sp->rps = field[9];
+		if (n >= 11)
+			sp->flow_limit = field[10];
+		g_softnet_new->count++;
+	}
+}
 
-	if (g_tcp_old->tv.tv_sec == 0)
-		/* Not initialised */
-		g_tcp_old->tv.tv_sec = fetch_boot_time();
-		/* g_tcp_old->tv.tv_sec = g_tcp_new->tv.tv_sec - 100; */
-	tdiff = tv_diff(&g_tcp_new->tv, &g_tcp_old->tv);
-	if (tdiff == 0)
-		tdiff = 1;
+/*
+ * load_softnet() -	Read PROC_NET_SOFTNET_PATH into g_softnet_new
+ */
+static void
+load_softnet(struct timeval *now_tv)
+{
+	static char *softnet_buf = NULL;
+	static int softnet_bufsiz;
 
-	/* Header */
-	update_timestr(&(g_tcp_new->tv.tv_sec));
-	if (! g_opt_p)
-		(void) printf("%8s %7s %7s %7s %7s %5s %5s %4s %5s %5s %5s\n",
-			g_timestr, "InKB", "OutKB", "InSeg", "OutSeg",
-			"Reset", "AttF", "%ReTX", "InConn", "OutCon", "Drops");
+	(void) load_proc_file(g_softnet_fd, PROC_NET_SOFTNET_PATH,
+	    &softnet_buf, &softnet_bufsiz);
+	g_softnet_new->tv = *now_tv;
+	parse_softnet(softnet_buf);
+}
 
-	resets = (TCPSTAT(estabResets) + TCPSTAT(outRsts));
-	outbytes = TCPSTAT(outDataBytes);
+/*
+ * irq_claim() -	Record that an IRQ belongs to an interface
+ */
+static void
+irq_claim(struct nicdata *nicp, int irq)
+{
+	irqstats_t *ip;
+	int size;
 
-	inkb = (TCPSTAT(inDataInorderBytes) + TCPSTAT(inDataUnorderBytes)) /
-		1024.0 / tdiff;
-	outkb = outbytes / 1024.0 / tdiff;
-	inseg = (TCPSTAT(inDataInorderSegs) + TCPSTAT(inDataUnorderSegs)) /
-		tdiff;
-	outseg = TCPSTAT(outDataSegs) / tdiff;
-	reset = resets / tdiff;
-	attfail = TCPSTAT(attemptFails) / tdiff;
-	if (outbytes == 0)
-		retrans_rate = 0.0;
-	else
-		retrans_rate = TCPSTAT(retransBytes) * 100.0 /
-			(double)outbytes;
-	inconn = TCPSTAT(passiveOpens) / tdiff;
-	outconn = TCPSTAT(activeOpens) / tdiff;
-	drops = (TCPSTAT(halfOpenDrop) + TCPSTAT(listenDrop) +
-		TCPSTAT(listenDropQ0)) / tdiff;
+	if (irq < 0)
+		return;
+	if (irq >= g_irq_table_size) {
+		size = g_irq_table_size ? g_irq_table_size : 256;
+		while (size <= irq)
+			size *= 2;
+		g_irq_table = realloc(g_irq_table, size * sizeof (irqstats_t *));
+		if (g_irq_table == NULL)
+			die(1, "realloc");
+		(void) memset(g_irq_table + g_irq_table_size, 0,
+		    (size - g_irq_table_size) * sizeof (irqstats_t *));
+		g_irq_table_size = size;
+	}
+	if (g_irq_table[irq])
+		/* Shared, or already claimed */
+		return;
+	ip = allocate(sizeof (irqstats_t));
+	ip->nicp = nicp;
+	g_irq_table[irq] = ip;
+	nicp->irqs = realloc(nicp->irqs, (nicp->nirqs + 1) * sizeof (int));
+	if (nicp->irqs == NULL)
+		die(1, "realloc");
+	/* Keep them in order */
+	for (size = nicp->nirqs++; size > 0 && nicp->irqs[size - 1] > irq;
+	    size--)
+		nicp->irqs[size] = nicp->irqs[size - 1];
+	nicp->irqs[size] = irq;
+}
 
-#ifdef NOTDEBUG
-	double ods_rate = (g_tcp_new->outDataSegs - g_tcp_old->outDataSegs) /
-		tdiff;
-	(void) printf("old->outDataSegs = %llu, new->outDataSegs = %llu, "
-		"  tdiff = %7.2f; rate = %7.2f\n",
-		g_tcp_old->outDataSegs, g_tcp_new->outDataSegs,
-		tdiff, ods_rate);
-#endif /* DEBUG */
-	if (g_opt_p)
-		(void) printf("%ld:TCP:%.*f:%.*f:%.*f:%.*f:%.*f:%.*f:"
-			"%.*f:%.*f:%.*f:%.*f\n",
-			g_tcp_new->tv.tv_sec,
-			precision_p(inkb), inkb,
-			precision_p(outkb), outkb,
-			precision_p(inseg), inseg,
-			precision_p(outseg), outseg,
-			precision_p(reset), reset,
-			precision_p(attfail), attfail,
-			precision_p(retrans_rate), retrans_rate,
-			precision_p(inconn), inconn,
-			precision_p(outconn), outconn,
-			precision_p(drops), drops);
-	else
-		(void) printf("TCP      %7.*f %7.*f %7.*f %7.*f %5.*f %5.*f "
-			"%4.*f %6.*f %6.*f %5.*f\n",
-			precision(inkb), inkb,
-			precision(outkb), outkb,
-			precision(inseg), inseg,
-			precision(outseg), outseg,
-			precision4(reset), reset,
-			precision4(attfail), attfail,
-			precision_p(retrans_rate), retrans_rate,
-			precision4(inconn), inconn,
-			precision4(outconn), outconn,
-			precision4(drops), drops);
-	/* Flip pointers to TCP stats */
-	tsp = g_tcp_old;
-	g_tcp_old = g_tcp_new;
-	g_tcp_new = tsp;
+/*
+ * irq_read_msi() -	Claim the IRQs listed in an msi_irqs directory
+ */
+static int
+irq_read_msi(struct nicdata *nicp, char *path)
+{
+	DIR *dirp;
+	struct dirent *dp;
+	int found;
+
+	if ((dirp = opendir(path)) == NULL)
+		return (0);
+	found = 0;
+	while ((dp = readdir(dirp)) != NULL) {
+		if (! isdigit(dp->d_name[0]))
+			continue;
+		irq_claim(nicp, atoi(dp->d_name));
+		found++;
+	}
+	(void) closedir(dirp);
+	return (found);
+}
+
+/*
+ * irq_name_matches() -	Does an interrupt action name belong to name?
+ *
+ * Drivers name their vectors "<ifname>-TxRx-3", "<ifname>-rx-0",
+ * "virtio3-input.0" and the like.
+ */
+static int
+irq_name_matches(char *action, int len, char *name)
+{
+	int n;
+
+	n = strlen(name);
+	if (n == 0 || n > len || strncmp(action, name, n) != 0)
+		return (B_FALSE);
+	return (n == len || ! isalnum(action[n]));
 }
 
+/*
+ * resolve_irqs() -	Find the IRQs of interfaces we have not seen before
+ *
+ * MSI/MSI-X vectors are listed in sysfs for the interface's device (or
+ * its parent, for virtio).  Otherwise we fall back to matching the
+ * interface or device name against the actions in /proc/interrupts;
+ * which needs the unparsed /proc/interrupts data in buf.
+ */
 static void
-print_udp()
+resolve_irqs(char *buf)
 {
-	double indg, outdg, inerr, outerr;
-	udpstats_t *usp;
-	double tdiff;
+	struct nicdata *nicp;
+	char path[PATH_MAX], link[PATH_MAX], *devname, *p, *q, *endp;
+	int irq, n, len;
 
-	if (g_udp_old->tv.tv_sec == 0)
-		/* Not initialised */
-		g_udp_old->tv.tv_sec = fetch_boot_time();
-	tdiff = tv_diff(&g_udp_new->tv, &g_udp_old->tv);
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (nicp->irqs_resolved || ! nicp->report)
+			continue;
+		nicp->irqs_resolved = B_TRUE;
+		(void) snprintf(path, sizeof (path), "%s%s/%s/device/msi_irqs",
+		    g_proc_root, SYS_CLASS_NET_PATH, nicp->name);
+		if (irq_read_msi(nicp, path) > 0)
+			continue;
+		(void) snprintf(path, sizeof (path), "%s%s/%s/device/../msi_irqs",
+		    g_proc_root, SYS_CLASS_NET_PATH, nicp->name);
+		if (irq_read_msi(nicp, path) > 0)
+			continue;
+
+		/* Match names - a full parse, but only done once per NIC */
+		(void) snprintf(path, sizeof (path), "%s%s/%s/device",
+		    g_proc_root, SYS_CLASS_NET_PATH, nicp->name);
+		devname = NULL;
+		n = readlink(path, link, sizeof (link) - 1);
+		if (n > 0) {
+			link[n] = '\0';
+			devname = strrchr(link, '/');
+			devname = devname ? devname + 1 : link;
+		}
+		for (p = strchr(buf, '\n'); p && *++p; p = strchr(p, '\n')) {
+			irq = strtol(p, &endp, 10);
+			if (endp == p || *endp != ':')
+				continue;
+			/* The action name is the last word in the line */
+			len = strcspn(endp, "\n");
+			for (q = endp + len; q > endp && q[-1] != ' '; q--)
+				;
+			len = endp + len - q;
+			if (irq_name_matches(q, len, nicp->name) ||
+			    (devname && irq_name_matches(q, len, devname)))
+				irq_claim(nicp, irq);
+		}
+	}
+}
+
+/*
+ * parse_interrupts() -	Parse per-CPU counts of interface IRQs from a
+ *			PROC_INTERRUPTS_PATH buffer of len bytes
+ *
+ * /proc/interrupts has a line per IRQ, with a column per CPU; which is
+ * a lot of data on large systems.  Only the lines for IRQs we track are
+ * parsed, others are skipped with memchr().
+ */
+static void
+parse_interrupts(char *intr_buf, int len)
+{
+	static int warned = 0;
+	irqstats_t *ip;
+	uint64_t v, *counts;
+	char *p, *end;
+	int irq, ncpus, cpu;
+
+	end = intr_buf + len;
+
+	/* Header - "CPU0 CPU1 ..." */
+	ncpus = 0;
+	for (p = intr_buf; p < end && *p != '\n'; p++)
+		if (p[0] == 'C' && p[1] == 'P' && p[2] == 'U')
+			ncpus++;
+	if (ncpus == 0) {
+		if (! warned) {
+			diag(0, "%s: unexpected format, ignoring it",
+			    PROC_INTERRUPTS_PATH);
+			warned = 1;
+		}
+		return;
+	}
+	if (ncpus != g_irq_ncpus) {
+		/* First time, or CPUs came or went - start again */
+		g_irq_cpu_ids = realloc(g_irq_cpu_ids, ncpus * sizeof (int));
+		if (g_irq_cpu_ids == NULL)
+			die(1, "realloc");
+		for (irq = 0; irq < g_irq_table_size; irq++) {
+			if ((ip = g_irq_table[irq]) == NULL)
+				continue;
+			free(ip->old);
+			free(ip->new);
+			ip->old = allocate(ncpus * sizeof (uint64_t));
+			ip->new = allocate(ncpus * sizeof (uint64_t));
+			/* Will report since boot */
+			ip->primed = B_TRUE;
+		}
+		g_irq_ncpus = ncpus;
+		g_irq_tv_old.tv_sec = 0;
+	}
+	for (p = intr_buf, cpu = 0; p < end && *p != '\n'; p++)
+		if (p[0] == 'C' && p[1] == 'P' && p[2] == 'U')
+			g_irq_cpu_ids[cpu++] = atoi(p + 3);
+
+	while (p < end) {
+		/* p is at the end of the previous line */
+		p++;
+		while (*p == ' ')
+			p++;
+		irq = 0;
+		if (! isdigit(*p))
+			/* NMI:, LOC: etc. */
+			irq = -1;
+		for (; isdigit(*p); p++)
+			if (irq < INT_MAX / 10 - 1)
+				irq = irq * 10 + (*p - '0');
+		if (irq < 0 || irq >= g_irq_table_size || *p != ':' ||
+		    (ip = g_irq_table[irq]) == NULL) {
+			p = memchr(p, '\n', end - p);
+			if (p == NULL)
+				break;
+			continue;
+		}
+		if (ip->new == NULL) {
+			/* Claimed since the CPU count was established */
+			ip->old = allocate(ncpus * sizeof (uint64_t));
+			ip->new = allocate(ncpus * sizeof (uint64_t));
+			ip->primed = g_irq_tv_old.tv_sec == 0;
+		}
+		counts = ip->new;
+		p++;		/* ':' */
+		for (cpu = 0; cpu < ncpus; cpu++) {
+			while (*p == ' ')
+				p++;
+			for (v = 0; isdigit(*p); p++)
+				v = v * 10 + (*p - '0');
+			counts[cpu] = v;
+		}
+		p = memchr(p, '\n', end - p);
+		if (p == NULL)
+			break;
+	}
+	if (g_irq_tv_old.tv_sec == 0)
+		/* Not initialised, so numbers will be since boot */
+		g_irq_tv_old = g_boot_tv;
+}
+
+/*
+ * load_interrupts() -	Read per-CPU counts of interface IRQs
+ */
+static void
+load_interrupts(struct timeval *now_tv)
+{
+	static char *intr_buf = NULL;
+	static int intr_bufsiz;
+	int len;
+
+	len = load_proc_file(g_interrupts_fd, PROC_INTERRUPTS_PATH,
+	    &intr_buf, &intr_bufsiz);
+	resolve_irqs(intr_buf);
+	g_irq_tv_new = *now_tv;
+	parse_interrupts(intr_buf, len);
+}
+
+/*
+ * irq_rollover() -	Save the current IRQ counts for next time
+ */
+static void
+irq_rollover()
+{
+	irqstats_t *ip;
+	uint64_t *tp;
+	int irq;
+
+	for (irq = 0; irq < g_irq_table_size; irq++) {
+		if ((ip = g_irq_table[irq]) == NULL || ip->new == NULL)
+			continue;
+		tp = ip->old;
+		ip->old = ip->new;
+		ip->new = tp;
+		ip->primed = B_TRUE;
+	}
+	g_irq_tv_old = g_irq_tv_new;
+}
+
+/*
+ * irq_rate() -	Interrupts per second for an IRQ on one CPU
+ */
+static inline double
+irq_rate(irqstats_t *ip, int cpu, double tdiff)
+{
+	uint32_t delta;
+
+	/* These are 32-bit counters */
+	delta = ip->new[cpu] - ip->old[cpu];
+	return (delta / tdiff);
+}
+
+/*
+ * irq_nic_rate() -	Interrupts per second for all of an interface's IRQs
+ *
+ * Returns -1 if we have no interrupt data for the interface.
+ */
+static double
+irq_nic_rate(struct nicdata *nicp)
+{
+	irqstats_t *ip;
+	double tdiff, rate;
+	int i, cpu, valid;
+
+	tdiff = tv_diff(&g_irq_tv_new, &g_irq_tv_old);
 	if (tdiff == 0)
 		tdiff = 1;
+	rate = 0;
+	valid = 0;
+	for (i = 0; i < nicp->nirqs; i++) {
+		ip = g_irq_table[nicp->irqs[i]];
+		if (ip->new == NULL || ! ip->primed)
+			continue;
+		for (cpu = 0; cpu < g_irq_ncpus; cpu++)
+			rate += irq_rate(ip, cpu, tdiff);
+		valid++;
+	}
+	return (valid ? rate : -1);
+}
+
+/*
+ * ifindex_to_name() -	if_indextoname(), cached
+ */
+static char *
+ifindex_to_name(int ifindex)
+{
+	char name[IF_NAMESIZE];
+	int size;
+
+	if (ifindex <= 0)
+		return (NULL);
+	if (ifindex >= g_ifindex_names_size) {
+		size = g_ifindex_names_size ? g_ifindex_names_size : 64;
+		while (size <= ifindex)
+			size *= 2;
+		g_ifindex_names = realloc(g_ifindex_names,
+		    size * sizeof (char *));
+		if (g_ifindex_names == NULL)
+			die(1, "realloc");
+		(void) memset(g_ifindex_names + g_ifindex_names_size, 0,
+		    (size - g_ifindex_names_size) * sizeof (char *));
+		g_ifindex_names_size = size;
+	}
+	if (g_ifindex_names[ifindex] == NULL) {
+		if (if_indextoname(ifindex, name) == NULL)
+			return (NULL);
+		g_ifindex_names[ifindex] = new_string(name);
+	}
+	return (g_ifindex_names[ifindex]);
+}
+
+/*
+ * ifindex_forget() -	Drop the cached name of an ifindex (of all of them
+ *			if it is -1), as the link has gone or changed
+ */
+static void
+ifindex_forget(int ifindex)
+{
+	int i;
+
+	for (i = 0; i < g_ifindex_names_size; i++)
+		if ((ifindex < 0 || i == ifindex) &&
+		    g_ifindex_names[i] != NULL) {
+			free(g_ifindex_names[i]);
+			g_ifindex_names[i] = NULL;
+		}
+}
+
+/*
+ * rtnl_socket() -	Open and bind an rtnetlink socket; -1 on failure
+ */
+static int
+rtnl_socket()
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0)
+		return (-1);
+	(void) memset(&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	if (bind(fd, (struct sockaddr *)&addr, sizeof (addr)) < 0) {
+		(void) close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/*
+ * rtnl_open() -	Open our rtnetlink socket
+ */
+static void
+rtnl_open()
+{
+	if (g_rtnl >= 0)
+		return;
+	if ((g_rtnl = rtnl_socket()) < 0)
+		die(1, "rtnetlink socket");
+}
+
+/*
+ * rtnl_dump() -	Send an rtnetlink dump request, and call handler()
+ *			for each message in the reply
+ */
+static void
+rtnl_dump(int type, void *req, int req_len,
+    void (*handler)(struct nlmsghdr *))
+{
+	static char *buf = NULL;
+	static int bufsiz = 0;
+	struct {
+		struct nlmsghdr nlh;
+		char body[64];
+	} msg;
+	struct nlmsghdr *nlh;
+	int len, done;
+
+	if (buf == NULL) {
+		bufsiz = 64 * 1024;
+		buf = allocate(bufsiz);
+	}
+	(void) memset(&msg, 0, sizeof (msg));
+	msg.nlh.nlmsg_len = NLMSG_LENGTH(req_len);
+	msg.nlh.nlmsg_type = type;
+	msg.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	msg.nlh.nlmsg_seq = ++g_rtnl_seq;
+	(void) memcpy(NLMSG_DATA(&msg.nlh), req, req_len);
+	if (send(g_rtnl, &msg, msg.nlh.nlmsg_len, 0) < 0)
+		die(1, "send(AF_NETLINK)");
+
+	done = 0;
+	while (! done) {
+		/* The size of the next reply, so as not to truncate it */
+		len = recv(g_rtnl, NULL, 0, MSG_PEEK | MSG_TRUNC);
+		if (len > bufsiz) {
+			while (bufsiz < len)
+				bufsiz *= 2;
+			if ((buf = realloc(buf, bufsiz)) == NULL)
+				die(1, "realloc");
+		}
+		if (len >= 0)
+			len = recv(g_rtnl, buf, bufsiz, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			die(1, "recv(AF_NETLINK)");
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		    nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != g_rtnl_seq)
+				continue;
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				errno = -((struct nlmsgerr *)
+				    NLMSG_DATA(nlh))->error;
+				die(1, "rtnetlink dump");
+			}
+			handler(nlh);
+		}
+	}
+}
+
+/*
+ * qdisc_find() -	Find (or add) a qdisc in g_qdiscs
+ *
+ * The dump comes in the same order each time, so we expect the
+ * entry at *cursor; otherwise search, and failing that insert.
+ */
+static qdiscstats_t *
+qdisc_find(int *cursor, int ifindex, uint32_t handle, uint32_t parent)
+{
+	qdiscstats_t *qp, tmp;
+	int i;
+
+	for (i = *cursor; i < g_qdisc_count; i++) {
+		qp = &g_qdiscs[i];
+		if (qp->ifindex == ifindex && qp->handle == handle &&
+		    qp->parent == parent)
+			break;
+	}
+	if (i == g_qdisc_count) {
+		/* New qdisc, add it */
+		if (g_qdisc_count == g_qdisc_size) {
+			g_qdisc_size = g_qdisc_size ? g_qdisc_size * 2 : 64;
+			g_qdiscs = realloc(g_qdiscs,
+			    g_qdisc_size * sizeof (qdiscstats_t));
+			if (g_qdiscs == NULL)
+				die(1, "realloc");
+		}
+		qp = &g_qdiscs[g_qdisc_count++];
+		(void) memset(qp, 0, sizeof (qdiscstats_t));
+		qp->ifindex = ifindex;
+		qp->handle = handle;
+		qp->parent = parent;
+		/* Report since boot if this is our first sample */
+		qp->primed = g_qdisc_tv_old.tv_sec == 0;
+	}
+	if (i != *cursor) {
+		/* Move it to where we expect it next time */
+		tmp = g_qdiscs[i];
+		g_qdiscs[i] = g_qdiscs[*cursor];
+		g_qdiscs[*cursor] = tmp;
+	}
+	return (&g_qdiscs[(*cursor)++]);
+}
+
+/*
+ * qdisc_handler() -	Save the stats from one RTM_NEWQDISC message
+ */
+static void
+qdisc_handler(struct nlmsghdr *nlh)
+{
+	struct tcmsg *tcm;
+	struct rtattr *rta, *nested;
+	struct gnet_stats_queue q;
+	struct tc_stats st;
+	qdiscstats_t *qp;
+	char *kind;
+	int len, nlen, have_stats2;
+
+	if (nlh->nlmsg_type != RTM_NEWQDISC)
+		return;
+	tcm = NLMSG_DATA(nlh);
+	qp = qdisc_find(&g_qdisc_cursor, tcm->tcm_ifindex, tcm->tcm_handle,
+	    tcm->tcm_parent);
+	kind = NULL;
+	have_stats2 = 0;
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof (*tcm));
+	for (rta = TCA_RTA(tcm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case TCA_KIND:
+			kind = RTA_DATA(rta);
+			break;
+		case TCA_STATS2:
+			have_stats2 = 1;
+			nlen = RTA_PAYLOAD(rta);
+			for (nested = RTA_DATA(rta); RTA_OK(nested, nlen);
+			    nested = RTA_NEXT(nested, nlen)) {
+				if (nested->rta_type == TCA_STATS_BASIC) {
+					/* { __u64 bytes; __u32 packets; } */
+					(void) memcpy(&qp->new.bytes,
+					    RTA_DATA(nested), 8);
+					(void) memcpy(&qp->new.packets,
+					    (char *)RTA_DATA(nested) + 8, 4);
+				} else if (nested->rta_type ==
+				    TCA_STATS_QUEUE) {
+					(void) memcpy(&q, RTA_DATA(nested),
+					    sizeof (q));
+					qp->qlen = q.qlen;
+					qp->backlog = q.backlog;
+					qp->new.drops = q.drops;
+					qp->new.requeues = q.requeues;
+					qp->new.overlimits = q.overlimits;
+				}
+			}
+			break;
+		case TCA_STATS:
+			/* Pre-2.6.13 kernels - only use if no TCA_STATS2 */
+			if (have_stats2 || RTA_PAYLOAD(rta) < sizeof (st))
+				break;
+			(void) memcpy(&st, RTA_DATA(rta), sizeof (st));
+			qp->new.bytes = st.bytes;
+			qp->new.packets = st.packets;
+			qp->new.drops = st.drops;
+			qp->new.overlimits = st.overlimits;
+			qp->qlen = st.qlen;
+			qp->backlog = st.backlog;
+			break;
+		}
+	}
+	if (kind)
+		(void) strncpy(qp->kind, kind, sizeof (qp->kind) - 1);
+}
+
+/*
+ * load_qdiscs() -	Dump all qdiscs, with their stats
+ */
+static void
+load_qdiscs(struct timeval *now_tv)
+{
+	struct tcmsg tcm;
+
+	(void) memset(&tcm, 0, sizeof (tcm));
+	tcm.tcm_family = AF_UNSPEC;
+	g_qdisc_cursor = 0;
+	rtnl_dump(RTM_GETQDISC, &tcm, sizeof (tcm), qdisc_handler);
+	/* Anything past the cursor has gone away */
+	g_qdisc_count = g_qdisc_cursor;
+	g_qdisc_tv_new = *now_tv;
+	if (g_qdisc_tv_old.tv_sec == 0)
+		/* Not initialised, so numbers will be since boot */
+		g_qdisc_tv_old = g_boot_tv;
+}
+
+/*
+ * Links seen during a bond discovery dump
+ */
+typedef struct link_info {
+	int ifindex;
+	int master;			/* IFLA_MASTER, or 0 */
+	int is_bond;			/* IFLA_INFO_KIND is bond or team */
+	char name[IFNAMSIZ];
+} linkinfo_t;
+
+static linkinfo_t *g_links;
+static int g_links_count, g_links_size;
+
+/*
+ * link_handler() -	Save the interesting parts of an RTM_NEWLINK message
+ */
+static void
+link_handler(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi;
+	struct rtattr *rta, *nested;
+	linkinfo_t *lp;
+	int len, nlen;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return;
+	if (g_links_count == g_links_size) {
+		g_links_size = g_links_size ? g_links_size * 2 : 64;
+		g_links = realloc(g_links, g_links_size * sizeof (linkinfo_t));
+		if (g_links == NULL)
+			die(1, "realloc");
+	}
+	lp = &g_links[g_links_count++];
+	(void) memset(lp, 0, sizeof (linkinfo_t));
+	ifi = NLMSG_DATA(nlh);
+	lp->ifindex = ifi->ifi_index;
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof (*ifi));
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			(void) strncpy(lp->name, RTA_DATA(rta),
+			    sizeof (lp->name) - 1);
+			break;
+		case IFLA_MASTER:
+			(void) memcpy(&lp->master, RTA_DATA(rta), sizeof (int));
+			break;
+		case IFLA_LINKINFO:
+			nlen = RTA_PAYLOAD(rta);
+			for (nested = RTA_DATA(rta); RTA_OK(nested, nlen);
+			    nested = RTA_NEXT(nested, nlen))
+				if (nested->rta_type == IFLA_INFO_KIND &&
+				    (streql(RTA_DATA(nested), "bond") ||
+				    streql(RTA_DATA(nested), "team")))
+					lp->is_bond = B_TRUE;
+			break;
+		}
+	}
+}
+
+/*
+ * discover_bonds() -	Rebuild g_bonds from an RTM_GETLINK dump
+ *
+ * Bridges and other masters also set IFLA_MASTER on their ports, so
+ * only masters of kind "bond" or "team" are kept.
+ */
+static void
+discover_bonds()
+{
+	struct ifinfomsg ifi;
+	bond_t *bp, *next;
+	linkinfo_t *lp;
+	int i, j;
+
+	for (bp = g_bonds; bp; bp = next) {
+		next = bp->next;
+		for (i = 0; i < bp->nmembers; i++)
+			free(bp->members[i].name);
+		free(bp->members);
+		free(bp->name);
+		free(bp);
+	}
+	g_bonds = NULL;
+
+	(void) memset(&ifi, 0, sizeof (ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	g_links_count = 0;
+	rtnl_dump(RTM_GETLINK, &ifi, sizeof (ifi), link_handler);
+
+	/* Walk backwards, so g_bonds ends up in ifindex order */
+	for (i = g_links_count - 1; i >= 0; i--) {
+		lp = &g_links[i];
+		if (! lp->is_bond || if_is_ignored(lp->name))
+			continue;
+		bp = allocate(sizeof (bond_t));
+		bp->ifindex = lp->ifindex;
+		bp->name = new_string(lp->name);
+		for (j = 0; j < g_links_count; j++) {
+			if (g_links[j].master != lp->ifindex)
+				continue;
+			bp->members = realloc(bp->members,
+			    (bp->nmembers + 1) * sizeof (bondmember_t));
+			if (bp->members == NULL)
+				die(1, "realloc");
+			bp->members[bp->nmembers].name =
+			    new_string(g_links[j].name);
+			bp->members[bp->nmembers].nicp = NULL;
+			bp->nmembers++;
+		}
+		bp->next = g_bonds;
+		g_bonds = bp;
+	}
+	g_bonds_stale = B_FALSE;
+}
+
+/*
+ * rtnl_events_open() -	Listen for link events, so that we know when to
+ *			re-discover bonds, and which ifindex names to drop
+ */
+static void
+rtnl_events_open()
+{
+	struct sockaddr_nl addr;
+
+	g_rtnl_events = socket(AF_NETLINK,
+	    SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (g_rtnl_events < 0)
+		die(1, "socket(AF_NETLINK)");
+	(void) memset(&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK;
+	if (bind(g_rtnl_events, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+		die(1, "bind(AF_NETLINK)");
+}
+
+/*
+ * check_link_events() -	Drain pending link events; mark bonds as stale
+ *				if links were added, removed or changed, and
+ *				forget the names of those links' ifindexes
+ */
+static void
+check_link_events()
+{
+	char buf[8192];
+	struct nlmsghdr *nlh;
+	struct ifinfomsg *ifi;
+	int len;
+
+	for (;;) {
+		len = recv(g_rtnl_events, buf, sizeof (buf), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == ENOBUFS) {
+				/* Overran - we missed some */
+				g_bonds_stale = B_TRUE;
+				ifindex_forget(-1);
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				die(1, "recv(AF_NETLINK)");
+			break;
+		}
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		    nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_type != RTM_NEWLINK &&
+			    nlh->nlmsg_type != RTM_DELLINK)
+				continue;
+			g_bonds_stale = B_TRUE;
+			/* Deleted, or renamed; its ifindex may be reused */
+			ifi = NLMSG_DATA(nlh);
+			if (nlh->nlmsg_len >= NLMSG_LENGTH(sizeof (*ifi)))
+				ifindex_forget(ifi->ifi_index);
+		}
+	}
+}
+#endif /* OS_LINUX */
+
+#ifdef OS_LINUX
+/*
+ * phase_begin() -	Note the time at the start of a -d phase
+ */
+static inline void
+phase_begin(phasetime_t *tp)
+{
+	struct timespec ts;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &ts);
+	tp->wall = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	(void) clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	tp->cpu = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * phase_end() -	Add the time since phase_begin() to a phase
+ */
+static inline void
+phase_end(enum phase phase, phasetime_t *tp)
+{
+	phasetime_t now;
+
+	phase_begin(&now);
+	g_phases[phase].wall += now.wall - tp->wall;
+	g_phases[phase].cpu += now.cpu - tp->cpu;
+}
+
+#define	SPEED_REFRESH	60	/* seconds an ETHTOOL_GSET speed is kept */
+
+/*
+ * read_sys_net() -	Read a /sys/class/net/<interface> file
+ */
+static int
+read_sys_net(char *name, char *file, char *buf, int size)
+{
+	char path[PATH_MAX];
+	int fd, n;
+
+	(void) snprintf(path, sizeof (path), "%s%s/%s/%s",
+	    g_proc_root, SYS_CLASS_NET_PATH, name, file);
+	if ((fd = open(path, O_RDONLY, 0)) < 0)
+		return (-1);
+	n = read(fd, buf, size - 1);
+	(void) close(fd);
+	if (n >= 0)
+		buf[n] = '\0';
+	return (n);
+}
+
+/*
+ * sysfs_speed_duplex() -	For -S auto, read the speed and duplex of an
+ *				interface from sysfs, which needs no privilege
+ *
+ * A driver can be slow to answer, so once the reads in a sample have
+ * taken g_speed_auto_ms the rest are left for the next sample; false is
+ * returned for those.  A read that never returns still holds nicstat up.
+ */
+static int
+sysfs_speed_duplex(char *name, uint64_t *speedp, duplex_t *duplexp)
+{
+	static time_t budget_time;	/* the sample used_ms is for */
+	static long used_ms;
+	struct timespec start, end;
+	char buf[32];
+	long speed;
+
+	if (budget_time != g_sample_time) {
+		budget_time = g_sample_time;
+		used_ms = 0;
+	}
+	if (used_ms >= g_speed_auto_ms)
+		return (B_FALSE);
+	(void) clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* -1 (unknown) or EINVAL when there is no link */
+	speed = 0;
+	*duplexp = DUPLEX_UNKNOWN;
+	if (read_sys_net(name, "speed", buf, sizeof (buf)) > 0)
+		speed = atol(buf);
+	if (speed > 0 && read_sys_net(name, "duplex", buf, sizeof (buf)) > 0) {
+		if (strncmp(buf, "full", 4) == 0)
+			*duplexp = DUPLEX_FULL;
+		else if (strncmp(buf, "half", 4) == 0)
+			*duplexp = DUPLEX_HALF;
+	}
+	*speedp = (uint64_t)max(speed, 0) * 1000000;
+
+	(void) clock_gettime(CLOCK_MONOTONIC, &end);
+	used_ms += (end.tv_sec - start.tv_sec) * 1000 +
+	    (end.tv_nsec - start.tv_nsec) / 1000000;
+	return (B_TRUE);
+}
+
+
+/*
+ * get_speed_duplex - the speed and duplex of an interface, from -S if it
+ * is listed there, or else from sysfs (-S auto) or SIOCETHTOOL.  Each is
+ * kept, rather than looked up every sample: a -S speed for good, the
+ * others for SPEED_REFRESH seconds, in case the link is renegotiated.
+ */
+static void
+get_speed_duplex(nicdata_t *nicp)
+{
+	struct ifreq ifr;
+	struct ethtool_cmd edata;
+	uint64_t speed;
+	duplex_t duplex;
+	int status;
+
+	if (nicp->flags & NIC_SPEED_LISTED)
+		return;
+	if (nicp->speed_time != 0 &&
+	    g_sample_time - nicp->speed_time < SPEED_REFRESH)
+		return;
+	speed = nicp->speed;
+	duplex = nicp->duplex;
+	if (find_interface_speed(nicp)) {
+		nicp->flags |= NIC_SPEED_LISTED;
+		return;
+	}
+
+	if (g_speed_auto) {
+		if (sysfs_speed_duplex(nicp->name, &speed, &duplex))
+			nicp->speed_time = g_sample_time;
+		/* else over budget; keep what we had until next sample */
+		nicp->speed = speed;
+		nicp->duplex = duplex;
+		return;
+	}
+
+	if (nicp->flags & NIC_NO_GSET) {
+		if (nicp->speed > 0)
+			/* Already got something */
+			return;
+		if (nicp->flags & NIC_NO_SFLAG)
+			return;
+		if (! find_interface_speed(nicp))
+			nicp->flags |= NIC_NO_SFLAG;
+		return;
+	}
+
+	/* Try SIOCETHTOOL */
+	strncpy(ifr.ifr_name, nicp->name, sizeof (ifr.ifr_name));
+	ifr.ifr_data = (void *) &edata;
+	edata.cmd = ETHTOOL_GSET;
+	status = ioctl(g_sock, SIOCETHTOOL, &ifr);
+	g_ioctls++;
+	if (status < 0) {
+		nicp->flags |= NIC_NO_GSET;
+		get_speed_duplex(nicp);
+		return;
+	}
+	nicp->speed = (long long) edata.speed * 1000000;
+	nicp->duplex = edata.duplex;
+	nicp->speed_time = g_sample_time;
+}
+
+/*
+ * get_coalesce - fetch interrupt coalescing settings with SIOCETHTOOL
+ *
+ * These are fetched every sample, as the point is to watch the effect
+ * of changing them.
+ */
+static void
+get_coalesce(nicdata_t *nicp)
+{
+	struct ifreq ifr;
+	struct ethtool_coalesce ecoal;
+
+	if (nicp->flags & NIC_NO_GCOALESCE)
+		return;
+	(void) memset(&ecoal, 0, sizeof (ecoal));
+	strncpy(ifr.ifr_name, nicp->name, sizeof (ifr.ifr_name));
+	ifr.ifr_data = (void *) &ecoal;
+	ecoal.cmd = ETHTOOL_GCOALESCE;
+	g_ioctls++;
+	if (ioctl(g_sock, SIOCETHTOOL, &ifr) < 0) {
+		nicp->flags |= NIC_NO_GCOALESCE;
+		return;
+	}
+	nicp->coalesce.rx_usecs = ecoal.rx_coalesce_usecs;
+	nicp->coalesce.rx_frames = ecoal.rx_max_coalesced_frames;
+	nicp->coalesce.tx_usecs = ecoal.tx_coalesce_usecs;
+	nicp->coalesce.tx_frames = ecoal.tx_max_coalesced_frames;
+	nicp->coalesce.adaptive_rx = ecoal.use_adaptive_rx_coalesce;
+	nicp->coalesce.adaptive_tx = ecoal.use_adaptive_tx_coalesce;
+}
+#endif /* OS_LINUX */
+
+#ifdef OS_LINUX
+
+/*
+ * Collectors.  Each reads the counters of every interface into the
+ * nicdata list, through collect_nic(): the /proc/net/dev text (procfs),
+ * the files below /sys/class/net/<interface>/statistics (sysfs), or an
+ * RTM_GETLINK dump (rtnetlink).  All of them have every counter nicstat
+ * uses, so which is used is only a matter of what is available, and
+ * cost; at startup each available one is timed over a few samples, and
+ * the cheapest kept, unless -B says which.
+ *
+ * sample() fills in the interfaces' new counters, and returns how many
+ * it kept.  It is timed as PH_READ, until it ends that phase in *tp and
+ * begins the next; which is then taken as PH_PARSE.
+ */
+typedef struct collector {
+	char *name;
+	int (*open)(void);		/* B_FALSE if not available */
+	int (*sample)(struct timeval *now_tv, phasetime_t *tp);
+	void (*close)(void);
+} collector_t;
+
+#define	COLL_PROBES	3		/* samples timed of each */
+#define	COLL_PROBE_IFS	32		/* interfaces sysfs reads to time */
+
+static collector_t *g_collector;	/* the one in use */
+static char *g_collector_name;		/* -B */
+static int g_coll_probing;		/* collector_select() is timing */
+static int g_coll_cut;			/* ... and the sample stopped short */
+
+/*
+ * collect_nic() -	Save an interface's counters, given in the order
+ *			of a /proc/net/dev line; returns B_TRUE if it is
+ *			to be reported
+ */
+static int
+collect_nic(struct nicdata **lastp, char *if_name, unsigned long long *ll,
+    struct timeval *now_tv)
+{
+	struct nicdata *nicp;
+	int loopback;
+
+	if (g_coll_probing)
+		/* Counted, but not kept; only a real sample is */
+		return (B_TRUE);
+	nicp = find_nicdatap(&g_nicdatap, lastp, if_name);
+	/*
+	 * Skip interface if not specifically interested in it;
+	 * the -i patterns are only matched on first sight
+	 */
+	if (! (nicp->flags & NIC_SELECTION)) {
+		nicp->flags |= NIC_SELECTION;
+		if (if_is_ignored(if_name))
+			nicp->flags |= NIC_IGNORED;
+	}
+	if (nicp->flags & NIC_IGNORED)
+		return (B_FALSE);
+	/*
+	 * If g_nonlocal, skip "lo"
+	 */
+	loopback = streql("lo", if_name);
+	if (g_nonlocal && loopback)
+		return (B_FALSE);
+	/*
+	 * Skip interface if it has never seen a packet
+	 */
+	if (ll[1] == 0 && ll[9] == 0)
+		return (B_FALSE);
+
+	/*
+	 * OK, we'll keep this one
+	 */
+	nicp->new.tv.tv_sec = now_tv->tv_sec;
+	nicp->new.tv.tv_usec = now_tv->tv_usec;
+	nicp->new.skew = g_skew;
+	nicp->new.rbytes = ll[0];
+	nicp->new.rpackets = ll[1];
+	nicp->new.wbytes = ll[8];
+	nicp->new.wpackets = ll[9];
+	nicp->new.sat = ll[2];
+	nicp->new.sat += ll[3];
+	nicp->new.sat += ll[11];
+	nicp->new.sat += ll[12];
+	nicp->new.sat += ll[13];
+	nicp->new.sat += ll[14];
+	if (g_opt_x || g_hist || g_store_dir || g_nsinks ||
+	    g_state_file || g_top_key == TOP_ERRORS) {
+		nicp->new.ierr = ll[2];
+		nicp->new.oerr = ll[10];
+		nicp->new.coll = ll[13];
+	}
+	if (loopback)
+		nicp->flags |= NIC_LOOPBACK;
+	nicp->report = 1;
+	return (B_TRUE);
+}
+
+/*
+ * A /proc/net/dev of thousands of interfaces takes long enough to parse
+ * to matter at short intervals.  So above NETDEV_PARALLEL_MIN bytes, with
+ * more than one CPU online, it is split at line boundaries into a part
+ * for each thread of a small pool (the main thread taking the first).
+ * Each thread parses its part into a lines[] of its own; when all are
+ * done, the main thread merges them into the nicdata list in order.  No
+ * thread touches another's part, nor the list, so the merge needs no
+ * locks; the pool's lock only hands out rounds.
+ */
+#define	NETDEV_PARALLEL_MIN	(128 * 1024)	/* bytes */
+#define	NETDEV_THREADS_MAX	8
+
+typedef struct netdev_line {
+	char name[32];			/* "" if the line was bad */
+	unsigned long long ll[16];
+} netdevline_t;
+
+typedef struct netdev_part {
+	char *start, *end;		/* whole lines of the buffer */
+	netdevline_t *lines;
+	int nlines;
+	int size;			/* of lines[] */
+} netdevpart_t;
+
+typedef struct netdev_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work;		/* a new round */
+	pthread_cond_t done;		/* the last part is parsed */
+	int nthreads;			/* 0 until started; 1 if serial */
+	int round;
+	int pending;			/* parts still being parsed */
+	int quit;			/* net_dev_pool_stop() */
+	pthread_t tids[NETDEV_THREADS_MAX];	/* [0] is unused */
+	netdevpart_t parts[NETDEV_THREADS_MAX];
+} netdevpool_t;
+
+static netdevpool_t g_netdev_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, 0, 0, 0, B_FALSE, { 0 },
+	{ { NULL, NULL, NULL, 0, 0 } }
+};
+static int g_netdev_threads;		/* -E: 0 for as many as pay */
+
+/*
+ * net_dev_line() -	Parse a NUL-terminated line of PROC_NET_DEV_PATH
+ *			into a name and 16 counters; B_FALSE if it is not
+ *			one
+ */
+static int
+net_dev_line(char *line, char *if_name, int size, unsigned long long *ll)
+{
+	char *endp;
+	int i, n;
+
+	/* Get the interface name */
+	while (*line == ' ')
+		line++;
+	n = strcspn(line, ":");
+	if (line[n] != ':' || n == 0 || n >= size)
+		return (B_FALSE);
+	(void) memcpy(if_name, line, n);
+	if_name[n] = '\0';
+
+	/* Scan in values */
+	line += n + 1;
+	for (i = 0; i < 16; i++) {
+		ll[i] = strtoull(line, &endp, 10);
+		if (endp == line)
+			return (B_FALSE);
+		line = endp;
+	}
+	return (B_TRUE);
+}
+
+/*
+ * net_dev_bad_line() -	Warn, once, of a line net_dev_line() rejected
+ */
+static void
+net_dev_bad_line()
+{
+	static int warned = 0;
+
+	if (! warned) {
+		diag(0, "%s: skipping lines of unexpected format",
+		    PROC_NET_DEV_PATH);
+		warned = 1;
+	}
+}
+
+/*
+ * net_dev_part() -	Parse the lines of a part into its lines[]
+ */
+static void
+net_dev_part(netdevpart_t *pp)
+{
+	netdevline_t *lp;
+	char *bufp, *eol;
+
+	pp->nlines = 0;
+	for (bufp = pp->start; bufp < pp->end; bufp = eol) {
+		/* Only the last part may not end in a newline */
+		if ((eol = memchr(bufp, '\n', pp->end - bufp)) != NULL)
+			*eol++ = '\0';
+		else
+			eol = pp->end;
+		if (pp->nlines == pp->size) {
+			pp->size = pp->size ? pp->size * 2 : 1024;
+			pp->lines = realloc(pp->lines,
+			    pp->size * sizeof (netdevline_t));
+			if (pp->lines == NULL)
+				die(1, "realloc");
+		}
+		lp = &pp->lines[pp->nlines++];
+		if (! net_dev_line(bufp, lp->name, sizeof (lp->name), lp->ll))
+			lp->name[0] = '\0';
+	}
+}
+
+/*
+ * net_dev_worker() -	Parse part (int)arg of each round
+ */
+static void *
+net_dev_worker(void *arg)
+{
+	netdevpool_t *pp = &g_netdev_pool;
+	int id = (int)(intptr_t)arg;
+	int round = 0;
+
+	for (;;) {
+		(void) pthread_mutex_lock(&pp->lock);
+		while (pp->round == round && ! pp->quit)
+			(void) pthread_cond_wait(&pp->work, &pp->lock);
+		if (pp->quit) {
+			(void) pthread_mutex_unlock(&pp->lock);
+			return (NULL);
+		}
+		round = pp->round;
+		(void) pthread_mutex_unlock(&pp->lock);
+
+		net_dev_part(&pp->parts[id]);
+
+		(void) pthread_mutex_lock(&pp->lock);
+		if (--pp->pending == 0)
+			(void) pthread_cond_signal(&pp->done);
+		(void) pthread_mutex_unlock(&pp->lock);
+	}
+}
+
+/*
+ * net_dev_pool_stop() -	Stop the pool's threads and wait for them;
+ *				run when procfs is closed, and at exit
+ */
+static void
+net_dev_pool_stop()
+{
+	netdevpool_t *pp = &g_netdev_pool;
+	int i;
+
+	for (i = 1; i < pp->nthreads; i++)
+		if (pthread_equal(pthread_self(), pp->tids[i]))
+			/* A worker died */
+			return;
+	(void) pthread_mutex_lock(&pp->lock);
+	pp->quit = B_TRUE;
+	(void) pthread_cond_broadcast(&pp->work);
+	(void) pthread_mutex_unlock(&pp->lock);
+	for (i = 1; i < pp->nthreads; i++)
+		(void) pthread_join(pp->tids[i], NULL);
+	pp->nthreads = 0;
+	pp->quit = B_FALSE;
+}
+
+/*
+ * net_dev_pool() -	Start the pool, if it is not already; returns how
+ *			many threads it has, counting the main one
+ */
+static int
+net_dev_pool()
+{
+	netdevpool_t *pp = &g_netdev_pool;
+	static int registered = B_FALSE;
+	sigset_t all, old;
+	long n;
+	int i;
+
+	if (pp->nthreads)
+		return (pp->nthreads);
+	if ((n = g_netdev_threads) == 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	n = max(min(n, NETDEV_THREADS_MAX), 1);
+
+	(void) sigfillset(&all);
+	(void) pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 1; i < n; i++)
+		if (pthread_create(&pp->tids[i], NULL, net_dev_worker,
+		    (void *)(intptr_t)i) != 0)
+			break;
+	(void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+	/* Fewer threads, or none, only cost speed */
+	pp->nthreads = i;
+	if (i > 1 && ! registered) {
+		(void) atexit(net_dev_pool_stop);
+		registered = B_TRUE;
+	}
+	return (pp->nthreads);
+}
+
+/*
+ * parse_net_dev() -	Parse a PROC_NET_DEV_PATH buffer into the nicdata
+ *			list, marking the interfaces seen to be reported
+ *
+ * Nothing in it is fatal: a kernel that changes the format should cost
+ * us the odd interface, not the whole of nicstat.  So a header we do
+ * not know is warned about once, and lines we cannot parse are skipped
+ * (also with a warning, once).  buf is modified.  Returns how many
+ * interfaces were kept.
+ */
+static int
+parse_net_dev(char *buf, struct timeval *now_tv)
+{
+	static int warned_header = 0;
+	netdevpool_t *pp = &g_netdev_pool;
+	netdevpart_t *partp;
+	netdevline_t *lp;
+	struct nicdata *lastp;
+	char *bufp, *eol, *endp;
+	int count, i, n;
+	size_t len;
+	unsigned long long ll[16];
+	char if_name[32];
+
+	if (strncmp(buf, PROC_NET_DEV_HEADER,
+	    sizeof (PROC_NET_DEV_HEADER) - 1) != 0 && ! warned_header) {
+		diag(0, "%s: unexpected header, carrying on",
+		    PROC_NET_DEV_PATH);
+		warned_header = 1;
+	}
+
+	/* Two lines of it */
+	bufp = buf;
+	for (i = 0; i < 2 && bufp; i++)
+		if ((bufp = strchr(bufp, '\n')) != NULL)
+			bufp++;
+
+	count = 0;
+	lastp = NULL;
+	len = bufp ? strlen(bufp) : 0;
+	if ((len < NETDEV_PARALLEL_MIN && g_netdev_threads == 0) ||
+	    (n = net_dev_pool()) == 1) {
+		for (; bufp && *bufp; bufp = eol) {
+			/*
+			 * One line at a time, so nothing can run into
+			 * the next
+			 */
+			if ((eol = strchr(bufp, '\n')) != NULL)
+				*eol++ = '\0';
+			if (! net_dev_line(bufp, if_name, sizeof (if_name),
+			    ll))
+				net_dev_bad_line();
+			else if (collect_nic(&lastp, if_name, ll, now_tv))
+				count++;
+		}
+		return (count);
+	}
+
+	/* Split it, each part ending after a newline but the last */
+	endp = bufp + len;
+	for (i = 0; i < n; i++) {
+		partp = &pp->parts[i];
+		partp->start = bufp;
+		if (i < n - 1 && bufp + len / n < endp &&
+		    (eol = strchr(bufp + len / n, '\n')) != NULL)
+			bufp = eol + 1;
+		else
+			bufp = endp;
+		partp->end = bufp;
+	}
+
+	(void) pthread_mutex_lock(&pp->lock);
+	pp->pending = n - 1;
+	pp->round++;
+	(void) pthread_cond_broadcast(&pp->work);
+	(void) pthread_mutex_unlock(&pp->lock);
+	net_dev_part(&pp->parts[0]);
+	(void) pthread_mutex_lock(&pp->lock);
+	while (pp->pending > 0)
+		(void) pthread_cond_wait(&pp->done, &pp->lock);
+	(void) pthread_mutex_unlock(&pp->lock);
+
+	/* Merge */
+	for (partp = pp->parts; partp < &pp->parts[n]; partp++)
+		for (lp = partp->lines; lp < &partp->lines[partp->nlines];
+		    lp++) {
+			if (lp->name[0] == '\0')
+				net_dev_bad_line();
+			else if (collect_nic(&lastp, lp->name, lp->ll, now_tv))
+				count++;
+		}
+	return (count);
+}
+
+/*
+ * The procfs collector
+ */
+static int g_net_dev_fd = -1;		/* PROC_NET_DEV_PATH */
+
+static int
+procfs_open()
+{
+	g_net_dev_fd = open(proc_path(PROC_NET_DEV_PATH), O_RDONLY, 0);
+	return (g_net_dev_fd >= 0);
+}
+
+static int
+procfs_sample(struct timeval *now_tv, phasetime_t *tp)
+{
+	static char *proc_net_buffer = NULL;
+	static int proc_net_size;
+
+	/* A read of it returns no more than a page or so */
+	(void) load_proc_file(g_net_dev_fd, PROC_NET_DEV_PATH,
+	    &proc_net_buffer, &proc_net_size);
+	if (g_timing) {
+		phase_end(PH_READ, tp);
+		phase_begin(tp);
+	}
+	return (parse_net_dev(proc_net_buffer, now_tv));
+}
+
+static void
+procfs_close()
+{
+	net_dev_pool_stop();
+	(void) close(g_net_dev_fd);
+	g_net_dev_fd = -1;
+}
+
+/*
+ * The sysfs collector.  Each file is added to the /proc/net/dev column
+ * that the kernel would have put it in.
+ */
+static struct sysfs_stat {
+	char *file;			/* below statistics/ */
+	int column;
+	int errors;			/* only needed for error counts */
+} g_sysfs_stats[] = {
+	{ "statistics/rx_bytes",		0,	B_FALSE },
+	{ "statistics/rx_packets",		1,	B_FALSE },
+	{ "statistics/rx_errors",		2,	B_FALSE },
+	{ "statistics/rx_dropped",		3,	B_FALSE },
+	{ "statistics/rx_missed_errors",	3,	B_FALSE },
+	{ "statistics/tx_bytes",		8,	B_FALSE },
+	{ "statistics/tx_packets",		9,	B_FALSE },
+	{ "statistics/tx_errors",		10,	B_TRUE },
+	{ "statistics/tx_dropped",		11,	B_FALSE },
+	{ "statistics/tx_fifo_errors",		12,	B_FALSE },
+	{ "statistics/collisions",		13,	B_FALSE },
+	{ "statistics/tx_carrier_errors",	14,	B_FALSE },
+	{ "statistics/tx_aborted_errors",	14,	B_FALSE },
+	{ "statistics/tx_window_errors",	14,	B_FALSE },
+	{ "statistics/tx_heartbeat_errors",	14,	B_FALSE },
+	{ NULL,					0,	B_FALSE }
+};
+
+#define	SYSFS_NSTATS	\
+	((int)(sizeof (g_sysfs_stats) / sizeof (g_sysfs_stats[0])) - 1)
+
+static DIR *g_sysfs_dir;		/* SYS_CLASS_NET_PATH */
+
+/*
+ * readdir() of SYS_CLASS_NET_PATH is in no useful order, so the
+ * interfaces are sorted by ifindex, which is the order /proc/net/dev
+ * (and so the other collectors) give them in.  Their ifindexes are
+ * read again only when the listing changes.
+ */
+typedef struct sysfs_ent {
+	char name[IFNAMSIZ];
+	int ifindex;
+} sysfsent_t;
+
+static sysfsent_t *g_sysfs_ents;	/* in ifindex order */
+static sysfsent_t *g_sysfs_listed;	/* in readdir() order */
+static int g_sysfs_nents;		/* in each */
+static int g_sysfs_nlisted;		/* ... not all of them interfaces */
+
+/*
+ * When -i names just a few interfaces outright, sysfs reads only theirs,
+ * without listing SYS_CLASS_NET_PATH; and keeps their files open, to be
+ * pread() each sample.  So its cost is in proportion to the interfaces
+ * tracked, not to those on the system.
+ */
+#define	SYSFS_SELECTED_MAX	16	/* interfaces, of SYSFS_NSTATS fds */
+
+typedef struct sysfs_nic {
+	char *name;
+	int ifindex;			/* to keep them in order by */
+	int open;			/* fds[] are open */
+	int fds[SYSFS_NSTATS];		/* -1 for files the driver lacks */
+} sysfsnic_t;
+
+static sysfsnic_t g_sysfs_nics[SYSFS_SELECTED_MAX];
+static int g_sysfs_nnics;
+static int g_sysfs_all;			/* -i has globs, "!" or too many */
+
+/*
+ * sysfs_select() -	Note the interfaces named by a -i
+ */
+static void
+sysfs_select(char **list)
+{
+	for (; *list; list++) {
+		if (**list == '!' || strpbrk(*list, "*?[") != NULL ||
+		    g_sysfs_nnics == SYSFS_SELECTED_MAX) {
+			g_sysfs_all = B_TRUE;
+			return;
+		}
+		g_sysfs_nics[g_sysfs_nnics++].name = *list;
+	}
+}
+
+/*
+ * sysfs_nic_close() -	Close an interface's statistics files
+ */
+static void
+sysfs_nic_close(sysfsnic_t *np)
+{
+	int i;
+
+	for (i = 0; i < SYSFS_NSTATS; i++)
+		if (np->fds[i] >= 0)
+			(void) close(np->fds[i]);
+	np->open = B_FALSE;
+}
+
+/*
+ * sysfs_nic_open() -	Open an interface's statistics files; B_FALSE if
+ *			it does not exist (yet)
+ */
+static int
+sysfs_nic_open(sysfsnic_t *np)
+{
+	char path[PATH_MAX], buf[32];
+	int i;
+
+	if (read_sys_net(np->name, "ifindex", buf, sizeof (buf)) <= 0)
+		return (B_FALSE);
+	np->ifindex = atoi(buf);
+	for (i = 0; i < SYSFS_NSTATS; i++) {
+		(void) snprintf(path, sizeof (path), "%s%s/%s/%s",
+		    g_proc_root, SYS_CLASS_NET_PATH, np->name,
+		    g_sysfs_stats[i].file);
+		np->fds[i] = open(path, O_RDONLY, 0);
+		if (i == 0 && np->fds[0] < 0)
+			return (B_FALSE);
+	}
+	np->open = B_TRUE;
+	return (B_TRUE);
+}
+
+/*
+ * sysfs_nic_compare() -	Order the -i interfaces by ifindex, with those
+ *				not there (yet) last
+ */
+static int
+sysfs_nic_compare(const void *a, const void *b)
+{
+	const sysfsnic_t *na = a, *nb = b;
+
+	if (na->open != nb->open)
+		return (na->open ? -1 : 1);
+	return (na->ifindex < nb->ifindex ? -1 :
+	    na->ifindex > nb->ifindex);
+}
+
+/*
+ * sysfs_sample_selected() -	sysfs_sample() for the -i interfaces
+ */
+static int
+sysfs_sample_selected(struct timeval *now_tv, int errors)
+{
+	struct nicdata *lastp;
+	sysfsnic_t *np;
+	unsigned long long ll[16];
+	char buf[32];
+	int count, opened, i, n;
+
+	/* Those that have (re)appeared go in ifindex order, as others */
+	opened = B_FALSE;
+	for (np = g_sysfs_nics; np < &g_sysfs_nics[g_sysfs_nnics]; np++)
+		if (! np->open && sysfs_nic_open(np))
+			opened = B_TRUE;
+	if (opened)
+		qsort(g_sysfs_nics, g_sysfs_nnics, sizeof (sysfsnic_t),
+		    sysfs_nic_compare);
+
+	count = 0;
+	lastp = NULL;
+	for (np = g_sysfs_nics; np < &g_sysfs_nics[g_sysfs_nnics]; np++) {
+		if (! np->open)
+			continue;
+		(void) memset(ll, 0, sizeof (ll));
+		for (i = 0; i < SYSFS_NSTATS; i++) {
+			if (np->fds[i] < 0 ||
+			    (g_sysfs_stats[i].errors && ! errors))
+				continue;
+			if ((n = pread(np->fds[i], buf, sizeof (buf) - 1,
+			    0)) <= 0) {
+				if (i == 0)
+					break;
+				/* Just this counter is unavailable */
+				(void) close(np->fds[i]);
+				np->fds[i] = -1;
+				continue;
+			}
+			buf[n] = '\0';
+			ll[g_sysfs_stats[i].column] += strtoull(buf, NULL, 10);
+		}
+		if (i < SYSFS_NSTATS) {
+			/* Gone; it may come back */
+			sysfs_nic_close(np);
+			continue;
+		}
+		if (collect_nic(&lastp, np->name, ll, now_tv))
+			count++;
+	}
+	return (count);
+}
+
+static int
+sysfs_open()
+{
+	struct dirent *dp;
+	char buf[32];
+	int i;
+
+	if (g_sysfs_nnics > 0 && ! g_sysfs_all) {
+		/* Those not there yet are tried again each sample */
+		if (access(proc_path(SYS_CLASS_NET_PATH), F_OK) < 0)
+			return (B_FALSE);
+		for (i = 0; i < g_sysfs_nnics; i++)
+			(void) sysfs_nic_open(&g_sysfs_nics[i]);
+		qsort(g_sysfs_nics, g_sysfs_nnics, sizeof (sysfsnic_t),
+		    sysfs_nic_compare);
+		return (B_TRUE);
+	}
+	if ((g_sysfs_dir = opendir(proc_path(SYS_CLASS_NET_PATH))) == NULL)
+		return (B_FALSE);
+	/* Only if an interface there has statistics */
+	while ((dp = readdir(g_sysfs_dir)) != NULL)
+		if (dp->d_name[0] != '.' &&
+		    read_sys_net(dp->d_name, g_sysfs_stats[0].file, buf,
+		    sizeof (buf)) > 0)
+			return (B_TRUE);
+	(void) closedir(g_sysfs_dir);
+	return (B_FALSE);
+}
+
+static int
+sysfs_ent_compare(const void *a, const void *b)
+{
+	const sysfsent_t *ea = a, *eb = b;
+
+	return (ea->ifindex < eb->ifindex ? -1 :
+	    ea->ifindex > eb->ifindex);
+}
+
+/*
+ * sysfs_list() -	List SYS_CLASS_NET_PATH into g_sysfs_ents, if it
+ *			has changed since last time
+ */
+static void
+sysfs_list()
+{
+	static int size;
+	struct dirent *dp;
+	char buf[32];
+	int i, n, changed;
+
+	n = 0;
+	changed = B_FALSE;
+	rewinddir(g_sysfs_dir);
+	while ((dp = readdir(g_sysfs_dir)) != NULL) {
+		if (dp->d_name[0] == '.' || strlen(dp->d_name) >= IFNAMSIZ)
+			continue;
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			g_sysfs_listed = realloc(g_sysfs_listed,
+			    size * sizeof (sysfsent_t));
+			g_sysfs_ents = realloc(g_sysfs_ents,
+			    size * sizeof (sysfsent_t));
+			if (g_sysfs_listed == NULL || g_sysfs_ents == NULL)
+				die(1, "realloc");
+		}
+		if (n >= g_sysfs_nlisted ||
+		    ! streql(g_sysfs_listed[n].name, dp->d_name)) {
+			(void) strcpy(g_sysfs_listed[n].name, dp->d_name);
+			changed = B_TRUE;
+		}
+		n++;
+	}
+	if (! changed && n == g_sysfs_nlisted)
+		return;
+	g_sysfs_nlisted = n;
+
+	/* Those without an ifindex (e.g. bonding_masters) are not ours */
+	g_sysfs_nents = 0;
+	for (i = 0; i < n; i++)
+		if (read_sys_net(g_sysfs_listed[i].name, "ifindex", buf,
+		    sizeof (buf)) > 0) {
+			g_sysfs_ents[g_sysfs_nents] = g_sysfs_listed[i];
+			g_sysfs_ents[g_sysfs_nents++].ifindex = atoi(buf);
+		}
+	qsort(g_sysfs_ents, g_sysfs_nents, sizeof (sysfsent_t),
+	    sysfs_ent_compare);
+}
+
+/*
+ * sysfs_sample_all() -	sysfs_sample() for every interface
+ */
+static int
+sysfs_sample_all(struct timeval *now_tv, int errors)
+{
+	struct nicdata *lastp;
+	struct sysfs_stat *sp;
+	sysfsent_t *ep;
+	unsigned long long ll[16];
+	char buf[32];
+	int count;
+
+	count = 0;
+	lastp = NULL;
+	sysfs_list();
+	for (ep = g_sysfs_ents; ep < &g_sysfs_ents[g_sysfs_nents]; ep++) {
+		(void) memset(ll, 0, sizeof (ll));
+		for (sp = g_sysfs_stats; sp->file; sp++) {
+			if (sp->errors && ! errors)
+				continue;
+			/* Gone, or a file this driver lacks */
+			if (read_sys_net(ep->name, sp->file, buf,
+			    sizeof (buf)) > 0)
+				ll[sp->column] += strtoull(buf, NULL, 10);
+			else if (sp == g_sysfs_stats)
+				break;
+		}
+		if (sp == g_sysfs_stats)
+			/* Not an interface, or gone */
+			continue;
+		if (collect_nic(&lastp, ep->name, ll, now_tv))
+			count++;
+		if (g_coll_probing && count == COLL_PROBE_IFS) {
+			/* Enough to time it by */
+			g_coll_cut = B_TRUE;
+			break;
+		}
+	}
+	return (count);
+}
+
+static int
+sysfs_sample(struct timeval *now_tv, phasetime_t *tp)
+{
+	int count, errors;
+
+	errors = g_opt_x || g_hist || g_store_dir || g_nsinks ||
+	    g_state_file || g_top_key == TOP_ERRORS;
+	if (g_sysfs_dir == NULL)
+		count = sysfs_sample_selected(now_tv, errors);
+	else
+		count = sysfs_sample_all(now_tv, errors);
+	if (g_timing) {
+		phase_end(PH_READ, tp);
+		phase_begin(tp);
+	}
+	return (count);
+}
+
+static void
+sysfs_close()
+{
+	int i;
+
+	if (g_sysfs_dir == NULL) {
+		for (i = 0; i < g_sysfs_nnics; i++)
+			if (g_sysfs_nics[i].open)
+				sysfs_nic_close(&g_sysfs_nics[i]);
+		return;
+	}
+	(void) closedir(g_sysfs_dir);
+	g_sysfs_dir = NULL;
+}
+
+/*
+ * The rtnetlink collector
+ */
+static struct timeval *g_rtnl_tv;	/* for rtnl_stats_handler() */
+static struct nicdata *g_rtnl_lastp;
+static int g_rtnl_count;
+
+/*
+ * rtnl_stats_handler() -	Save the IFLA_STATS64 of an RTM_NEWLINK
+ */
+static void
+rtnl_stats_handler(struct nlmsghdr *nlh)
+{
+	struct ifinfomsg *ifi;
+	struct rtattr *rta;
+	struct rtnl_link_stats64 st;
+	unsigned long long ll[16];
+	char *name;
+	int len, found;
+
+	if (nlh->nlmsg_type != RTM_NEWLINK)
+		return;
+	ifi = NLMSG_DATA(nlh);
+	len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof (*ifi));
+	name = NULL;
+	found = B_FALSE;
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFLA_IFNAME:
+			name = RTA_DATA(rta);
+			break;
+		case IFLA_STATS64:
+			(void) memset(&st, 0, sizeof (st));
+			(void) memcpy(&st, RTA_DATA(rta),
+			    RTA_PAYLOAD(rta) < sizeof (st) ?
+			    RTA_PAYLOAD(rta) : sizeof (st));
+			found = B_TRUE;
+			break;
+		}
+	}
+	if (name == NULL || ! found)
+		return;
+	/* As dev_seq_printf_stats() */
+	ll[0] = st.rx_bytes;
+	ll[1] = st.rx_packets;
+	ll[2] = st.rx_errors;
+	ll[3] = st.rx_dropped + st.rx_missed_errors;
+	ll[4] = st.rx_fifo_errors;
+	ll[5] = st.rx_length_errors + st.rx_over_errors +
+	    st.rx_crc_errors + st.rx_frame_errors;
+	ll[6] = st.rx_compressed;
+	ll[7] = st.multicast;
+	ll[8] = st.tx_bytes;
+	ll[9] = st.tx_packets;
+	ll[10] = st.tx_errors;
+	ll[11] = st.tx_dropped;
+	ll[12] = st.tx_fifo_errors;
+	ll[13] = st.collisions;
+	ll[14] = st.tx_carrier_errors + st.tx_aborted_errors +
+	    st.tx_window_errors + st.tx_heartbeat_errors;
+	ll[15] = st.tx_compressed;
+	if (collect_nic(&g_rtnl_lastp, name, ll, g_rtnl_tv))
+		g_rtnl_count++;
+}
+
+static int
+rtnl_coll_open()
+{
+	if (*g_proc_root != '\0')
+		/* -X: the statistics are not this system's */
+		return (B_FALSE);
+	if (g_rtnl < 0)
+		g_rtnl = rtnl_socket();
+	return (g_rtnl >= 0);
+}
+
+static int
+rtnl_coll_sample(struct timeval *now_tv, phasetime_t *tp)
+{
+	struct ifinfomsg ifi;
+
+	(void) memset(&ifi, 0, sizeof (ifi));
+	ifi.ifi_family = AF_UNSPEC;
+	g_rtnl_tv = now_tv;
+	g_rtnl_lastp = NULL;
+	g_rtnl_count = 0;
+	rtnl_dump(RTM_GETLINK, &ifi, sizeof (ifi), rtnl_stats_handler);
+	if (g_timing) {
+		phase_end(PH_READ, tp);
+		phase_begin(tp);
+	}
+	return (g_rtnl_count);
+}
+
+static void
+rtnl_coll_close()
+{
+	/* -q and -b open it again if they need it */
+	(void) close(g_rtnl);
+	g_rtnl = -1;
+}
+
+static collector_t g_collectors[] = {
+	{ "procfs",	procfs_open,	procfs_sample,	procfs_close },
+	{ "sysfs",	sysfs_open,	sysfs_sample,	sysfs_close },
+	{ "rtnetlink",	rtnl_coll_open,	rtnl_coll_sample, rtnl_coll_close },
+	{ NULL }
+};
+
+/*
+ * collector_select() -	Choose the collector: that named by -B, or
+ *			the cheapest of those available
+ *
+ * Candidates are timed over COLL_PROBES samples each, keeping the
+ * fastest.  The interfaces they find are counted, not kept, so the live
+ * nicdata is untouched.  sysfs reading all interfaces costs some files
+ * per interface, so it reads just COLL_PROBE_IFS of them, and its cost
+ * is scaled up to the most any collector found.
+ */
+static void
+collector_select()
+{
+	collector_t *cp, *avail[sizeof (g_collectors) /
+	    sizeof (g_collectors[0])];
+	struct timeval now_tv;
+	phasetime_t t, start, end;
+	int64_t cost[sizeof (g_collectors) / sizeof (g_collectors[0])];
+	int count[sizeof (g_collectors) / sizeof (g_collectors[0])];
+	int cut[sizeof (g_collectors) / sizeof (g_collectors[0])];
+	int64_t best_cost;
+	int i, n, navail, nifs;
+
+	if (g_collector_name) {
+		for (cp = g_collectors; cp->name; cp++)
+			if (streql(cp->name, g_collector_name))
+				break;
+		if (cp->name == NULL)
+			die(0, "-B: \"%s\" is not procfs, sysfs or rtnetlink",
+			    g_collector_name);
+		if (! cp->open())
+			die(0, "-B %s: not available", cp->name);
+		g_collector = cp;
+		return;
+	}
+
+	navail = 0;
+	for (cp = g_collectors; cp->name; cp++)
+		if (cp->open())
+			avail[navail++] = cp;
+	if (navail == 0)
+		die(1, "open: %s", PROC_NET_DEV_PATH);
+	g_collector = avail[0];
+	if (navail == 1)
+		return;
+
+	g_coll_probing = B_TRUE;
+	nifs = 0;
+	for (i = 0; i < navail; i++) {
+		cp = avail[i];
+		cost[i] = 0;
+		g_coll_cut = B_FALSE;
+		for (n = 0; n < COLL_PROBES; n++) {
+			phase_begin(&start);
+			(void) gettimeofday(&now_tv, NULL);
+			count[i] = cp->sample(&now_tv, &t);
+			phase_begin(&end);
+			if (n == 0 || end.wall - start.wall < cost[i])
+				cost[i] = end.wall - start.wall;
+		}
+		cut[i] = g_coll_cut;
+		if (count[i] > nifs)
+			nifs = count[i];
+	}
+	g_coll_probing = B_FALSE;
+
+	best_cost = 0;
+	for (i = 0; i < navail; i++) {
+		cp = avail[i];
+		if (cut[i] && count[i] < nifs)
+			cost[i] = cost[i] * nifs / count[i];
+		if (g_verbose)
+			diag(0, "%s collector: %lld ns per sample%s",
+			    cp->name, (long long)cost[i],
+			    cut[i] ? " (estimated)" : "");
+		if (i == 0 || cost[i] < best_cost) {
+			best_cost = cost[i];
+			g_collector = cp;
+		}
+	}
+	for (i = 0; i < navail; i++)
+		if (avail[i] != g_collector)
+			avail[i]->close();
+	if (g_verbose)
+		diag(0, "using the %s collector", g_collector->name);
+	(void) memset(g_phases, 0, sizeof (g_phases));
+}
+
+/*
+ * update_stats - update stats for interfaces we are tracking
+ */
+static void
+update_stats()
+{
+	struct nicdata *nicp;
+	struct timeval now_tv;
+	static char *snmp_buffer = NULL, *netstat_buffer = NULL;
+	static int snmp_size, netstat_size;
+	static int first = B_TRUE;
+	phasetime_t t = { 0, 0 };
+
+	/*
+	 * Collect interface statistics
+	 */
+	if (g_timing)
+		phase_begin(&t);
+#ifdef USE_URING
+	if (g_uring.fd >= 0)
+		uring_read_all();
+#endif
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next)
+		nicp->report = 0;
+	(void) gettimeofday(&now_tv, NULL);
+	g_sample_time = now_tv.tv_sec;
+	if (first) {
+		/* Rates since boot are over the uptime at this sample */
+		set_boot_tv(&now_tv);
+		first = B_FALSE;
+	}
+	if (g_align)
+		g_skew = (int64_t)(now_tv.tv_sec - g_tick.tv_sec) * 1000000 +
+		    now_tv.tv_usec - g_tick.tv_nsec / 1000;
+	g_nicdata_count = g_collector->sample(&now_tv, &t);
+	if (g_timing) {
+		phase_end(PH_PARSE, &t);
+		phase_begin(&t);
+	}
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (! nicp->report)
+			continue;
+		get_speed_duplex(nicp);
+		if (g_coalesce)
+			get_coalesce(nicp);
+	}
+	if (g_timing) {
+		phase_end(PH_SPEED, &t);
+		phase_begin(&t);
+	}
+	if (g_tcp || g_udp) {
+		(void) load_proc_file(g_snmp_fd, PROC_NET_SNMP_PATH,
+		    &snmp_buffer, &snmp_size);
+		load_snmp(snmp_buffer);
+	}
+	if (g_tcp) {
+		g_tcp_new->tv = now_tv;
+		(void) load_proc_file(g_netstat_fd, PROC_NET_NETSTAT_PATH,
+		    &netstat_buffer, &netstat_size);
+		load_netstat(netstat_buffer);
+	}
+	if (g_timing) {
+		phase_end(PH_SNMP, &t);
+		phase_begin(&t);
+	}
+	if (g_udp)
+		g_udp_new->tv = now_tv;
+	if (g_udp_sock)
+		load_udp_socks();
+	if (g_softnet)
+		load_softnet(&now_tv);
+	if (g_irq || g_coalesce)
+		load_interrupts(&now_tv);
+	if (g_qdisc || g_bond)
+		check_link_events();
+	if (g_qdisc)
+		load_qdiscs(&now_tv);
+	if (g_bond && g_bonds_stale)
+		discover_bonds();
+	if (g_timing)
+		phase_end(PH_OTHER, &t);
+}
+#endif /* OS_LINUX */
+
+/*
+ * precision -	figure an optimal floating precision for a printf()
+ */
+static inline int
+precision(double value)
+{
+	if (value < 100)
+		return (2);
+	else if (value < 100000)
+		return (1);
+	return (0);
+}
+
+static inline int
+precision4(double value)
+{
+	if (value < 10)
+		return (2);
+	else if (value < 100)
+		return (1);
+	return (0);
+}
+
+static inline int
+precision_p(double value)
+{
+	if (value < 100)
+		if (value < 10)
+			return (3);
+		else
+			return (2);
+	else if (value < 10000)
+		return (1);
+	return (0);
+}
+
+static char g_timestr[16];
+
+/*
+ * time_string() -	Format a time (or now, if tptr is NULL) as HH:MM:SS;
+ *			safe from the -A writer thread
+ */
+static void
+time_string(time_t *tptr, char *buf, size_t size)
+{
+	struct tm tm;
+	time_t t;
+
+	if (tptr)
+		t = *tptr;
+	else
+		t = time(NULL);
+	(void) localtime_r(&t, &tm);
+	(void) strftime(buf, size, "%H:%M:%S", &tm);
+}
+
+static void
+update_timestr(time_t *tptr)
+{
+	time_string(tptr, g_timestr, sizeof (g_timestr));
+}
+
+static uint32_t
+tcpudpstat(uint32_t new, uint32_t old)
+{
+	if (new < old)
+		return((UINT32_MAX - old) + new);
+	else
+		return(new - old);
+}
+
+#define	TCPSTAT(field)	tcpudpstat(((g_tcp_new)->field), ((g_tcp_old)->field))
+#define	UDPSTAT(field)	tcpudpstat(((g_udp_new)->field), ((g_udp_old)->field))
+
+static void
+print_tcp(FILE *fp)
+{
+	double tdiff;
+	uint64_t resets;
+	double retrans_rate;
+	uint64_t outbytes;
+	double inkb, outkb, inseg, outseg, reset, attfail, inconn,
+		outconn, drops;
+	tcpstats_t *tsp;
+
+	if (g_tcp_old->tv.tv_sec == 0)
+		/* Not initialised */
+#ifdef OS_LINUX
+		g_tcp_old->tv = g_boot_tv;
+#else
+		g_tcp_old->tv.tv_sec = fetch_boot_time();
+#endif
+	tdiff = tv_diff(&g_tcp_new->tv, &g_tcp_old->tv);
+	if (tdiff == 0)
+		tdiff = 1;
+
+	/* Header */
+	update_timestr(&(g_tcp_new->tv.tv_sec));
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %7s %7s %7s %7s %5s %5s %4s %5s %5s %5s\n",
+			g_timestr, "InKB", "OutKB", "InSeg", "OutSeg",
+			"Reset", "AttF", "%ReTX", "InConn", "OutCon", "Drops");
+
+	resets = (TCPSTAT(estabResets) + TCPSTAT(outRsts));
+	outbytes = TCPSTAT(outDataBytes);
+
+	inkb = (TCPSTAT(inDataInorderBytes) + TCPSTAT(inDataUnorderBytes)) /
+		1024.0 / tdiff;
+	outkb = outbytes / 1024.0 / tdiff;
+	inseg = (TCPSTAT(inDataInorderSegs) + TCPSTAT(inDataUnorderSegs)) /
+		tdiff;
+	outseg = TCPSTAT(outDataSegs) / tdiff;
+	reset = resets / tdiff;
+	attfail = TCPSTAT(attemptFails) / tdiff;
+	if (outbytes == 0)
+		retrans_rate = 0.0;
+	else
+		retrans_rate = TCPSTAT(retransBytes) * 100.0 /
+			(double)outbytes;
+	inconn = TCPSTAT(passiveOpens) / tdiff;
+	outconn = TCPSTAT(activeOpens) / tdiff;
+	drops = (TCPSTAT(halfOpenDrop) + TCPSTAT(listenDrop) +
+		TCPSTAT(listenDropQ0)) / tdiff;
+
+#ifdef NOTDEBUG
+	double ods_rate = (g_tcp_new->outDataSegs - g_tcp_old->outDataSegs) /
+		tdiff;
+	(void) fprintf(fp, "old->outDataSegs = %llu, new->outDataSegs = %llu, "
+		"  tdiff = %7.2f; rate = %7.2f\n",
+		g_tcp_old->outDataSegs, g_tcp_new->outDataSegs,
+		tdiff, ods_rate);
+#endif /* DEBUG */
+	if (g_opt_p)
+		(void) fprintf(fp, "%ld:TCP:%.*f:%.*f:%.*f:%.*f:%.*f:%.*f:"
+			"%.*f:%.*f:%.*f:%.*f\n",
+			g_tcp_new->tv.tv_sec,
+			precision_p(inkb), inkb,
+			precision_p(outkb), outkb,
+			precision_p(inseg), inseg,
+			precision_p(outseg), outseg,
+			precision_p(reset), reset,
+			precision_p(attfail), attfail,
+			precision_p(retrans_rate), retrans_rate,
+			precision_p(inconn), inconn,
+			precision_p(outconn), outconn,
+			precision_p(drops), drops);
+	else
+		(void) fprintf(fp, "TCP      %7.*f %7.*f %7.*f %7.*f %5.*f %5.*f "
+			"%4.*f %6.*f %6.*f %5.*f\n",
+			precision(inkb), inkb,
+			precision(outkb), outkb,
+			precision(inseg), inseg,
+			precision(outseg), outseg,
+			precision4(reset), reset,
+			precision4(attfail), attfail,
+			precision_p(retrans_rate), retrans_rate,
+			precision4(inconn), inconn,
+			precision4(outconn), outconn,
+			precision4(drops), drops);
+	/* Flip pointers to TCP stats */
+	tsp = g_tcp_old;
+	g_tcp_old = g_tcp_new;
+	g_tcp_new = tsp;
+}
+
+static void
+print_udp(FILE *fp)
+{
+	double indg, outdg, inerr, outerr;
+	double noport, rcvbuf, sndbuf, csumerr;
+	udpstats_t *usp;
+	double tdiff;
+
+	if (g_udp_old->tv.tv_sec == 0)
+		/* Not initialised */
+#ifdef OS_LINUX
+		g_udp_old->tv = g_boot_tv;
+#else
+		g_udp_old->tv.tv_sec = fetch_boot_time();
+#endif
+	tdiff = tv_diff(&g_udp_new->tv, &g_udp_old->tv);
+	if (tdiff == 0)
+		tdiff = 1;
+
+	/* Header */
+	update_timestr(&(g_udp_new->tv.tv_sec));
+	if (! g_opt_p) {
+		if (g_udp_sock)
+			(void) fprintf(fp, "%8s                 %7s %7s   %7s %7s "
+				"%7s %7s %7s %7s\n",
+				g_timestr, "InDG", "OutDG", "InErr", "OutErr",
+				"NoPort", "RcvBuf", "SndBuf", "CsumEr");
+		else
+			(void) fprintf(fp, "%8s                 %7s %7s   %7s %7s\n",
+				g_timestr, "InDG", "OutDG", "InErr", "OutErr");
+	}
+
+	indg = UDPSTAT(inDatagrams) / tdiff;
+	outdg = UDPSTAT(outDatagrams) / tdiff;
+	inerr = UDPSTAT(inErrors) / tdiff;
+	outerr = UDPSTAT(outErrors) / tdiff;
+
+	if (g_udp_sock) {
+		noport = UDPSTAT(noPorts) / tdiff;
+		rcvbuf = UDPSTAT(rcvbufErrors) / tdiff;
+		sndbuf = UDPSTAT(sndbufErrors) / tdiff;
+		csumerr = UDPSTAT(inCsumErrors) / tdiff;
+		if (g_opt_p)
+			(void) fprintf(fp, "%ld:UDP:%.*f:%.*f:%.*f:%.*f:"
+				"%.*f:%.*f:%.*f:%.*f\n",
+				g_udp_new->tv.tv_sec,
+				precision_p(indg), indg,
+				precision_p(outdg), outdg,
+				precision_p(inerr), inerr,
+				precision_p(outerr), outerr,
+				precision_p(noport), noport,
+				precision_p(rcvbuf), rcvbuf,
+				precision_p(sndbuf), sndbuf,
+				precision_p(csumerr), csumerr);
+		else
+			(void) fprintf(fp, "UDP                      "
+				"%7.*f %7.*f   %7.*f %7.*f %7.*f %7.*f "
+				"%7.*f %7.*f\n",
+				precision(indg), indg,
+				precision(outdg), outdg,
+				precision(inerr), inerr,
+				precision(outerr), outerr,
+				precision(noport), noport,
+				precision(rcvbuf), rcvbuf,
+				precision(sndbuf), sndbuf,
+				precision(csumerr), csumerr);
+	} else if (g_opt_p)
+		(void) fprintf(fp, "%ld:UDP:%.*f:%.*f:%.*f:%.*f\n",
+			g_udp_new->tv.tv_sec,
+			precision_p(indg), indg,
+			precision_p(outdg), outdg,
+			precision_p(inerr), inerr,
+			precision_p(outerr), outerr);
+	else
+		(void) fprintf(fp, "UDP                      "
+			"%7.*f %7.*f   %7.*f %7.*f\n",
+			precision(indg), indg,
+			precision(outdg), outdg,
+			precision(inerr), inerr,
+			precision(outerr), outerr);
+
+	/* Flip pointers to TCP stats */
+	usp = g_udp_old;
+	g_udp_old = g_udp_new;
+	g_udp_new = usp;
+}
+
+#ifdef OS_LINUX
+/*
+ * udp_sock_busier() -	Is socket a busier than b?  Drops, then rx_queue
+ */
+static inline int
+udp_sock_busier(udpsock_t *a, udpsock_t *b)
+{
+	if (a->ddrops != b->ddrops)
+		return (a->ddrops > b->ddrops);
+	return (a->rxq > b->rxq);
+}
+
+/*
+ * print_udp_socks() -	Show the UDP sockets with the most drops and/or
+ *			the fullest receive queues.
+ */
+static void
+print_udp_socks(FILE *fp)
+{
+	static int baseline = B_FALSE;
+	udpsock_t *top[UDP_TOP_SOCKETS];
+	udpsock_t *sp;
+	udpsocktab_t tab;
+	char addr[INET6_ADDRSTRLEN];
+	double tdiff, drops;
+	int i, j, ntop;
+
+	/*
+	 * Drops are counted from each socket's creation, so a rate needs
+	 * a previous sample to take them from; until then, just keep this
+	 * one
+	 */
+	if (! baseline) {
+		baseline = B_TRUE;
+		goto flip;
+	}
+	tdiff = tv_diff(&g_udp_old->tv, &g_udp_new->tv);
+	if (tdiff <= 0)
+		tdiff = 1;
+
+	/* Keep the UDP_TOP_SOCKETS busiest, in order */
+	ntop = 0;
+	for (i = 0; i < g_usock_new.count; i++) {
+		sp = &g_usock_new.socks[i];
+		if (sp->ddrops == 0 && sp->rxq == 0)
+			continue;
+		if (ntop == UDP_TOP_SOCKETS &&
+		    ! udp_sock_busier(sp, top[ntop - 1]))
+			continue;
+		if (ntop < UDP_TOP_SOCKETS)
+			ntop++;
+		for (j = ntop - 1; j > 0 && udp_sock_busier(sp, top[j - 1]);
+		    j--)
+			top[j] = top[j - 1];
+		top[j] = sp;
+	}
+
+	if (! g_opt_p && ntop > 0)
+		(void) fprintf(fp, "%8s %-39s %5s %9s %9s %8s\n", "",
+			"UDP Socket", "Port", "RxQueue", "TxQueue", "Drops/s");
+	for (i = 0; i < ntop; i++) {
+		sp = top[i];
+		if (inet_ntop(sp->family, sp->addr, addr, sizeof (addr)) == NULL)
+			(void) strcpy(addr, "?");
+		drops = sp->ddrops / tdiff;
+		if (g_opt_p)
+			/* Bracket IPv6 addresses, to keep ':' as a separator */
+			(void) fprintf(fp, "%ld:UDPSOCK:%s%s%s:%d:%u:%u:%.*f\n",
+				g_udp_old->tv.tv_sec,
+				sp->family == AF_INET6 ? "[" : "", addr,
+				sp->family == AF_INET6 ? "]" : "", sp->port,
+				sp->rxq, sp->txq, precision_p(drops), drops);
+		else
+			(void) fprintf(fp, "%8s %-39s %5d %9u %9u %8.*f\n", "",
+				addr, sp->port, sp->rxq, sp->txq,
+				precision(drops), drops);
+	}
+
+flip:
+	/* Flip socket tables */
+	tab = g_usock_old;
+	g_usock_old = g_usock_new;
+	g_usock_new = tab;
+}
+
+/*
+ * print_softnet() -	Show per-CPU NET_RX softirq rates
+ *
+ * The Flags column marks CPUs that dropped packets because their
+ * backlog was full (D), ran out of NET_RX budget or time (S), or
+ * processed more than SOFTNET_HOT_FACTOR times an even share of
+ * packets (H).
+ */
+static void
+print_softnet(FILE *fp)
+{
+	softnetstats_t *np, *op;
+	softnet_t *tsp;
+	softnetstats_t total;
+	double tdiff, processed, dropped, squeezed, rps, flow_limit;
+	double even_share;
+	char flags[4];
+	int i, f;
+
+	if (g_softnet_old->tv.tv_sec == 0)
+		/* Not initialised */
+		g_softnet_old->tv = g_boot_tv;
+	tdiff = tv_diff(&g_softnet_new->tv, &g_softnet_old->tv);
+	if (tdiff == 0)
+		tdiff = 1;
+
+	/* First pass - totals, for the even share of packets */
+	(void) memset(&total, 0, sizeof (total));
+	for (i = 0; i < g_softnet_new->count; i++) {
+		np = &g_softnet_new->cpus[i];
+		op = i < g_softnet_old->count ? &g_softnet_old->cpus[i] : NULL;
+		if (op && op->cpu == np->cpu && op->processed <= np->processed)
+			total.processed += np->processed - op->processed;
+		else
+			total.processed += np->processed;
+	}
+	even_share = (double)total.processed / g_softnet_new->count;
+
+	update_timestr(&(g_softnet_new->tv.tv_sec));
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %5s %10s %8s %8s %8s %8s %5s\n",
+			g_timestr, "CPU", "Proc/s", "Drop/s", "Sqz/s",
+			"RPS/s", "FlowL/s", "Flags");
+	(void) memset(&total, 0, sizeof (total));
+	for (i = 0; i < g_softnet_new->count; i++) {
+		np = &g_softnet_new->cpus[i];
+		op = i < g_softnet_old->count ? &g_softnet_old->cpus[i] : NULL;
+		if (op && op->cpu == np->cpu && op->processed <= np->processed) {
+			processed = np->processed - op->processed;
+			dropped = np->dropped - op->dropped;
+			squeezed = np->squeezed - op->squeezed;
+			rps = np->rps - op->rps;
+			flow_limit = np->flow_limit - op->flow_limit;
+		} else {
+			/* New (or renumbered) CPU - since boot */
+			processed = np->processed;
+			dropped = np->dropped;
+			squeezed = np->squeezed;
+			rps = np->rps;
+			flow_limit = np->flow_limit;
+		}
+		total.processed += processed;
+		total.dropped += dropped;
+		total.squeezed += squeezed;
+		total.rps += rps;
+		total.flow_limit += flow_limit;
+
+		f = 0;
+		if (dropped > 0)
+			flags[f++] = 'D';
+		if (squeezed > 0)
+			flags[f++] = 'S';
+		if (g_softnet_new->count > 1 &&
+		    processed > SOFTNET_HOT_FACTOR * even_share)
+			flags[f++] = 'H';
+		if (f == 0)
+			flags[f++] = '-';
+		flags[f] = '\0';
+
+		processed /= tdiff;
+		dropped /= tdiff;
+		squeezed /= tdiff;
+		rps /= tdiff;
+		flow_limit /= tdiff;
+		if (g_opt_p)
+			(void) fprintf(fp, "%ld:CPU%d:%.*f:%.*f:%.*f:%.*f:%.*f:%s\n",
+				g_softnet_new->tv.tv_sec, np->cpu,
+				precision_p(processed), processed,
+				precision_p(dropped), dropped,
+				precision_p(squeezed), squeezed,
+				precision_p(rps), rps,
+				precision_p(flow_limit), flow_limit,
+				flags);
+		else
+			(void) fprintf(fp, "%8s %5d %10.*f %8.*f %8.*f %8.*f "
+				"%8.*f %5s\n", "", np->cpu,
+				precision(processed), processed,
+				precision(dropped), dropped,
+				precision(squeezed), squeezed,
+				precision(rps), rps,
+				precision(flow_limit), flow_limit,
+				flags);
+	}
+	if (! g_opt_p && g_softnet_new->count > 1) {
+		(void) fprintf(fp, "%8s %5s %10.*f %8.*f %8.*f %8.*f %8.*f\n",
+			"", "all",
+			precision(total.processed / tdiff),
+			total.processed / tdiff,
+			precision(total.dropped / tdiff),
+			total.dropped / tdiff,
+			precision(total.squeezed / tdiff),
+			total.squeezed / tdiff,
+			precision(total.rps / tdiff), total.rps / tdiff,
+			precision(total.flow_limit / tdiff),
+			total.flow_limit / tdiff);
+	}
+
+	/* Flip softnet samples */
+	tsp = g_softnet_old;
+	g_softnet_old = g_softnet_new;
+	g_softnet_new = tsp;
+}
+
+/*
+ * irq_busiest() -	Format the busiest CPUs in rates[] as "cpu:rate ..."
+ */
+static void
+irq_busiest(double *rates, char sep, char *buf, int bufsiz)
+{
+	int top[IRQ_TOP_CPUS];
+	int i, j, ntop, len;
+
+	ntop = 0;
+	for (i = 0; i < g_irq_ncpus; i++) {
+		if (rates[i] <= 0)
+			continue;
+		if (ntop == IRQ_TOP_CPUS && rates[i] <= rates[top[ntop - 1]])
+			continue;
+		if (ntop < IRQ_TOP_CPUS)
+			ntop++;
+		for (j = ntop - 1; j > 0 && rates[i] > rates[top[j - 1]]; j--)
+			top[j] = top[j - 1];
+		top[j] = i;
+	}
+	(void) strcpy(buf, "-");
+	for (i = 0, len = 0; i < ntop && len < bufsiz; i++)
+		len += snprintf(buf + len, bufsiz - len, "%s%d%c%.*f",
+		    i ? (sep == ':' ? " " : ";") : "",
+		    g_irq_cpu_ids[top[i]], sep,
+		    precision(rates[top[i]]), rates[top[i]]);
+}
+
+/*
+ * print_irq_line() -	Print one line of -I output
+ */
+static void
+print_irq_line(FILE *fp, char *name, char *irq, double *rates, double imbal)
+{
+	char busiest[IRQ_TOP_CPUS * 24];
+	char imbal_s[16];
+	double total;
+	int cpu, ncpus;
+
+	total = 0;
+	ncpus = 0;
+	for (cpu = 0; cpu < g_irq_ncpus; cpu++)
+		if (rates[cpu] > 0) {
+			total += rates[cpu];
+			ncpus++;
+		}
+	if (imbal < 0)
+		(void) strcpy(imbal_s, "-");
+	else
+		(void) snprintf(imbal_s, sizeof (imbal_s), "%.2f", imbal);
+	if (g_opt_p) {
+		irq_busiest(rates, '=', busiest, sizeof (busiest));
+		(void) fprintf(fp, "%ld:IRQ:%s:%s:%.*f:%d:%s:%s\n",
+			g_irq_tv_new.tv_sec, name, irq,
+			precision_p(total), total, ncpus, imbal_s, busiest);
+	} else {
+		irq_busiest(rates, ':', busiest, sizeof (busiest));
+		(void) fprintf(fp, "%8s %-10s %5s %10.*f %5d %5s  %s\n", "",
+			name, irq, precision(total), total, ncpus, imbal_s,
+			busiest);
+	}
+}
+
+/*
+ * print_irqs() -	Show interrupt rates per interface, IRQ and CPU
+ *
+ * The imbalance score is 0 when an interface's interrupts are spread
+ * evenly over as many CPUs as it has IRQs (or as there are CPUs), and
+ * 1 when one CPU takes all of them.
+ */
+static void
+print_irqs(FILE *fp)
+{
+	static double *if_rates = NULL, *irq_rates = NULL;
+	static int rates_ncpus = 0;
+	struct nicdata *nicp;
+	irqstats_t *ip;
+	double tdiff, total, busiest, imbal;
+	char irq_s[16];
+	int i, cpu, k;
+
+	if (rates_ncpus != g_irq_ncpus) {
+		free(if_rates);
+		free(irq_rates);
+		if_rates = allocate(g_irq_ncpus * sizeof (double));
+		irq_rates = allocate(g_irq_ncpus * sizeof (double));
+		rates_ncpus = g_irq_ncpus;
+	}
+	tdiff = tv_diff(&g_irq_tv_new, &g_irq_tv_old);
+	if (tdiff == 0)
+		tdiff = 1;
+
+	update_timestr(&g_irq_tv_new.tv_sec);
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %-10s %5s %10s %5s %5s  %s\n", g_timestr,
+			"Int", "IRQ", "Intr/s", "CPUs", "Imbal",
+			"Busiest CPU:Intr/s");
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (! nicp->report || nicp->nirqs == 0)
+			continue;
+		(void) memset(if_rates, 0, g_irq_ncpus * sizeof (double));
+		/* Interface totals first, then each IRQ */
+		for (k = 0; k < 2; k++) {
+			if (k == 1) {
+				total = busiest = 0;
+				for (cpu = 0; cpu < g_irq_ncpus; cpu++) {
+					total += if_rates[cpu];
+					busiest = max(busiest, if_rates[cpu]);
+				}
+				i = min(nicp->nirqs, g_irq_ncpus);
+				if (total == 0)
+					imbal = -1;
+				else if (i > 1)
+					imbal = (busiest / total - 1.0 / i) /
+						(1 - 1.0 / i);
+				else
+					imbal = 0;
+				print_irq_line(fp, nicp->name, "all", if_rates,
+				    imbal);
+			}
+			for (i = 0; i < nicp->nirqs; i++) {
+				ip = g_irq_table[nicp->irqs[i]];
+				if (ip->new == NULL || ! ip->primed)
+					continue;
+				for (cpu = 0; cpu < g_irq_ncpus; cpu++) {
+					irq_rates[cpu] = irq_rate(ip, cpu,
+					    tdiff);
+					if (k == 0)
+						if_rates[cpu] += irq_rates[cpu];
+				}
+				if (k == 1) {
+					(void) snprintf(irq_s, sizeof (irq_s),
+					    "%d", nicp->irqs[i]);
+					print_irq_line(fp, nicp->name, irq_s,
+					    irq_rates, -1);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * print_coalesce() -	Show packets per interrupt, and coalescing settings
+ *
+ * %CPU is an estimate of the time spent taking the interface's
+ * interrupts, as a percentage of one CPU, assuming each costs
+ * INTR_COST_NSEC.
+ */
+static void
+print_coalesce(FILE *fp)
+{
+	struct nicdata *nicp;
+	struct nic_coalesce *cp;
+	double tdiff, intrs, pps, ppi, cpu;
+	char ppi_s[16], set_s[48];
+	char *adaptive;
+
+	update_timestr(&g_irq_tv_new.tv_sec);
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %-10s %9s %9s %7s %5s %5s %5s %5s %5s %5s\n",
+			g_timestr, "Int", "Intr/s", "Pk/s", "Pk/Intr", "%CPU",
+			"rxUs", "rxFr", "txUs", "txFr", "Adapt");
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (! nicp->report || nicp->nirqs == 0)
+			continue;
+		if ((intrs = irq_nic_rate(nicp)) < 0)
+			continue;
+		tdiff = nic_tdiff(nicp);
+		pps = (nicp->new.rpackets - nicp->old.rpackets) / tdiff;
+		pps += (nicp->new.wpackets - nicp->old.wpackets) / tdiff;
+		cpu = intrs * INTR_COST_NSEC / 1e9 * 100;
+		if (intrs > 0) {
+			ppi = pps / intrs;
+			(void) snprintf(ppi_s, sizeof (ppi_s), "%.*f",
+			    g_opt_p ? precision_p(ppi) : precision4(ppi), ppi);
+		} else
+			(void) strcpy(ppi_s, "-");
+
+		cp = &nicp->coalesce;
+		if (cp->adaptive_rx && cp->adaptive_tx)
+			adaptive = "rx,tx";
+		else if (cp->adaptive_rx)
+			adaptive = "rx";
+		else if (cp->adaptive_tx)
+			adaptive = "tx";
+		else
+			adaptive = "-";
+		if (nicp->flags & NIC_NO_GCOALESCE)
+			(void) snprintf(set_s, sizeof (set_s),
+			    g_opt_p ? "-:-:-:-:-" : "%5s %5s %5s %5s %5s",
+			    "-", "-", "-", "-", "-");
+		else
+			(void) snprintf(set_s, sizeof (set_s),
+			    g_opt_p ? "%u:%u:%u:%u:%s" : "%5u %5u %5u %5u %5s",
+			    cp->rx_usecs, cp->rx_frames, cp->tx_usecs,
+			    cp->tx_frames, adaptive);
+		if (g_opt_p)
+			(void) fprintf(fp, "%ld:COAL:%s:%.*f:%.*f:%s:%.*f:%s\n",
+				nicp->new.tv.tv_sec, nicp->name,
+				precision_p(intrs), intrs,
+				precision_p(pps), pps, ppi_s,
+				precision_p(cpu), cpu, set_s);
+		else
+			(void) fprintf(fp, "%8s %-10s %9.*f %9.*f %7s %5.*f %s\n",
+				"", nicp->name,
+				precision(intrs), intrs,
+				precision(pps), pps, ppi_s,
+				precision4(cpu), cpu, set_s);
+	}
+}
+
+/*
+ * tc_handle_string() -	Format a qdisc handle the way tc(8) does; except
+ *			that the parseable format uses "." for ":"
+ */
+static char *
+tc_handle_string(uint32_t handle, char *buf, int bufsiz)
+{
+	char *sep = g_opt_p ? "." : ":";
+
+	if (handle == TC_H_ROOT)
+		(void) strncpy(buf, "root", bufsiz);
+	else if (handle == TC_H_INGRESS)
+		(void) strncpy(buf, "ingress", bufsiz);
+	else if (TC_H_MIN(handle) == 0)
+		(void) snprintf(buf, bufsiz, "%x%s", TC_H_MAJ(handle) >> 16,
+		    sep);
+	else
+		(void) snprintf(buf, bufsiz, "%x%s%x", TC_H_MAJ(handle) >> 16,
+		    sep, TC_H_MIN(handle));
+	return (buf);
+}
+
+/*
+ * print_qdiscs() -	Show queueing discipline statistics
+ *
+ * Root qdiscs include the traffic of their children, so give the
+ * interface's totals.  With -z, idle qdiscs are not shown.
+ */
+static void
+print_qdiscs(FILE *fp)
+{
+	qdiscstats_t *qp;
+	double tdiff, kbps, pps, drops, overlimits, requeues;
+	char handle_s[16], parent_s[16];
+	char *name;
+	int i;
+
+	tdiff = tv_diff(&g_qdisc_tv_new, &g_qdisc_tv_old);
+	if (tdiff == 0)
+		tdiff = 1;
+	update_timestr(&g_qdisc_tv_new.tv_sec);
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %-10s %-10s %7s %7s %7s %7s %6s %6s %6s "
+			"%8s %5s\n", g_timestr, "Int", "Qdisc", "Handle",
+			"Parent", g_opt_m ? "Mbps" : "KB/s", "Pk/s",
+			"Drop/s", "Ovrl/s", "Rque/s", "Backlog", "Qlen");
+	for (i = 0; i < g_qdisc_count; i++) {
+		qp = &g_qdiscs[i];
+		if (! qp->primed)
+			continue;
+		name = ifindex_to_name(qp->ifindex);
+		if (name == NULL || if_is_ignored(name))
+			continue;
+		if (g_nonlocal && streql(name, "lo"))
+			continue;
+		kbps = (qp->new.bytes - qp->old.bytes) / tdiff / 1024;
+		if (g_opt_m)
+			kbps /= 128;
+		pps = (uint32_t)(qp->new.packets - qp->old.packets) / tdiff;
+		drops = (uint32_t)(qp->new.drops - qp->old.drops) / tdiff;
+		overlimits = (uint32_t)(qp->new.overlimits -
+			qp->old.overlimits) / tdiff;
+		requeues = (uint32_t)(qp->new.requeues - qp->old.requeues) /
+			tdiff;
+		if (g_skipzero && pps == 0 && drops == 0 && overlimits == 0 &&
+		    qp->backlog == 0)
+			continue;
+		(void) tc_handle_string(qp->handle, handle_s,
+		    sizeof (handle_s));
+		(void) tc_handle_string(qp->parent, parent_s,
+		    sizeof (parent_s));
+		if (g_opt_p)
+			(void) fprintf(fp, "%ld:QDISC:%s:%s:%s:%s:%.*f:%.*f:%.*f:"
+				"%.*f:%.*f:%u:%u\n",
+				g_qdisc_tv_new.tv_sec, name, qp->kind,
+				handle_s, parent_s,
+				precision_p(kbps), kbps,
+				precision_p(pps), pps,
+				precision_p(drops), drops,
+				precision_p(overlimits), overlimits,
+				precision_p(requeues), requeues,
+				qp->backlog, qp->qlen);
+		else
+			(void) fprintf(fp, "%8s %-10s %-10s %7s %7s %7.*f %7.*f "
+				"%6.*f %6.*f %6.*f %8u %5u\n", "", name,
+				qp->kind, handle_s, parent_s,
+				precision(kbps), kbps,
+				precision(pps), pps,
+				precision4(drops), drops,
+				precision4(overlimits), overlimits,
+				precision4(requeues), requeues,
+				qp->backlog, qp->qlen);
+	}
+
+	/* Save the current values for next time */
+	for (i = 0; i < g_qdisc_count; i++) {
+		g_qdiscs[i].old = g_qdiscs[i].new;
+		g_qdiscs[i].primed = B_TRUE;
+	}
+	g_qdisc_tv_old = g_qdisc_tv_new;
+}
+
+#endif /* OS_LINUX */
+
+/*
+ * nic_ewma() -	Fold an interface's latest rates into its -L moving
+ *		averages, and copy them out with the rates
+ */
+static void
+nic_ewma(struct nicdata *nicp, nicrates_t *rp)
+{
+	double value[EW_COUNT];
+	int m, s;
+
+	value[EW_RBYTES] = rp->rbps;
+	value[EW_WBYTES] = rp->wbps;
+	value[EW_PACKETS] = rp->rpps + rp->wpps;
+	value[EW_UTIL] = rp->util;
+	for (m = 0; m < EW_COUNT; m++)
+		for (s = 0; s < g_ewma_nspans; s++) {
+			if (nicp->ewma_primed)
+				nicp->ewma[m][s] += g_ewma_alpha[s] *
+				    (value[m] - nicp->ewma[m][s]);
+			else
+				nicp->ewma[m][s] = value[m];
+			rp->ewma[m][s] = nicp->ewma[m][s];
+		}
+	nicp->ewma_primed = B_TRUE;
+}
+
+/*
+ * ewma_util() -	Work out the utilisation averages of summed rates,
+ *			from their byte averages and the summed speed
+ */
+static void
+ewma_util(nicrates_t *rp, uint64_t speed)
+{
+	int s;
+
+	for (s = 0; s < g_ewma_nspans; s++)
+		if (speed > 0)
+			rp->ewma[EW_UTIL][s] = min(max(rp->ewma[EW_RBYTES][s],
+			    rp->ewma[EW_WBYTES][s]) * 800 / speed, 100);
+		else
+			rp->ewma[EW_UTIL][s] = 0;
+}
+
+/*
+ * print_ewma_header() -	Header of the -L columns
+ */
+static void
+print_ewma_header(output_t *op)
+{
+	char *prefix[EW_COUNT];
+	char heading[16];
+	int m, s;
+
+	prefix[EW_RBYTES] = g_opt_m ? "rMb" : "rKB";
+	prefix[EW_WBYTES] = g_opt_m ? "wMb" : "wKB";
+	prefix[EW_PACKETS] = "Pk";
+	prefix[EW_UTIL] = "Ut";
+	for (m = 0; m < EW_COUNT; m++)
+		for (s = 0; s < g_ewma_nspans; s++) {
+			(void) snprintf(heading, sizeof (heading), "%s:%d",
+			    prefix[m], g_ewma_spans[s]);
+			(void) fprintf(op->fp, " %7s", heading);
+		}
+}
+
+/*
+ * print_ewma() -	The -L columns, which follow the usual ones in every
+ *			style
+ */
+static void
+print_ewma(output_t *op, nicrates_t *rp)
+{
+	double value;
+	int m, s;
+
+	for (m = 0; m < EW_COUNT; m++)
+		for (s = 0; s < g_ewma_nspans; s++) {
+			value = rp->ewma[m][s];
+			if (m == EW_RBYTES || m == EW_WBYTES)
+				value /= g_opt_m ? 1024 * 128 : 1024;
+			if (op->style == STYLE_PARSEABLE ||
+			    op->style == STYLE_EXTENDED_PARSEABLE)
+				(void) fprintf(op->fp, ":%.*f", m == EW_UTIL ?
+				    precision4(value) : precision_p(value),
+				    value);
+			else
+				(void) fprintf(op->fp, " %7.*f", m == EW_UTIL ?
+				    precision4(value) : precision(value),
+				    value);
+		}
+}
+
+#ifdef OS_LINUX
+/*
+ * async_record() -	Queue a header or an interface line for the -A
+ *			writer, after the text printed so far
+ */
+static void
+async_record(int header, char *name, time_t t, nicrates_t *rp)
+{
+	outrec_t *rec;
+
+	if (fflush(g_async_mem) != 0)
+		die(1, "fflush");
+	if (g_async_nrecs == g_async_maxrecs) {
+		g_async_maxrecs = g_async_maxrecs ? g_async_maxrecs * 2 : 64;
+		g_async_recs = realloc(g_async_recs,
+		    g_async_maxrecs * sizeof (outrec_t));
+		if (g_async_recs == NULL)
+			die(1, "realloc");
+	}
+	rec = &g_async_recs[g_async_nrecs++];
+	rec->text = g_async_mem_len;
+	rec->header = header;
+	rec->t = t;
+	if (name) {
+		(void) strncpy(rec->name, name, sizeof (rec->name) - 1);
+		rec->name[sizeof (rec->name) - 1] = '\0';
+	}
+	if (rp)
+		rec->rates = *rp;
+}
+#endif /* OS_LINUX */
+
+/*
+ * print_header - print the header line; t is the time for the extended
+ * styles' header.
+ */
+static void
+print_header(output_t *op, time_t t)
+{
+	char timestr[16];
+
+#ifdef OS_LINUX
+	if (op->async) {
+		async_record(B_TRUE, NULL, t, NULL);
+		return;
+	}
+#endif
+#if DEBUG > 1
+	(void) fprintf(op->fp, "<<nic_count = %d>>", g_nicdata_count);
+#endif
+	switch (op->style) {
+	case STYLE_SUMMARY:
+		(void) fprintf(op->fp, "%8s %8s %14s %14s",
+		    "Time", "Int", g_runit_1, g_wunit_1);
+		break;
+	case STYLE_FULL:
+		(void) fprintf(op->fp, "%8s %8s %7s %7s %7s "
+		    "%7s %7s %7s %5s %6s",
+		    "Time", "Int", g_runit_1, g_wunit_1, "rPk/s",
+		    "wPk/s", "rAvs", "wAvs", "%Util", "Sat");
+		break;
+	case STYLE_FULL_UTIL:
+		(void) fprintf(op->fp, "%8s %8s %7s %7s %7s "
+		    "%7s %7s %7s %6s %6s",
+		    "Time", "Int", g_runit_1, g_wunit_1, "rPk/s",
+		    "wPk/s", "rAvs", "wAvs", "%rUtil", "%wUtil");
+		break;
+	case STYLE_EXTENDED:
+		time_string(&t, timestr, sizeof (timestr));
+		(void) fprintf(op->fp, "%-10s %7s %7s %7s %7s  "
+		    "%5s %5s %5s %5s %5s  %5s",
+		    timestr, g_runit_2, g_wunit_2, "RdPkt", "WrPkt",
+		    "IErr", "OErr", "Coll", "NoCP", "Defer", "%Util");
+		break;
+	case STYLE_EXTENDED_UTIL:
+		time_string(&t, timestr, sizeof (timestr));
+		(void) fprintf(op->fp, "%-10s %7s %7s %7s %7s  "
+		    "%5s %5s %5s %5s %5s %6s %6s",
+		    timestr, g_runit_2, g_wunit_2, "RdPkt", "WrPkt",
+		    "IErr", "OErr", "Coll", "NoCP", "Defer",
+		    "%rUtil", "%wUtil");
+		break;
+	default:
+		return;
+	}
+	if (op->ewma)
+		print_ewma_header(op);
+	(void) fprintf(op->fp, "\n");
+}
+
+/*
+ * nic_util() -	Fill in the utilisation of some rates, given the speed
+ *		and duplex of the link(s) they were measured on
+ */
+static void
+nic_util(nicrates_t *rp, uint64_t speed, duplex_t duplex)
+{
+	if (speed > 0) {
+		/*
+		 * The following have a mysterious "800", it is
+		 * 100 for the % conversion, and 8 for
+		 * bytes2bits.
+		 */
+		rp->rutil = min(rp->rbps * 800 / speed, 100);
+		rp->wutil = min(rp->wbps * 800 / speed, 100);
+		if (duplex == DUPLEX_FULL) {
+			/* Full duplex */
+			rp->util = max(rp->rutil, rp->wutil);
+		} else {
+			/* Half Duplex */
+			rp->util = min((rp->rbps + rp->wbps) * 800 / speed,
+			    100);
+		}
+	} else {
+		rp->util = 0;
+		rp->rutil = 0;
+		rp->wutil = 0;
+	}
+}
+
+/*
+ * nic_rates() -	Calculate the per second values of an interface
+ *			between its old and new samples
+ */
+static void
+nic_rates(struct nicdata *nicp, nicrates_t *rp)
+{
+	double tdiff;		/* time difference between samples */
+
+	tdiff = nic_tdiff(nicp);
+	rp->rbps = (nicp->new.rbytes - nicp->old.rbytes) / tdiff;
+	rp->wbps = (nicp->new.wbytes - nicp->old.wbytes) / tdiff;
+	rp->rpps = (nicp->new.rpackets - nicp->old.rpackets) / tdiff;
+	rp->wpps = (nicp->new.wpackets - nicp->old.wpackets) / tdiff;
+	rp->sats = (nicp->new.sat - nicp->old.sat) / tdiff;
+	rp->ierrs = (nicp->new.ierr - nicp->old.ierr) / tdiff;
+	rp->oerrs = (nicp->new.oerr - nicp->old.oerr) / tdiff;
+	rp->colls = (nicp->new.coll - nicp->old.coll) / tdiff;
+	rp->nocps = (nicp->new.nocp - nicp->old.nocp) / tdiff;
+	rp->defers = (nicp->new.defer - nicp->old.defer) / tdiff;
+	rp->skew = nicp->new.skew;
+	nic_util(rp, nicp->speed, nicp->duplex);
+}
+
+/*
+ * add_rates() -	Add one set of rates into a total (except utilisation,
+ *			which the caller works out with nic_util())
+ */
+static void
+add_rates(nicrates_t *sum, nicrates_t *rp)
+{
+	int m, s;
+
+	sum->rbps += rp->rbps;
+	sum->wbps += rp->wbps;
+	sum->rpps += rp->rpps;
+	sum->wpps += rp->wpps;
+	sum->sats += rp->sats;
+	sum->ierrs += rp->ierrs;
+	sum->oerrs += rp->oerrs;
+	sum->colls += rp->colls;
+	sum->nocps += rp->nocps;
+	sum->defers += rp->defers;
+	/* All from the one sample */
+	sum->skew = rp->skew;
+	for (m = 0; m < EW_COUNT; m++)
+		for (s = 0; s < g_ewma_nspans; s++)
+			sum->ewma[m][s] += rp->ewma[m][s];
+}
+
+#ifdef OS_LINUX
+/*
+ * find_reported_nic() -	Find an interface by name, if it has been
+ *				updated this sample
+ */
+static struct nicdata *
+find_reported_nic(char *name, struct nicdata **cachep)
+{
+	struct nicdata *nicp;
+
+	/* Linux nicdata are never freed, so we can cache the pointer */
+	if (*cachep == NULL)
+		for (nicp = g_nicdatap; nicp; nicp = nicp->next)
+			if (streql(nicp->name, name)) {
+				*cachep = nicp;
+				break;
+			}
+	if (*cachep && (*cachep)->report)
+		return (*cachep);
+	return (NULL);
+}
+
+/*
+ * print_bond_line() -	Print a bond, or a member of a bond, for -b
+ *
+ * Members' shares are of the traffic through all of the bond's members;
+ * their utilisation is against their own speed.
+ */
+static void
+print_bond_line(FILE *fp, struct nicdata *nicp, char *bond_name,
+    nicrates_t *rp, nicrates_t *total, uint64_t speed)
+{
+	double rkps, wkps, rshare, wshare;
+	char rshare_s[16], wshare_s[16];
+	int member = (bond_name != NULL);
+
+	rkps = rp->rbps / 1024;
+	wkps = rp->wbps / 1024;
+	if (g_opt_m) {
+		rkps /= 128;
+		wkps /= 128;
+	}
+	if (member) {
+		rshare = total->rbps > 0 ? rp->rbps * 100 / total->rbps : 0;
+		wshare = total->wbps > 0 ? rp->wbps * 100 / total->wbps : 0;
+		(void) snprintf(rshare_s, sizeof (rshare_s), "%.*f",
+		    precision4(rshare), rshare);
+		(void) snprintf(wshare_s, sizeof (wshare_s), "%.*f",
+		    precision4(wshare), wshare);
+	} else {
+		(void) strcpy(rshare_s, "-");
+		(void) strcpy(wshare_s, "-");
+	}
+
+	if (g_opt_p)
+		(void) fprintf(fp, "%ld:BOND:%s:%s:%.*f:%.*f:%.*f:%.*f:%s:%s:"
+			"%llu:%.*f\n", nicp->new.tv.tv_sec,
+			member ? bond_name : nicp->name,
+			member ? nicp->name : "-",
+			precision_p(rkps), rkps,
+			precision_p(wkps), wkps,
+			precision_p(rp->rpps), rp->rpps,
+			precision_p(rp->wpps), rp->wpps,
+			rshare_s, wshare_s,
+			(unsigned long long) speed / 1000000,
+			precision4(rp->util), rp->util);
+	else
+		(void) fprintf(fp, "%8s %s%-*s %7.*f %7.*f %7.*f %7.*f %6s %6s "
+			"%7llu %5.*f\n", "", member ? "  " : "",
+			member ? 10 : 12, nicp->name,
+			precision(rkps), rkps,
+			precision(wkps), wkps,
+			precision(rp->rpps), rp->rpps,
+			precision(rp->wpps), rp->wpps,
+			rshare_s, wshare_s,
+			(unsigned long long) speed / 1000000,
+			precision4(rp->util), rp->util);
+}
+
+/*
+ * print_bonds() -	Show each bond, with its members nested below it
+ *
+ * If the bond's own speed is unknown, the sum of its members' speeds
+ * is used.
+ */
+static void
+print_bonds(FILE *fp)
+{
+	struct nicdata *bond_nicp, *nicp;
+	bond_t *bp;
+	nicrates_t rates, total;
+	uint64_t speed;
+	int i;
+
+	update_timestr(&g_sample_time);
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %-12s %7s %7s %7s %7s %6s %6s %7s %5s\n",
+			g_timestr, "Bond", g_runit_1, g_wunit_1, "rPk/s",
+			"wPk/s", "%rShr", "%wShr", "Mbit/s", "%Util");
+	for (bp = g_bonds; bp; bp = bp->next) {
+		if ((bond_nicp = find_reported_nic(bp->name, &bp->nicp)) ==
+		    NULL)
+			continue;
+		/* nic_rates() leaves the -L averages alone; keep them zero */
+		(void) memset(&rates, 0, sizeof (rates));
+		(void) memset(&total, 0, sizeof (total));
+		speed = 0;
+		for (i = 0; i < bp->nmembers; i++) {
+			nicp = find_reported_nic(bp->members[i].name,
+			    &bp->members[i].nicp);
+			if (nicp == NULL)
+				continue;
+			nic_rates(nicp, &rates);
+			add_rates(&total, &rates);
+			speed += nicp->speed;
+		}
+		if (bond_nicp->speed > 0)
+			speed = bond_nicp->speed;
+		nic_rates(bond_nicp, &rates);
+		nic_util(&rates, speed, bond_nicp->duplex);
+		print_bond_line(fp, bond_nicp, NULL, &rates, &total, speed);
+		for (i = 0; i < bp->nmembers; i++) {
+			nicp = find_reported_nic(bp->members[i].name,
+			    &bp->members[i].nicp);
+			if (nicp == NULL)
+				continue;
+			nic_rates(nicp, &rates);
+			print_bond_line(fp, nicp, bp->name, &rates, &total,
+			    nicp->speed);
+		}
+	}
+}
+#endif /* OS_LINUX */
+
+/*
+ * print_rates() -	Print one line of interface statistics, in the
+ *			output's style
+ */
+static void
+print_rates(output_t *op, char *name, time_t t, nicrates_t *rp)
+{
+	double rkps;		/* read KB per sec */
+	double wkps;		/* write KB per sec */
+	double ravs;		/* read average packet size */
+	double wavs;		/* write average packet size */
+	char timestr[16];
+
+	if (op->style == STYLE_NONE)
+		return;
+#ifdef OS_LINUX
+	if (op->async) {
+		async_record(B_FALSE, name, t, rp);
+		return;
+	}
+#endif
+	if (g_opt_m && op->style != STYLE_PARSEABLE &&
+	    op->style != STYLE_EXTENDED_PARSEABLE) {
+		/* report in Mbps; the parseable formats are always KB */
+		rkps = rp->rbps / 1024 / 128;
+		wkps = rp->wbps / 1024 / 128;
+	} else {
+		/* original KB/sec */
+		rkps = rp->rbps / 1024;
+		wkps = rp->wbps / 1024;
+	}
+	if (rp->rpps > 0)
+		ravs = rp->rbps / rp->rpps;
+	else
+		ravs = 0;
+	if (rp->wpps > 0)
+		wavs = rp->wbps / rp->wpps;
+	else
+		wavs = 0;
+
+	switch (op->style) {
+	case STYLE_SUMMARY:
+		time_string(&t, timestr, sizeof (timestr));
+		(void) fprintf(op->fp, "%s %8s %14.3f %14.3f",
+			timestr, name, rkps, wkps);
+		break;
+	case STYLE_FULL:
+		time_string(&t, timestr, sizeof (timestr));
+		(void) fprintf(op->fp, "%s %8s %7.*f %7.*f %7.*f %7.*f "
+			"%7.*f %7.*f %5.*f %6.*f",
+			timestr, name,
+			precision(rkps), rkps,
+			precision(wkps), wkps,
+			precision(rp->rpps), rp->rpps,
+			precision(rp->wpps), rp->wpps,
+			precision(ravs), ravs,
+			precision(wavs), wavs,
+			precision4(rp->util), rp->util,
+			precision(rp->sats), rp->sats);
+		break;
+	case STYLE_FULL_UTIL:
+		time_string(&t, timestr, sizeof (timestr));
+		(void) fprintf(op->fp, "%s %8s %7.*f %7.*f %7.*f %7.*f "
+			"%7.*f %7.*f %6.*f %6.*f",
+			timestr, name,
+			precision(rkps), rkps,
+			precision(wkps), wkps,
+			precision(rp->rpps), rp->rpps,
+			precision(rp->wpps), rp->wpps,
+			precision(ravs), ravs,
+			precision(wavs), wavs,
+			precision4(rp->rutil), rp->rutil,
+			precision4(rp->wutil), rp->wutil);
+		break;
+	case STYLE_PARSEABLE:
+		(void) fprintf(op->fp, "%ld:%s:%.*f:%.*f:%.*f:%.*f:"
+			"%.*f:%.*f",
+			(long)t, name,
+			precision_p(rkps), rkps,
+			precision_p(wkps), wkps,
+			precision_p(rp->rpps), rp->rpps,
+			precision_p(rp->wpps), rp->wpps,
+			precision4(rp->util), rp->util,
+			precision(rp->sats), rp->sats);
+		break;
+	case STYLE_EXTENDED:
+		(void) fprintf(op->fp, "%-10s %7.*f %7.*f %7.*f %7.*f  "
+			"%5.*f %5.*f %5.*f %5.*f %5.*f  %5.*f",
+			name,
+			precision(rkps), rkps,
+			precision(wkps), wkps,
+			precision(rp->rpps), rp->rpps,
+			precision(rp->wpps), rp->wpps,
+			precision4(rp->ierrs), rp->ierrs,
+			precision4(rp->oerrs), rp->oerrs,
+			precision4(rp->colls), rp->colls,
+			precision4(rp->nocps), rp->nocps,
+			precision4(rp->defers), rp->defers,
+			precision4(rp->util), rp->util);
+		break;
+	case STYLE_EXTENDED_UTIL:
+		(void) fprintf(op->fp, "%-10s %7.*f %7.*f %7.*f %7.*f  "
+			"%5.*f %5.*f %5.*f %5.*f %5.*f %6.*f %6.*f",
+			name,
+			precision(rkps), rkps,
+			precision(wkps), wkps,
+			precision(rp->rpps), rp->rpps,
+			precision(rp->wpps), rp->wpps,
+			precision4(rp->ierrs), rp->ierrs,
+			precision4(rp->oerrs), rp->oerrs,
+			precision4(rp->colls), rp->colls,
+			precision4(rp->nocps), rp->nocps,
+			precision4(rp->defers), rp->defers,
+			precision4(rp->rutil), rp->rutil,
+			precision4(rp->wutil), rp->wutil);
+		break;
+	case STYLE_EXTENDED_PARSEABLE:
+		/*
+		 * Use same initial order as STYLE_PARSEABLE
+		 * for backward compatibility
+		 */
+		(void) fprintf(op->fp, "%ld:%s:%.*f:%.*f:%.*f:%.*f:"
+			"%.*f:%.*f:%.*f:%.*f:%.*f:%.*f:%.*f",
+			(long)t, name,
+			precision_p(rkps), rkps,
+			precision_p(wkps), wkps,
+			precision_p(rp->rpps), rp->rpps,
+			precision_p(rp->wpps), rp->wpps,
+			precision4(rp->util), rp->util,
+			precision(rp->sats), rp->sats,
+			precision(rp->ierrs), rp->ierrs,
+			precision(rp->oerrs), rp->oerrs,
+			precision(rp->colls), rp->colls,
+			precision(rp->nocps), rp->nocps,
+			precision(rp->defers), rp->defers);
+	}
+	if (op->ewma)
+		print_ewma(op, rp);
+	if (op->skew && (op->style == STYLE_PARSEABLE ||
+	    op->style == STYLE_EXTENDED_PARSEABLE))
+		(void) fprintf(op->fp, ":%lld", (long long)rp->skew);
+	(void) fprintf(op->fp, "\n");
+}
+
+#ifdef OS_LINUX
+/*
+ * async_take() -	Claim the oldest committed buffer, or return NULL
+ */
+static outbuf_t *
+async_take()
+{
+	outbuf_t *bp;
+	uint32_t head, tail;
+
+	tail = __atomic_load_n(&g_async_tail, __ATOMIC_ACQUIRE);
+	for (;;) {
+		head = __atomic_load_n(&g_async_head, __ATOMIC_ACQUIRE);
+		if (tail == head)
+			return (NULL);
+		bp = __atomic_load_n(&g_async_ring[tail % g_async],
+		    __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&g_async_tail, &tail,
+		    tail + 1, B_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return (bp);
+		/* The producer dropped it; tail is now the next one */
+	}
+}
+
+/*
+ * async_writer() -	The writer thread: print committed buffers to the
+ *			standard output, reporting any that were dropped
+ */
+/* ARGSUSED */
+static void *
+async_writer(void *arg)
+{
+	outbuf_t *bp;
+	outrec_t *rec;
+	output_t out;
+	uint64_t dropped, reported;
+	uint32_t head;
+	size_t off;
+	int done, i;
+
+	(void) arg;
+	out = g_output;
+	out.fp = stdout;
+	out.async = B_FALSE;
+	reported = 0;
+	for (;;) {
+		done = __atomic_load_n(&g_async_done, __ATOMIC_ACQUIRE);
+		bp = async_take();
+		if (bp == NULL) {
+			if (done)
+				break;
+			while (sem_wait(&g_async_sem) < 0 && errno == EINTR)
+				continue;
+			continue;
+		}
+		dropped = __atomic_load_n(&g_async_dropped, __ATOMIC_RELAXED);
+		if (dropped != reported) {
+			diag(0, "output stalled: %llu samples dropped",
+			    (unsigned long long)(dropped - reported));
+			reported = dropped;
+		}
+		off = 0;
+		for (i = 0; i < bp->nrecs; i++) {
+			rec = &bp->recs[i];
+			if (fwrite(bp->data + off, 1, rec->text - off,
+			    stdout) != rec->text - off)
+				die(1, "write: stdout");
+			off = rec->text;
+			if (rec->header)
+				print_header(&out, rec->t);
+			else
+				print_rates(&out, rec->name, rec->t,
+				    &rec->rates);
+		}
+		if (fwrite(bp->data + off, 1, bp->len - off, stdout) !=
+		    bp->len - off || fflush(stdout) != 0)
+			die(1, "write: stdout");
+
+		/* Hand it back to the producer */
+		head = g_async_free_head;
+		g_async_free[head % (g_async + 2)] = bp;
+		__atomic_store_n(&g_async_free_head, head + 1,
+		    __ATOMIC_RELEASE);
+	}
+	return (NULL);
+}
+
+/*
+ * async_commit() -	Queue everything printed since the last commit
+ */
+static void
+async_commit()
+{
+	static outbuf_t *spare = NULL;	/* last one dropped */
+	outbuf_t *bp, *oldest;
+	uint32_t head, tail;
+
+	if (fflush(g_async_mem) != 0)
+		die(1, "fflush");
+	if (g_async_mem_len == 0 && g_async_nrecs == 0)
+		return;
+
+	/*
+	 * Get a buffer.  There are two more than ring slots, so with
+	 * the ring full and the writer busy with one, one is free.
+	 */
+	if (spare) {
+		bp = spare;
+		spare = NULL;
+	} else {
+		tail = g_async_free_tail;
+		if (tail == __atomic_load_n(&g_async_free_head,
+		    __ATOMIC_ACQUIRE))
+			die(0, "-A: no free output buffer");
+		bp = g_async_free[tail % (g_async + 2)];
+		__atomic_store_n(&g_async_free_tail, tail + 1,
+		    __ATOMIC_RELEASE);
+	}
+	if (bp->size < g_async_mem_len) {
+		bp->data = realloc(bp->data, g_async_mem_len);
+		if (bp->data == NULL)
+			die(1, "realloc");
+		bp->size = g_async_mem_len;
+	}
+	(void) memcpy(bp->data, g_async_mem_buf, g_async_mem_len);
+	bp->len = g_async_mem_len;
+	rewind(g_async_mem);
+	if (bp->maxrecs < g_async_nrecs) {
+		bp->recs = realloc(bp->recs, g_async_nrecs * sizeof (outrec_t));
+		if (bp->recs == NULL)
+			die(1, "realloc");
+		bp->maxrecs = g_async_nrecs;
+	}
+	(void) memcpy(bp->recs, g_async_recs,
+	    g_async_nrecs * sizeof (outrec_t));
+	bp->nrecs = g_async_nrecs;
+	g_async_nrecs = 0;
+
+	/* If the ring is full, drop the oldest - unless it gets written */
+	head = g_async_head;
+	tail = __atomic_load_n(&g_async_tail, __ATOMIC_ACQUIRE);
+	while (head - tail == (uint32_t)g_async) {
+		oldest = __atomic_load_n(&g_async_ring[tail % g_async],
+		    __ATOMIC_RELAXED);
+		if (__atomic_compare_exchange_n(&g_async_tail, &tail,
+		    tail + 1, B_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			spare = oldest;
+			__atomic_store_n(&g_async_dropped,
+			    g_async_dropped + 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	__atomic_store_n(&g_async_ring[head % g_async], bp, __ATOMIC_RELAXED);
+	__atomic_store_n(&g_async_head, head + 1, __ATOMIC_RELEASE);
+	(void) sem_post(&g_async_sem);
+}
+
+/*
+ * async_finish() -	Queue the last output, and wait for the writer to
+ *			write it all; run at exit
+ */
+static void
+async_finish()
+{
+	if (pthread_equal(pthread_self(), g_async_thread))
+		/* The writer failed */
+		return;
+	async_commit();
+	__atomic_store_n(&g_async_done, B_TRUE, __ATOMIC_RELEASE);
+	(void) sem_post(&g_async_sem);
+	(void) pthread_join(g_async_thread, NULL);
+}
+
+/*
+ * async_start() -	Start the writer thread, and send the output to it
+ */
+static void
+async_start()
+{
+	sigset_t all, old;
+	int i;
+
+	g_async_ring = allocate(g_async * sizeof (outbuf_t *));
+	g_async_free = allocate((g_async + 2) * sizeof (outbuf_t *));
+	for (i = 0; i < g_async + 2; i++)
+		g_async_free[i] = allocate(sizeof (outbuf_t));
+	g_async_free_head = g_async + 2;
+	if (sem_init(&g_async_sem, 0, 0) != 0)
+		die(1, "sem_init");
+	g_async_mem = open_memstream(&g_async_mem_buf, &g_async_mem_len);
+	if (g_async_mem == NULL)
+		die(1, "open_memstream");
+	if (fflush(stdout) != 0)
+		die(1, "fflush(stdout)");
+	g_output.fp = g_async_mem;
+	g_output.async = B_TRUE;
+
+	/* Signals are for the main thread, which may be sleeping */
+	(void) sigfillset(&all);
+	(void) pthread_sigmask(SIG_SETMASK, &all, &old);
+	errno = pthread_create(&g_async_thread, NULL, async_writer, NULL);
+	if (errno != 0)
+		die(1, "pthread_create");
+	(void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	(void) atexit(async_finish);
+}
+#endif /* OS_LINUX */
+
+/*
+ * flush_output() -	Finish a batch of output: write it out, or with -A
+ *			hand it to the writer thread
+ */
+static void
+flush_output()
+{
+#ifdef OS_LINUX
+	if (g_async) {
+		async_commit();
+		return;
+	}
+#endif
+	if (fflush(stdout) != 0)
+		die(1, "fflush(stdout)");
+}
+
+/*
+ * Rate histograms (-H).  Every interval's rates are counted into
+ * log-scaled buckets, HIST_SUB per doubling, so a percentile is known to
+ * within about 4% whatever the magnitude, in a fixed amount of memory
+ * per interface.  Bucket 0 holds (near) zero; bucket b > 0 covers
+ * [2^(HIST_MIN_EXP + (b - 1) / HIST_SUB), 2^(HIST_MIN_EXP + b / HIST_SUB)).
+ */
+static int
+hist_bucket(double value)
+{
+	int b;
+
+	if (value < HIST_MIN)
+		return (0);
+	b = 1 + (int)((log2(value) - HIST_MIN_EXP) * HIST_SUB);
+	if (b >= HIST_BUCKETS)
+		b = HIST_BUCKETS - 1;
+	return (b);
+}
+
+/*
+ * hist_find() -	Find (or create) the histograms of an interface
+ */
+static nichist_t *
+hist_find(char *name)
+{
+	nichist_t *hp;
+
+	for (hp = g_hists; hp; hp = hp->next)
+		if (streql(hp->name, name))
+			return (hp);
+	hp = allocate(sizeof (nichist_t));
+	hp->name = new_string(name);
+	hp->next = g_hists;
+	g_hists = hp;
+	return (hp);
+}
+
+static inline void
+hist_add(hist_t *h, double value)
+{
+	h->samples++;
+	h->count[hist_bucket(value)]++;
+	if (value > h->max)
+		h->max = value;
+}
+
+/*
+ * hist_record() -	Count an interface's rates into its histograms
+ */
+static void
+hist_record(struct nicdata *nicp, nicrates_t *rp)
+{
+	nichist_t *hp;
+
+	if (nicp->hist == NULL)
+		nicp->hist = hist_find(nicp->name);
+	hp = nicp->hist;
+	hist_add(&hp->metric[HM_RBYTES], rp->rbps);
+	hist_add(&hp->metric[HM_WBYTES], rp->wbps);
+	hist_add(&hp->metric[HM_RPACKETS], rp->rpps);
+	hist_add(&hp->metric[HM_WPACKETS], rp->wpps);
+	hist_add(&hp->metric[HM_UTIL], rp->util);
+	hist_add(&hp->metric[HM_SAT], rp->sats);
+	hist_add(&hp->metric[HM_IERR], rp->ierrs);
+	hist_add(&hp->metric[HM_OERR], rp->oerrs);
+}
+
+/*
+ * hist_percentile() -	Estimate a percentile from a histogram, as the
+ *			geometric middle of the bucket it falls in
+ */
+static double
+hist_percentile(hist_t *h, double pct)
+{
+	uint64_t rank, seen;
+	double value;
+	int b;
+
+	if (h->samples == 0)
+		return (0);
+	rank = (uint64_t)ceil(h->samples * pct / 100);
+	if (rank < 1)
+		rank = 1;
+	seen = 0;
+	for (b = 0; b < HIST_BUCKETS - 1; b++)
+		if ((seen += h->count[b]) >= rank)
+			break;
+	if (b == 0)
+		return (0);
+	value = exp2(HIST_MIN_EXP + (b - 0.5) / HIST_SUB);
+	return (min(value, h->max));
+}
+
+/*
+ * print_hists() -	Print the percentile summary of every histogram
+ */
+static void
+print_hists(FILE *fp)
+{
+	static double pcts[] = { 50, 95, 99 };
+	nichist_t *hp;
+	hist_t *h;
+	double v[4], scale;
+	time_t now;
+	int m, i;
+
+	now = time(NULL);
+	update_timestr(&now);
+	g_output.line = PAGE_SIZE;
+	if (! g_opt_p)
+		(void) fprintf(fp, "%8s %-10s %-6s %9s %9s %9s %9s %9s\n",
+			g_timestr, "Int", "Metric", "Samples", "p50", "p95",
+			"p99", "max");
+	for (hp = g_hists; hp; hp = hp->next) {
+		if (if_is_ignored(hp->name))
+			continue;
+		if (g_nonlocal && streql(hp->name, "lo"))
+			continue;
+		for (m = 0; m < HM_COUNT; m++) {
+			h = &hp->metric[m];
+			if (h->samples == 0 || (g_skipzero && h->max == 0))
+				continue;
+			/* Bytes are shown as KB (or Mbit) like elsewhere */
+			scale = 1;
+			if (m == HM_RBYTES || m == HM_WBYTES)
+				scale = g_opt_m ? 1024 * 128 : 1024;
+			for (i = 0; i < 3; i++)
+				v[i] = hist_percentile(h, pcts[i]) / scale;
+			v[3] = h->max / scale;
+			if (g_opt_p)
+				(void) fprintf(fp, "%ld:HIST:%s:%s:%llu:%.*f:%.*f:"
+					"%.*f:%.*f\n", (long)now, hp->name,
+					g_hist_names[m],
+					(unsigned long long)h->samples,
+					precision_p(v[0]), v[0],
+					precision_p(v[1]), v[1],
+					precision_p(v[2]), v[2],
+					precision_p(v[3]), v[3]);
+			else
+				(void) fprintf(fp, "%8s %-10s %-6s %9llu %9.*f %9.*f "
+					"%9.*f %9.*f\n", "", hp->name,
+					m == HM_RBYTES ? g_runit_1 :
+					m == HM_WBYTES ? g_wunit_1 :
+					g_hist_labels[m],
+					(unsigned long long)h->samples,
+					precision(v[0]), v[0],
+					precision(v[1]), v[1],
+					precision(v[2]), v[2],
+					precision(v[3]), v[3]);
+		}
+	}
+}
+
+/*
+ * load_hists() -	Merge in histograms saved by an earlier run.  A
+ *			missing file is fine if we are going to create it.
+ */
+static void
+load_hists(char *path, int may_be_missing)
+{
+	FILE *fp;
+	nichist_t *hp;
+	hist_t *h;
+	char name[64], metric[16];
+	unsigned long long samples;
+	double max_v;
+	unsigned int count;
+	int version, sub, min_exp, buckets, nbuckets, b, m, i;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		if (may_be_missing && errno == ENOENT)
+			return;
+		die(1, "fopen: %s", path);
+	}
+	if (fscanf(fp, "nicstat-hist %d %d %d %d", &version, &sub, &min_exp,
+	    &buckets) != 4 || version != HIST_VERSION)
+		die(0, "%s: not a nicstat histogram file", path);
+	if (sub != HIST_SUB || min_exp != HIST_MIN_EXP ||
+	    buckets != HIST_BUCKETS)
+		die(0, "%s: histograms have different buckets", path);
+	while (fscanf(fp, "%63s %15s %llu %lf %d", name,
+	    metric, &samples, &max_v, &nbuckets) == 5) {
+		for (m = 0; m < HM_COUNT; m++)
+			if (streql(metric, g_hist_names[m]))
+				break;
+		hp = NULL;
+		h = NULL;
+		if (m < HM_COUNT) {
+			hp = hist_find(name);
+			h = &hp->metric[m];
+			h->samples += samples;
+			if (max_v > h->max)
+				h->max = max_v;
+		}
+		for (i = 0; i < nbuckets; i++) {
+			if (fscanf(fp, " %d:%u", &b, &count) != 2 ||
+			    b < 0 || b >= HIST_BUCKETS)
+				die(0, "%s: invalid format", path);
+			if (h)
+				h->count[b] += count;
+		}
+	}
+	if (! feof(fp))
+		die(0, "%s: invalid format", path);
+	(void) fclose(fp);
+}
+
+/*
+ * save_hists() -	Write all the histograms out, for a later run to
+ *			merge; via a temporary file, so an interrupted save
+ *			does not lose what was there
+ */
+static void
+save_hists(char *path)
+{
+	FILE *fp;
+	nichist_t *hp;
+	hist_t *h;
+	char tmp[PATH_MAX];
+	int m, b, nbuckets;
+
+	(void) snprintf(tmp, sizeof (tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		die(1, "fopen: %s", tmp);
+	(void) fprintf(fp, "nicstat-hist %d %d %d %d\n", HIST_VERSION,
+	    HIST_SUB, HIST_MIN_EXP, HIST_BUCKETS);
+	for (hp = g_hists; hp; hp = hp->next)
+		for (m = 0; m < HM_COUNT; m++) {
+			h = &hp->metric[m];
+			if (h->samples == 0)
+				continue;
+			nbuckets = 0;
+			for (b = 0; b < HIST_BUCKETS; b++)
+				if (h->count[b])
+					nbuckets++;
+			(void) fprintf(fp, "%s %s %llu %.17g %d", hp->name,
+			    g_hist_names[m], (unsigned long long)h->samples,
+			    h->max, nbuckets);
+			for (b = 0; b < HIST_BUCKETS; b++)
+				if (h->count[b])
+					(void) fprintf(fp, " %d:%u", b,
+					    h->count[b]);
+			(void) fprintf(fp, "\n");
+		}
+	if (fclose(fp) != 0)
+		die(1, "fclose: %s", tmp);
+	if (rename(tmp, path) < 0)
+		die(1, "rename: %s", path);
+}
+
+/*
+ * finish_hists() -	Print the summary, and save the histograms
+ */
+static void
+finish_hists()
+{
+	print_hists(g_output.fp);
+	if (g_hist_file)
+		save_hists(g_hist_file);
+	flush_output();
+}
+
+/*
+ * count_line() -	Account for an interface line, for header paging
+ */
+static void
+count_line(output_t *op)
+{
+	/* always print header if there are multiple NICs */
+	if (g_nicdata_count > 1)
+		op->line += PAGE_SIZE;
+	else
+		op->line++;
+}
+
+/*
+ * group_load() -	Add a member's bytes/s to its group's load each way.
+ *			A half duplex member's traffic either way takes up
+ *			its link both ways, so a group of full and half
+ *			duplex links is as busy as its busiest direction.
+ */
+static void
+group_load(nicrates_t *lp, duplex_t duplex, nicrates_t *rp)
+{
+	int m, s;
+
+	if (duplex == DUPLEX_FULL) {
+		lp->rbps += rp->rbps;
+		lp->wbps += rp->wbps;
+	} else {
+		lp->rbps += rp->rbps + rp->wbps;
+		lp->wbps += rp->rbps + rp->wbps;
+	}
+	for (s = 0; s < g_ewma_nspans; s++)
+		for (m = EW_RBYTES; m <= EW_WBYTES; m++)
+			lp->ewma[m][s] += duplex == DUPLEX_FULL ?
+			    rp->ewma[m][s] :
+			    rp->ewma[EW_RBYTES][s] + rp->ewma[EW_WBYTES][s];
+}
+
+/*
+ * group_add() -	Add an interface's rates to the -g groups it is in
+ */
+static void
+group_add(struct nicdata *nicp, nicrates_t *rp)
+{
+	nicgroup_t *gp;
+	int i;
+
+	if (! (nicp->flags & NIC_GROUPS_KNOWN)) {
+		/* Patterns are only matched the first time */
+		nicp->flags |= NIC_GROUPS_KNOWN;
+		nicp->groups = 0;
+		for (i = 0; i < g_ngroups; i++) {
+			gp = &g_groups[i];
+			if (gp->all ? ! (nicp->flags & NIC_LOOPBACK) :
+			    if_matches(&gp->match, nicp->name))
+				nicp->groups |= 1U << i;
+		}
+	}
+	for (i = 0; i < g_ngroups; i++)
+		if (nicp->groups & (1U << i)) {
+			gp = &g_groups[i];
+			add_rates(&gp->sum, rp);
+			group_load(&gp->load, nicp->duplex, rp);
+			gp->speed += nicp->speed;
+			gp->members++;
+		}
+}
+
+/*
+ * print_groups() -	Print a line for each -g group, after its members,
+ *			with utilisation against the members' summed speed
+ */
+static void
+print_groups()
+{
+	nicgroup_t *gp;
+	int i, s;
+
+	for (i = 0; i < g_ngroups; i++) {
+		gp = &g_groups[i];
+		if (gp->members == 0)
+			continue;
+		/* %rUtil and %wUtil are of the bytes, %Util of the load */
+		nic_util(&gp->sum, gp->speed, DUPLEX_FULL);
+		nic_util(&gp->load, gp->speed, DUPLEX_FULL);
+		ewma_util(&gp->load, gp->speed);
+		gp->sum.util = gp->load.util;
+		for (s = 0; s < g_ewma_nspans; s++)
+			gp->sum.ewma[EW_UTIL][s] = gp->load.ewma[EW_UTIL][s];
+		count_line(&g_output);
+		if (! g_skipzero || gp->sum.rpps != 0 || gp->sum.wpps != 0)
+			print_rates(&g_output, gp->name, g_sample_time,
+			    &gp->sum);
+		/* Start again for the next sample */
+		(void) memset(&gp->sum, 0, sizeof (gp->sum));
+		(void) memset(&gp->load, 0, sizeof (gp->load));
+		gp->speed = 0;
+		gp->members = 0;
+	}
+}
+
+/*
+ * top_key() -	The value -T ranks an interface's rates by
+ */
+static double
+top_key(nicrates_t *rp)
+{
+	switch (g_top_key) {
+	case TOP_UTIL:
+		return (rp->util);
+	case TOP_PPS:
+		return (rp->rpps + rp->wpps);
+	case TOP_ERRORS:
+		return (rp->ierrs + rp->oerrs);
+	case TOP_SAT:
+		return (rp->sats);
+	case TOP_BYTES:
+	default:
+		return (rp->rbps + rp->wbps);
+	}
+}
+
+/*
+ * top_select() -	Partially order list[0..n) so that its k entries with
+ *			the largest keys come first, in no particular order.
+ *			This is quickselect: O(n) on average, where sorting
+ *			thousands of interfaces to print ten would not be.
+ */
+static void
+top_select(topentry_t **list, int n, int k)
+{
+	topentry_t *tmp;
+	double pivot;
+	int lo, hi, i, j;
+
+	lo = 0;
+	hi = n - 1;
+	while (lo < hi) {
+		pivot = list[lo + (hi - lo) / 2]->key;
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (list[i]->key > pivot)
+				i++;
+			while (list[j]->key < pivot)
+				j--;
+			if (i <= j) {
+				tmp = list[i];
+				list[i++] = list[j];
+				list[j--] = tmp;
+			}
+		}
+		/* Now [lo, j] >= pivot >= [i, hi]; find the side with k */
+		if (k - 1 <= j)
+			hi = j;
+		else if (k - 1 >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+/*
+ * print_top() -	Print the -T busiest interfaces, busiest first, then
+ *			an "others" line totalling all the rest
+ */
+static void
+print_top()
+{
+	struct nicdata *nicp;
+	topentry_t *ep, **top;
+	nicrates_t others;
+	uint64_t others_speed;
+	int n, ntop, i, j, since_boot;
+
+	/* Make sure there is room for every interface */
+	if (g_top_size < g_nicdata_count) {
+		free(g_top_entries);
+		free(g_top_list);
+		g_top_size = g_nicdata_count * 2;
+		g_top_entries = allocate(g_top_size * sizeof (topentry_t));
+		g_top_list = allocate(g_top_size * sizeof (topentry_t *));
+	}
+
+	n = 0;
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+#ifdef OS_SOLARIS
+		if (! (nicp->flags & NIC_UP))
+			/* Link is not up */
+			continue;
+		if (g_nonlocal && (nicp->flags & NIC_LOOPBACK))
+			continue;
+#endif
+#ifdef OS_LINUX
+		if (! nicp->report)
+			continue;
+		nicp->report = 0;
+#endif
+		if (n == g_top_size)
+			break;
+		ep = &g_top_entries[n];
+		ep->nicp = nicp;
+		since_boot = (nicp->old.tv.tv_sec == 0);
+		nic_rates(nicp, &ep->rates);
+		if (g_ewma)
+			nic_ewma(nicp, &ep->rates);
+		if (g_ngroups)
+			group_add(nicp, &ep->rates);
+		if (g_hist && ! since_boot)
+			hist_record(nicp, &ep->rates);
+		ep->key = top_key(&ep->rates);
+		g_top_list[n++] = ep;
+
+		/*
+		 * Save the current values for next time; but as with
+		 * print_stats(), a line -z skips is not, so its next
+		 * rates are over the time since it was last shown
+		 */
+		if (! g_skipzero || ep->rates.wpps != 0 ||
+		    ep->rates.rpps != 0)
+			nicp->old = nicp->new;
+	}
+	if (n == 0)
+		return;
+
+	top = g_top_list;
+	ntop = n < g_top_n ? n : g_top_n;
+	if (ntop < n)
+		top_select(top, n, ntop);
+	/* Just the chosen few need sorting */
+	for (i = 1; i < ntop; i++) {
+		ep = top[i];
+		for (j = i; j > 0 && top[j - 1]->key < ep->key; j--)
+			top[j] = top[j - 1];
+		top[j] = ep;
+	}
+
+	for (i = 0; i < ntop; i++) {
+		ep = top[i];
+		count_line(&g_output);
+		if (g_skipzero && ep->rates.wpps == 0 && ep->rates.rpps == 0)
+			continue;
+		print_rates(&g_output, ep->nicp->name,
+		    ep->nicp->new.tv.tv_sec, &ep->rates);
+	}
+	if (ntop == n)
+		return;
+
+	/* Utilisation of the rest is against their summed speed */
+	(void) memset(&others, 0, sizeof (others));
+	others_speed = 0;
+	for (i = ntop; i < n; i++) {
+		add_rates(&others, &top[i]->rates);
+		others_speed += top[i]->nicp->speed;
+	}
+	nic_util(&others, others_speed, DUPLEX_FULL);
+	ewma_util(&others, others_speed);
+	count_line(&g_output);
+	if (g_skipzero && others.wpps == 0 && others.rpps == 0)
+		return;
+	print_rates(&g_output, "others", g_sample_time, &others);
+}
+
+/*
+ * print_stats - generate output
+ *
+ * This routine runs through the linked list of interfaces, prints out
+ * statistics where appropriate, then moves the "new" stats to the "old"
+ * stats, ready for next time.
+ */
+static void
+print_stats()
+{
+	struct nicdata *nicp;	/* ptr into g_nicdatap linked list */
+	nicrates_t rates;
+	int since_boot;		/* no previous sample of this interface */
+
+	if (g_tcp)
+		print_tcp(g_output.fp);
+	if (g_udp)
+		print_udp(g_output.fp);
+#ifdef OS_LINUX
+	if (g_udp_sock)
+		print_udp_socks(g_output.fp);
+	if (g_softnet)
+		print_softnet(g_output.fp);
+	if (g_irq)
+		print_irqs(g_output.fp);
+	if (g_coalesce)
+		print_coalesce(g_output.fp);
+	if (g_irq || g_coalesce)
+		irq_rollover();
+	if (g_qdisc)
+		print_qdiscs(g_output.fp);
+	if (g_bond)
+		print_bonds(g_output.fp);
+#endif
+
+	/* Print header if needed */
+	if (! g_list)
+		if (g_tcp || g_udp || g_softnet || g_irq || g_coalesce ||
+		    g_qdisc || g_bond || (g_output.line >= PAGE_SIZE)) {
+			g_output.line = 0;
+			print_header(&g_output, g_sample_time);
+		}
+
+	if (g_top_n > 0) {
+		print_top();
+		if (g_ngroups)
+			print_groups();
+		return;
+	}
+
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+#ifdef OS_SOLARIS
+		if (! (nicp->flags & NIC_UP))
+			/* Link is not up */
+			continue;
+		if (g_nonlocal && (nicp->flags & NIC_LOOPBACK))
+			continue;
+#endif
+#ifdef OS_LINUX
+		if (! nicp->report)
+			continue;
+		nicp->report = 0;
+#endif
+		since_boot = (nicp->old.tv.tv_sec == 0);
+		nic_rates(nicp, &rates);
+		if (g_ewma)
+			nic_ewma(nicp, &rates);
+		if (g_ngroups)
+			group_add(nicp, &rates);
+		if (g_hist && ! since_boot)
+			hist_record(nicp, &rates);
+		count_line(&g_output);
+
+		/* Skip zero lines */
+		if (g_skipzero && rates.wpps == 0 && rates.rpps == 0)
+			continue;
+
+		print_rates(&g_output, nicp->name, nicp->new.tv.tv_sec,
+		    &rates);
+
+		/* Save the current values for next time */
+		nicp->old = nicp->new;
+	}
+	if (g_ngroups)
+		print_groups();
+}
+
+static void
+cont_handler(int sig_number)
+{
+	/* Re-set the signal handler */
+	(void) signal(sig_number, cont_handler);
+#if DEBUG > 0
+	(void) fprintf(stderr, "<< caught SIGCONT >>\n");
+#endif
+	g_caught_cont = 1;
+}
+
+static void
+hist_handler(int sig_number)
+{
+	/* Re-set the signal handler */
+	(void) signal(sig_number, hist_handler);
+	if (sig_number == SIGUSR1)
+		g_caught_usr1 = 1;
+	else
+		g_caught_term = 1;
+}
+
+/*
+ * check_hist_signals() -	Act on a SIGUSR1, SIGINT or SIGTERM caught
+ *				while -H was keeping histograms
+ */
+static void
+check_hist_signals()
+{
+	if (g_caught_term) {
+		finish_hists();
+		exit(0);
+	}
+	if (g_caught_usr1) {
+		g_caught_usr1 = 0;
+		print_hists(g_output.fp);
+		flush_output();
+	}
+}
+
+#ifdef OS_SOLARIS
+/*
+ * sleep_for - sleep until start_n + period
+ *
+ * This Solaris version uses gethrtime() and nanosleep()
+ */
+static void
+sleep_for(hrtime_t period, hrtime_t start_n)
+{
+	struct timespec pause_tv;
+	hrtime_t now_n, pause_n;
+	int status;
+
+	pause_n = period;
+	do {
+		pause_tv.tv_sec = pause_n / NANOSEC;
+		pause_tv.tv_nsec = pause_n % NANOSEC;
+		status = nanosleep(&pause_tv, (struct timespec *)NULL);
+		if (status < 0)
+			if (errno == EINTR) {
+				if (g_hist)
+					check_hist_signals();
+				now_n = gethrtime();
+				pause_n = start_n + period - now_n;
+				if (pause_n < 100)
+					/* Forget about it */
+					return;
+			} else {
+				die(1, "nanosleep", g_progname);
+			}
+	} while (status != 0);
+}
+#endif /* OS_SOLARIS */
+
+#ifdef OS_LINUX
+/*
+ * sleep_aligned() -	For -W, sleep until the next multiple of the
+ *			interval since the epoch, by the wall clock.  The
+ *			deadline is absolute, so neither signals nor the
+ *			time taken to sample push the cadence back; ticks
+ *			already missed are skipped, not caught up on.
+ */
+static void
+sleep_aligned(int interval)
+{
+	struct timespec now;
+	int error;
+
+	(void) clock_gettime(CLOCK_REALTIME, &now);
+	/* The next multiple after the last, which the first need not be */
+	g_tick.tv_sec += interval - g_tick.tv_sec % interval;
+	g_tick.tv_nsec = 0;
+	/* Missed it, or the clock was set back */
+	if (g_tick.tv_sec <= now.tv_sec ||
+	    g_tick.tv_sec > now.tv_sec + interval)
+		g_tick.tv_sec = now.tv_sec - now.tv_sec % interval + interval;
+	while ((error = clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME,
+	    &g_tick, NULL)) != 0) {
+		if (error != EINTR) {
+			errno = error;
+			die(1, "clock_nanosleep");
+		}
+		if (g_hist)
+			check_hist_signals();
+	}
+}
+
+/*
+ * sleep_for - sleep until now + millisec
+ */
+static inline void
+sleep_for(int period_ms, struct timeval *start_tv)
+{
+	int status;
+	int done = 0;
+	struct timeval then;
+	int us;
+
+	then.tv_sec = 0;
+	do {
+		status = poll(NULL, 0, period_ms);
+		if (status < 0) {
+			if (errno != EINTR) {
+				perror("poll");
+				exit(1);
+			}
+			if (g_hist)
+				check_hist_signals();
+			/* Interrupted - we are not done yet */
+			if (then.tv_sec == 0) {
+				then.tv_sec = start_tv->tv_sec +
+					(period_ms / 1000);
+				us = ((period_ms % 1000) * 1000) +
+					start_tv->tv_usec;
+				if (us > 1000000) {
+					/* Wrapped */
+					then.tv_sec++;
+					then.tv_usec = us - 1000000;
+				} else
+					then.tv_usec = us;
+			}
+			(void) gettimeofday(start_tv, NULL);
+			period_ms = (then.tv_sec - start_tv->tv_sec) * 1000;
+			period_ms += (then.tv_usec - start_tv->tv_usec) / 1000;
+			if (period_ms <= 0)
+				done = 1;
+		} else
+			done = 1;
+	} while (! done);
+}
+#endif /* OS_LINUX */
+
+#ifdef OS_LINUX
+static void
+init_if_speed_list(char *speed_list)
+{
+	struct if_speed_list	*list_elem;
+	char			*speed_list_save_ptr;
+	char			*if_record;
+	char			name[32];
+	unsigned long long	speed;
+	char			duplex_s[32];
+	int			tokens;
+
+	if_record = strtok_r(speed_list, ",", &speed_list_save_ptr);
+	while (if_record) {
+		if (strncmp(if_record, "auto", 4) == 0 &&
+		    (if_record[4] == '\0' || if_record[4] == ':')) {
+			/* Ask sysfs for the rest, as they are seen */
+			g_speed_auto = B_TRUE;
+			if (if_record[4] == ':')
+				g_speed_auto_ms = atol(&if_record[5]);
+			if (g_speed_auto_ms <= 0)
+				die(0, "invalid -S timeout \"%s\"", if_record);
+			if_record = strtok_r(NULL, ",", &speed_list_save_ptr);
+			continue;
+		}
+		duplex_s[0] = '\0';
+		tokens = sscanf(if_record, "%31[^:]:%llu%31s",
+			name, &speed, duplex_s);
+		if (tokens == 0)
+			continue;
+		if (speed <= 0)
+			die(0, "invalid speed for -S %s", name, if_record);
+		if (name == NULL)
+			die(0, "invalid -S argument");
+
+		list_elem = allocate(sizeof (struct if_speed_list));
+		list_elem->name = new_string(name);
+		/* speed is in megabits/second */
+		list_elem->speed = speed * 1000000;
+		/* Do we have a duplex suffix? */
+		switch (duplex_s[0]) {
+		case 'h':
+		case 'H':
+			list_elem->duplex = DUPLEX_HALF;
+			break;
+		case 'f':
+		case 'F':
+		case '\0':	/* Not specified - default is full */
+			list_elem->duplex = DUPLEX_FULL;
+			break;
+		default:
+			list_elem->duplex = DUPLEX_UNKNOWN;
+		}
+#if DEBUG > 0
+		fprintf(stderr, "<< %s - %llu mbps, duplex = %d >>\n",
+			name, speed, list_elem->duplex);
+#endif
+		list_elem->next = g_if_speed_list;
+		g_if_speed_list = list_elem;
+
+		if_record = strtok_r(NULL, ",", &speed_list_save_ptr);
+	}
+}
+
+#endif /* OS_LINUX */
+
+/*
+ * split - Split a string of delimited fields, returning an array of char *
+ *
+ * NOTE: the input string gets modified by this routine
+ */
+static char **
+split(char *string, char *delim, int *nitems)
+{
+	int ndelim, i;
+	char *p;
+	char *lasts;
+	char **ptrs;
+
+	/* How many delimiters do we have? */
+	ndelim = 0;
+	for (p = string; *p; p++)
+		if (*p == *delim)
+			ndelim++;
+
+	/* We need that many ptrs + 2 (max) */
+	ptrs = allocate((ndelim + 2) * sizeof (char *));
+
+	/* Tokenize */
+	i = 0;
+	ptrs[i] = strtok_r(string, delim, &lasts);
+	while (ptrs[i])
+		ptrs[++i] = strtok_r(NULL, delim, &lasts);
+	*nitems = i;
+	return (ptrs);
+}
+
+/*
+ * init_hists() -	Handle "-H file[,file...]": merge in every file,
+ *			the first of which is where we save to ("-" for
+ *			nowhere)
+ */
+static void
+init_hists(char *arg)
+{
+	char **files;
+	int nfiles, i;
+
+	files = split(arg, ",", &nfiles);
+	if (nfiles == 0)
+		usage();
+	if (! streql(files[0], "-"))
+		g_hist_file = files[0];
+	for (i = 0; i < nfiles; i++)
+		if (! streql(files[i], "-"))
+			load_hists(files[i], i == 0);
+}
+
+/*
+ * parse_group() -	Parse the "name[=pattern[,pattern...]]" argument of -g
+ */
+static void
+parse_group(char *arg)
+{
+	nicgroup_t *gp;
+	char *patterns;
+	int npatterns;
+
+	if (g_ngroups == MAX_GROUPS)
+		die(0, "-g: at most %d groups", MAX_GROUPS);
+	gp = &g_groups[g_ngroups++];
+	if ((patterns = strchr(arg, '=')) != NULL)
+		*patterns++ = '\0';
+	if (*arg == '\0')
+		die(0, "-g: missing group name");
+#ifdef OS_LINUX
+	if (strlen(arg) >= OUTREC_NAME)
+		die(0, "-g: group names are at most %d characters",
+		    OUTREC_NAME - 1);
+#endif
+	gp->name = arg;
+	npatterns = 0;
+	if (patterns)
+		compile_if_patterns(&gp->match,
+		    split(patterns, ",", &npatterns));
+	gp->all = (npatterns == 0);
+}
+
+/*
+ * store_crc_init() -	Build the table for store_crc()
+ */
+static void
+store_crc_init()
+{
+	uint32_t c;
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		g_crc_table[i] = c;
+	}
+}
+
+/*
+ * store_crc() -	Continue a CRC-32 (the zlib one) over more bytes
+ */
+static uint32_t
+store_crc(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+	crc = ~crc;
+	while (len--)
+		crc = g_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (~crc);
+}
+
+static uint32_t
+store_hdr_crc(storehdr_t *hp)
+{
+	storehdr_t hdr;
+
+	hdr = *hp;
+	hdr.hdr_crc = 0;
+	return (store_crc(0, &hdr, sizeof (hdr)));
+}
+
+static inline uint64_t
+zigzag(int64_t v)
+{
+	return (((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static int
+put_varint(uint8_t *p, uint64_t v)
+{
+	int n;
+
+	for (n = 0; v >= 0x80; v >>= 7)
+		p[n++] = (v & 0x7f) | 0x80;
+	p[n++] = v;
+	return (n);
+}
+
+/*
+ * store_counters() -	The counters kept in the store, in their order
+ */
+static void
+store_counters(nicstats_t *sp, uint64_t *c)
+{
+	c[0] = sp->rbytes;
+	c[1] = sp->wbytes;
+	c[2] = sp->rpackets;
+	c[3] = sp->wpackets;
+	c[4] = sp->ierr;
+	c[5] = sp->oerr;
+	c[6] = sp->coll;
+	c[7] = sp->nocp;
+	c[8] = sp->defer;
+	c[9] = sp->sat;
+}
+
+/*
+ * store_set_counters() -	The reverse of store_counters()
+ */
+static void
+store_set_counters(nicstats_t *sp, uint64_t *c)
+{
+	sp->rbytes = c[0];
+	sp->wbytes = c[1];
+	sp->rpackets = c[2];
+	sp->wpackets = c[3];
+	sp->ierr = c[4];
+	sp->oerr = c[5];
+	sp->coll = c[6];
+	sp->nocp = c[7];
+	sp->defer = c[8];
+	sp->sat = c[9];
+}
+
+/*
+ * store_open_tier() -	Open (or create) one tier's file, returning its fd
+ *			and filling in *fhp
+ */
+static int
+store_open_tier(char *dir, storetier_t *tp, int create, storefilehdr_t *fhp)
+{
+	char path[PATH_MAX];
+	uint64_t nblocks;
+	int fd;
+
+	(void) snprintf(path, sizeof (path), "%s/%s.nst", dir, tp->name);
+	if ((fd = open(path, create ? O_RDWR | O_CREAT : O_RDONLY,
+	    0644)) < 0)
+		die(1, "open: %s", path);
+	if (pread(fd, fhp, sizeof (*fhp), 0) == sizeof (*fhp)) {
+		if (fhp->magic == STORE_FILE_MAGIC &&
+		    fhp->version != STORE_VERSION)
+			die(0, "%s: store version %u, not %d", path,
+			    fhp->version, STORE_VERSION);
+		if (fhp->magic != STORE_FILE_MAGIC ||
+		    fhp->block_size != STORE_BLOCK_SIZE ||
+		    fhp->period_ms != tp->period_ms || fhp->nblocks == 0)
+			die(0, "%s: not a nicstat store file", path);
+		return (fd);
+	}
+	if (! create)
+		die(0, "%s: not a nicstat store file", path);
+
+	/* New file, sized by its share of the budget */
+	nblocks = g_store_budget / 16 * tp->budget_16ths / STORE_BLOCK_SIZE;
+	if (nblocks > 0)
+		nblocks--;		/* for the file header */
+	if (nblocks < STORE_MIN_BLOCKS)
+		nblocks = STORE_MIN_BLOCKS;
+	(void) memset(fhp, 0, sizeof (*fhp));
+	fhp->magic = STORE_FILE_MAGIC;
+	fhp->version = STORE_VERSION;
+	fhp->block_size = STORE_BLOCK_SIZE;
+	fhp->nblocks = (uint32_t)min(nblocks, UINT32_MAX);
+	fhp->period_ms = tp->period_ms;
+	if (pwrite(fd, fhp, sizeof (*fhp), 0) != sizeof (*fhp))
+		die(1, "pwrite: %s", path);
+	return (fd);
+}
+
+/*
+ * store_open() -	Open the -w store, carrying on after its newest
+ *			block in each tier
+ */
+static void
+store_open()
+{
+	storetier_t *tp;
+	storefilehdr_t fh;
+	int i;
+
+	store_crc_init();
+	if (mkdir(g_store_dir, 0755) < 0 && errno != EEXIST)
+		die(1, "mkdir: %s", g_store_dir);
+	for (i = 0; i < STORE_TIERS; i++) {
+		tp = &g_store_tiers[i];
+		tp->fd = store_open_tier(g_store_dir, tp, B_TRUE, &fh);
+		tp->nblocks = fh.nblocks;
+		tp->next_seq = fh.next_seq ? fh.next_seq : 1;
+		tp->owner = allocate(tp->nblocks * sizeof (storestream_t *));
+	}
+}
+
+/*
+ * store_new_block() -	Start a stream on the tier's next block, which is
+ *			the oldest once the ring is full
+ */
+static void
+store_new_block(storetier_t *tp, storestream_t *sp, struct nicdata *nicp,
+    int64_t ms)
+{
+	storestream_t *old;
+	uint64_t next_seq;
+
+	/* Claim it in the file header before writing it */
+	next_seq = tp->next_seq + 1;
+	if (pwrite(tp->fd, &next_seq, sizeof (next_seq),
+	    offsetof(storefilehdr_t, next_seq)) != sizeof (next_seq))
+		die(1, "pwrite: %s/%s.nst", g_store_dir, tp->name);
+	sp->block = (tp->next_seq - 1) % tp->nblocks;
+	/* Whoever was still writing it must move on */
+	if ((old = tp->owner[sp->block]) != NULL)
+		old->block = -1;
+	tp->owner[sp->block] = sp;
+	(void) memset(&sp->hdr, 0, sizeof (sp->hdr));
+	sp->hdr.magic = STORE_BLOCK_MAGIC;
+	sp->hdr.seq = tp->next_seq++;
+	sp->hdr.first_ms = ms;
+	sp->hdr.speed = nicp->speed;
+	sp->hdr.duplex = nicp->duplex;
+	(void) strncpy(sp->hdr.name, nicp->name, sizeof (sp->hdr.name) - 1);
+}
+
+/*
+ * store_append() -	Append a sample to a stream's block, starting a new
+ *			block when it is full (or the link has changed);
+ *			with a coarser tier's peak rates, if peak
+ */
+static void
+store_append(storetier_t *tp, storestream_t *sp, struct nicdata *nicp,
+    int64_t ms, uint64_t *c, uint64_t *peak)
+{
+	uint8_t buf[STORE_MAX_SAMPLE];
+	int64_t dms, dc[STORE_COUNTERS];
+	off_t off;
+	int len, i;
+
+	len = 0;
+	if (sp->block >= 0) {
+		dms = ms - sp->prev_ms;
+		len += put_varint(buf + len, zigzag(dms - sp->prev_dms));
+		for (i = 0; i < STORE_COUNTERS; i++) {
+			dc[i] = (int64_t)(c[i] - sp->prev[i]);
+			len += put_varint(buf + len,
+			    zigzag(dc[i] - sp->prev_d[i]));
+		}
+		if (peak)
+			for (i = 0; i < STORE_COUNTERS; i++)
+				len += put_varint(buf + len, peak[i]);
+		len += put_varint(buf + len, zigzag(nicp->new.skew));
+		if ((size_t)(sp->hdr.used + len) > STORE_PAYLOAD ||
+		    sp->hdr.nsamples == UINT16_MAX ||
+		    sp->hdr.speed != nicp->speed ||
+		    sp->hdr.duplex != nicp->duplex)
+			sp->block = -1;
+	}
+	if (sp->block < 0) {
+		/* The first sample of a block is kept whole */
+		store_new_block(tp, sp, nicp, ms);
+		len = put_varint(buf, (uint64_t)ms);
+		for (i = 0; i < STORE_COUNTERS; i++)
+			len += put_varint(buf + len, c[i]);
+		if (peak)
+			for (i = 0; i < STORE_COUNTERS; i++)
+				len += put_varint(buf + len, peak[i]);
+		len += put_varint(buf + len, zigzag(nicp->new.skew));
+		dms = 0;
+		(void) memset(dc, 0, sizeof (dc));
+	}
+
+	/* Payload first, then the header that makes it visible */
+	off = (off_t)(sp->block + 1) * STORE_BLOCK_SIZE;
+	if (pwrite(tp->fd, buf, len, off + sizeof (storehdr_t) +
+	    sp->hdr.used) != len)
+		die(1, "pwrite: %s/%s.nst", g_store_dir, tp->name);
+	sp->hdr.payload_crc = store_crc(sp->hdr.payload_crc, buf, len);
+	sp->hdr.used += len;
+	sp->hdr.nsamples++;
+	sp->hdr.last_ms = ms;
+	sp->hdr.hdr_crc = store_hdr_crc(&sp->hdr);
+	if (pwrite(tp->fd, &sp->hdr, sizeof (sp->hdr), off) !=
+	    sizeof (sp->hdr))
+		die(1, "pwrite: %s/%s.nst", g_store_dir, tp->name);
+
+	sp->prev_ms = ms;
+	sp->prev_dms = dms;
+	for (i = 0; i < STORE_COUNTERS; i++) {
+		sp->prev[i] = c[i];
+		sp->prev_d[i] = dc[i];
+	}
+}
+
+/*
+ * store_record() -	Write an interface's latest sample to each tier due
+ *			one; coarser tiers take the first sample of each of
+ *			their periods, with the peak rates since their last
+ */
+static void
+store_record(struct nicdata *nicp)
+{
+	storetier_t *tp;
+	storestream_t *sp, *raw;
+	uint64_t c[STORE_COUNTERS], rate[STORE_COUNTERS];
+	int64_t ms;
+	int i, k;
+
+	if (nicp->store == NULL) {
+		nicp->store = allocate(STORE_TIERS * sizeof (storestream_t));
+		for (i = 0; i < STORE_TIERS; i++)
+			nicp->store[i].block = -1;
+	}
+	ms = (int64_t)nicp->new.tv.tv_sec * 1000 +
+	    nicp->new.tv.tv_usec / 1000;
+	store_counters(&nicp->new, c);
+
+	/* This sample's rates, from the last (which raw always has) */
+	raw = &nicp->store[0];
+	for (k = 0; k < STORE_COUNTERS; k++)
+		rate[k] = raw->prev_ms && ms > raw->prev_ms &&
+		    c[k] >= raw->prev[k] ?
+		    (c[k] - raw->prev[k]) * 1000 / (ms - raw->prev_ms) : 0;
+
+	for (i = 0; i < STORE_TIERS; i++) {
+		tp = &g_store_tiers[i];
+		sp = &nicp->store[i];
+		if (tp->period_ms)
+			for (k = 0; k < STORE_COUNTERS; k++)
+				if (rate[k] > sp->peak[k])
+					sp->peak[k] = rate[k];
+		if (tp->period_ms && sp->prev_ms &&
+		    ms / tp->period_ms == sp->prev_ms / tp->period_ms)
+			continue;
+		store_append(tp, sp, nicp, ms, c,
+		    tp->period_ms ? sp->peak : NULL);
+		(void) memset(sp->peak, 0, sizeof (sp->peak));
+	}
+}
+
+/*
+ * store_sample() -	Record every interface updated this sample
+ */
+static void
+store_sample()
+{
+	struct nicdata *nicp;
+
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+#ifdef OS_SOLARIS
+		if (! (nicp->flags & NIC_UP))
+			continue;
+#endif
+#ifdef OS_LINUX
+		if (! nicp->report)
+			continue;
+#endif
+		store_record(nicp);
+	}
+}
+
+/*
+ * parse_store() -	Parse the "dir[:MB]" argument of -w
+ */
+static void
+parse_store(char *arg)
+{
+	char *p;
+	long mb;
+
+	mb = STORE_BUDGET_MB;
+	if ((p = strrchr(arg, ':')) != NULL) {
+		*p++ = '\0';
+		mb = atol(p);
+		if (mb <= 0)
+			die(0, "-w: invalid size \"%s\"", p);
+	}
+	g_store_dir = arg;
+	g_store_budget = (uint64_t)mb * 1024 * 1024;
+}
+
+#ifdef OS_LINUX
+/*
+ * parse_sink() -	Parse the "format[:seconds]=path" argument of -o
+ */
+static void
+parse_sink(char *arg)
+{
+	static struct {
+		char *name;
+		sinkformat_t format;
+	} formats[] = {
+		{ "text",	SINK_TEXT },
+		{ "extended",	SINK_EXTENDED },
+		{ "parseable",	SINK_PARSEABLE },
+		{ "xparseable",	SINK_EXTENDED_PARSEABLE },
+		{ "json",	SINK_JSON },
+		{ "binary",	SINK_BINARY },
+		{ NULL }
+	};
+	sink_t *sp;
+	char *path, *p;
+	int i;
+
+	if (g_nsinks == MAX_SINKS)
+		die(0, "-o: at most %d outputs", MAX_SINKS);
+	sp = &g_sinks[g_nsinks++];
+	if ((path = strchr(arg, '=')) == NULL || path[1] == '\0')
+		die(0, "-o: \"%s\" has no \"=file\"", arg);
+	*path++ = '\0';
+	sp->path = path;
+	if ((p = strchr(arg, ':')) != NULL) {
+		*p++ = '\0';
+		sp->seconds = atoi(p);
+		if (sp->seconds <= 0)
+			die(0, "-o: invalid interval \"%s\"", p);
+	}
+	for (i = 0; formats[i].name; i++)
+		if (strcmp(arg, formats[i].name) == 0)
+			break;
+	if (formats[i].name == NULL)
+		die(0, "-o: unknown format \"%s\"", arg);
+	sp->format = formats[i].format;
+}
+
+/*
+ * open_sinks() -	Open the -o files, and work out how many intervals
+ *			each aggregates
+ */
+static void
+open_sinks(int interval)
+{
+	static int styles[] = {
+		STYLE_FULL, STYLE_EXTENDED, STYLE_PARSEABLE,
+		STYLE_EXTENDED_PARSEABLE
+	};
+	sinkfilehdr_t fh;
+	struct stat st;
+	sink_t *sp;
+
+	for (sp = g_sinks; sp < &g_sinks[g_nsinks]; sp++) {
+		if (sp->seconds == 0)
+			sp->seconds = interval;
+		if (sp->seconds % interval != 0)
+			die(0, "-o: %d seconds is not a multiple of the "
+			    "interval", sp->seconds);
+		sp->every = sp->seconds / interval;
+		/* The first sample is output, like the main output's */
+		sp->count = sp->every - 1;
+		if (sp->format < SINK_JSON) {
+			sp->out.style = styles[sp->format];
+			if (g_opt_U && sp->out.style == STYLE_FULL)
+				sp->out.style = STYLE_FULL_UTIL;
+			if (g_opt_U && sp->out.style == STYLE_EXTENDED)
+				sp->out.style = STYLE_EXTENDED_UTIL;
+		}
+		sp->out.ewma = B_FALSE;
+		sp->out.skew = g_align;
+		sp->out.line = PAGE_SIZE;
+		if (strcmp(sp->path, "-") == 0)
+			/* Whatever stdout is when we get to it */
+			continue;
+		sp->out.fp = fopen(sp->path, "a");
+		if (sp->out.fp == NULL)
+			die(1, "fopen: %s", sp->path);
+		if (sp->format != SINK_BINARY)
+			continue;
+		if (fstat(fileno(sp->out.fp), &st) < 0)
+			die(1, "fstat: %s", sp->path);
+		if (st.st_size > 0)
+			/* Appending to an earlier capture */
+			continue;
+		fh.magic = SINK_MAGIC;
+		fh.version = SINK_VERSION;
+		fh.record_size = sizeof (sinkrec_t);
+		fh.counters = STORE_COUNTERS;
+		if (fwrite(&fh, sizeof (fh), 1, sp->out.fp) != 1)
+			die(1, "write: %s", sp->path);
+	}
+}
+
+/*
+ * print_json_rates() -	Print one interface's rates as a JSON object
+ */
+static void
+print_json_rates(FILE *fp, struct nicdata *nicp, double secs,
+    nicrates_t *rp)
+{
+	char *p;
+
+	(void) fprintf(fp, "{\"time\":%ld,\"secs\":%.3f,",
+	    (long)nicp->new.tv.tv_sec, secs);
+	if (g_align)
+		(void) fprintf(fp, "\"skew_us\":%lld,", (long long)rp->skew);
+	(void) fputs("\"int\":\"", fp);
+	for (p = nicp->name; *p; p++) {
+		if (*p == '"' || *p == '\\')
+			(void) fputc('\\', fp);
+		(void) fputc(*p, fp);
+	}
+	(void) fprintf(fp, "\",\"rbps\":%.3f,\"wbps\":%.3f,"
+	    "\"rpps\":%.3f,\"wpps\":%.3f,\"util\":%.2f,\"rutil\":%.2f,"
+	    "\"wutil\":%.2f,\"sat\":%.3f,\"ierr\":%.3f,\"oerr\":%.3f,"
+	    "\"coll\":%.3f,\"nocp\":%.3f,\"defer\":%.3f,"
+	    "\"speed\":%llu}\n",
+	    rp->rbps, rp->wbps, rp->rpps, rp->wpps, rp->util, rp->rutil,
+	    rp->wutil, rp->sats, rp->ierrs, rp->oerrs, rp->colls, rp->nocps,
+	    rp->defers, (unsigned long long)nicp->speed);
+}
+
+/*
+ * write_sink_record() -	Append one interface's counters to a binary
+ *				capture
+ */
+static void
+write_sink_record(sink_t *sp, FILE *fp, struct nicdata *nicp)
+{
+	sinkrec_t rec;
+
+	(void) memset(&rec, 0, sizeof (rec));
+	rec.ms = (int64_t)nicp->new.tv.tv_sec * 1000 +
+	    nicp->new.tv.tv_usec / 1000;
+	rec.speed = nicp->speed;
+	rec.duplex = nicp->duplex;
+	(void) strncpy(rec.name, nicp->name, sizeof (rec.name) - 1);
+	store_counters(&nicp->new, rec.c);
+	if (fwrite(&rec, sizeof (rec), 1, fp) != 1)
+		die(1, "write: %s", sp->path);
+}
+
+/*
+ * sink_output() -	Write one sink's statistics for this sample
+ */
+static void
+sink_output(sink_t *sp)
+{
+	struct nicdata *nicp, tmp;
+	nicrates_t rates;
+	output_t out;
+	int text, j;
+	int i = sp - g_sinks;
+
+	out = sp->out;
+	if (out.fp == NULL)
+		out.fp = g_output.fp;
+	text = sp->format < SINK_JSON;
+	if (text && out.line >= PAGE_SIZE) {
+		out.line = 0;
+		print_header(&out, g_sample_time);
+	}
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (! nicp->report)
+			continue;
+		if (nicp->sink_old == NULL) {
+			/* From where the main output starts: -P's baseline */
+			nicp->sink_old = allocate(MAX_SINKS *
+			    sizeof (nicstats_t));
+			for (j = 0; j < MAX_SINKS; j++)
+				nicp->sink_old[j] = nicp->old;
+		}
+		if (sp->format == SINK_BINARY) {
+			write_sink_record(sp, out.fp, nicp);
+			continue;
+		}
+		tmp = *nicp;
+		tmp.old = nicp->sink_old[i];
+		nic_rates(&tmp, &rates);
+		nicp->sink_old[i] = nicp->new;
+		if (! text) {
+			print_json_rates(out.fp, nicp,
+			    tv_diff(&tmp.new.tv, &tmp.old.tv), &rates);
+			continue;
+		}
+		count_line(&out);
+		if (g_skipzero && rates.wpps == 0 && rates.rpps == 0)
+			continue;
+		print_rates(&out, nicp->name, nicp->new.tv.tv_sec, &rates);
+	}
+	sp->out.line = out.line;
+	if (sp->out.fp && fflush(sp->out.fp) != 0)
+		die(1, "write: %s", sp->path);
+}
+
+/*
+ * sink_sample() -	Write each sink whose interval is up; with -W, each
+ *			whose interval has a boundary on the wall clock
+ *			since it was last written
+ */
+static void
+sink_sample()
+{
+	sink_t *sp;
+
+	for (sp = g_sinks; sp < &g_sinks[g_nsinks]; sp++)
+		if (g_align) {
+			if (g_tick.tv_sec / sp->seconds != sp->period) {
+				sp->period = g_tick.tv_sec / sp->seconds;
+				sink_output(sp);
+			}
+		} else if (++sp->count >= sp->every) {
+			sp->count = 0;
+			sink_output(sp);
+		}
+}
+#endif /* OS_LINUX */
+
+#ifdef OS_LINUX
+/*
+ * state_map() -	Map the state file, if it is not already mapped at
+ *			this size
+ */
+static void
+state_map(size_t size)
+{
+	void *p;
+
+	if (g_state != NULL) {
+		if (size == g_state_size)
+			return;
+		(void) munmap((void *)g_state, g_state_size);
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+	    g_state_fd, 0);
+	if (p == MAP_FAILED)
+		die(1, "mmap: %s", g_state_file);
+	g_state = p;
+	g_state_size = size;
+}
+
+/*
+ * state_resize() -	Make room in the state file for capacity entries
+ */
+static void
+state_resize(uint32_t capacity)
+{
+	size_t size;
+
+	size = sizeof (statehdr_t) + capacity * sizeof (stateentry_t);
+	if (ftruncate(g_state_fd, size) < 0)
+		die(1, "ftruncate: %s", g_state_file);
+	state_map(size);
+	g_state->capacity = capacity;
+}
+
+/*
+ * state_init() -	(Re)initialise the state file, empty
+ */
+static void
+state_init()
+{
+	state_resize(STATE_MIN_ENTRIES);
+	g_state->magic = STATE_MAGIC;
+	g_state->version = STATE_VERSION;
+	g_state->entry_size = sizeof (stateentry_t);
+	g_state->nentries = 0;
+	g_state->boot_time = g_boot_time;
+}
+
+/*
+ * state_lock() -	Lock the state file, and check it is still usable;
+ *			another run may have grown or reset it
+ */
+static void
+state_lock()
+{
+	struct stat st;
+	statehdr_t *hp;
+
+	while (flock(g_state_fd, LOCK_EX) < 0)
+		if (errno != EINTR)
+			die(1, "flock: %s", g_state_file);
+	if (fstat(g_state_fd, &st) < 0)
+		die(1, "fstat: %s", g_state_file);
+	if (st.st_size == 0) {
+		state_init();
+		return;
+	}
+	if (st.st_size < (off_t)sizeof (statehdr_t))
+		die(0, "%s: not a nicstat state file", g_state_file);
+	state_map(st.st_size);
+	hp = g_state;
+	if (hp->magic != STATE_MAGIC)
+		die(0, "%s: not a nicstat state file", g_state_file);
+	if (hp->version != STATE_VERSION ||
+	    hp->entry_size != sizeof (stateentry_t) ||
+	    hp->nentries > hp->capacity ||
+	    g_state_size < sizeof (statehdr_t) +
+	    hp->capacity * sizeof (stateentry_t)) {
+		/* Another version's, or damaged: start again */
+		state_init();
+		return;
+	}
+	if (labs((long)hp->boot_time - (long)g_boot_time) >
+	    STATE_BOOT_SLOP) {
+		/* Counters have restarted since */
+		hp->nentries = 0;
+		hp->boot_time = g_boot_time;
+	}
+}
+
+/*
+ * state_find() -	Find (or add) an interface's entry in the state file
+ */
+static stateentry_t *
+state_find(struct nicdata *nicp)
+{
+	stateentry_t *ep;
+	uint32_t i;
+
+	ep = (stateentry_t *)(g_state + 1);
+	i = nicp->state_slot - 1;
+	if (nicp->state_slot > 0 && i < g_state->nentries &&
+	    strncmp(ep[i].name, nicp->name, sizeof (ep->name)) == 0)
+		return (&ep[i]);
+	for (i = 0; i < g_state->nentries; i++)
+		if (strncmp(ep[i].name, nicp->name, sizeof (ep->name)) == 0)
+			break;
+	if (i == g_state->nentries) {
+		if (i == g_state->capacity) {
+			state_resize(g_state->capacity * 2);
+			ep = (stateentry_t *)(g_state + 1);
+		}
+		(void) memset(&ep[i], 0, sizeof (stateentry_t));
+		(void) strncpy(ep[i].name, nicp->name, sizeof (ep->name) - 1);
+		g_state->nentries++;
+	}
+	nicp->state_slot = i + 1;
+	return (&ep[i]);
+}
+
+/*
+ * state_take_ewma() -	Take up the -L averages saved with a baseline
+ */
+static void
+state_take_ewma(struct nicdata *nicp, stateentry_t *ep)
+{
+	if (! g_ewma || ep->ewma_ms != ep->ms ||
+	    memcmp(ep->ewma_spans, g_ewma_spans, sizeof (g_ewma_spans)) != 0)
+		return;
+	(void) memcpy(nicp->ewma, ep->ewma, sizeof (nicp->ewma));
+	nicp->ewma_primed = B_TRUE;
+}
+
+/*
+ * state_ewma() -	Save the -L averages just updated, of each interface
+ *			whose entry still holds this sample
+ */
+static void
+state_ewma()
+{
+	struct nicdata *nicp;
+	stateentry_t *ep;
+	int64_t ms;
 
-	/* Header */
-	update_timestr(&(g_udp_new->tv.tv_sec));
-	if (! g_opt_p)
-		(void) printf("%8s                 %7s %7s   %7s %7s\n",
-			g_timestr, "InDG", "OutDG", "InErr", "OutErr");
+	state_lock();
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (nicp->state_slot == 0 || ! nicp->ewma_primed)
+			continue;
+		ep = state_find(nicp);
+		ms = (int64_t)nicp->new.tv.tv_sec * 1000 +
+		    nicp->new.tv.tv_usec / 1000;
+		if (ep->ms != ms)
+			/* Another run's since */
+			continue;
+		ep->ewma_ms = ms;
+		(void) memcpy(ep->ewma_spans, g_ewma_spans,
+		    sizeof (g_ewma_spans));
+		(void) memcpy(ep->ewma, nicp->ewma, sizeof (ep->ewma));
+	}
+	(void) flock(g_state_fd, LOCK_UN);
+}
 
-	indg = UDPSTAT(inDatagrams) / tdiff;
-	outdg = UDPSTAT(outDatagrams) / tdiff;
-	inerr = UDPSTAT(inErrors) / tdiff;
-	outerr = UDPSTAT(outErrors) / tdiff;
+/*
+ * state_sample() -	Save every interface updated this sample; for one
+ *			new to this run, first take the saved counters, if
+ *			they are still valid, as its previous sample
+ */
+static void
+state_sample()
+{
+	struct nicdata *nicp;
+	stateentry_t *ep;
+	uint64_t c[STORE_COUNTERS];
+	int64_t ms;
+	int i;
 
-	if (g_opt_p)
-		(void) printf("%ld:UDP:%.*f:%.*f:%.*f:%.*f\n",
-			g_udp_new->tv.tv_sec,
-			precision_p(indg), indg,
-			precision_p(outdg), outdg,
-			precision_p(inerr), inerr,
-			precision_p(outerr), outerr);
-	else
-		(void) printf("UDP                      "
-			"%7.*f %7.*f   %7.*f %7.*f\n",
-			precision(indg), indg,
-			precision(outdg), outdg,
-			precision(inerr), inerr,
-			precision(outerr), outerr);
+	state_lock();
+	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
+		if (! nicp->report)
+			continue;
+		ep = state_find(nicp);
+		ms = (int64_t)nicp->new.tv.tv_sec * 1000 +
+		    nicp->new.tv.tv_usec / 1000;
+		store_counters(&nicp->new, c);
+		if (nicp->old.tv.tv_sec == 0) {
+			/* Our first sample of it */
+			if (ep->ms != 0 && ep->ms < ms &&
+			    ep->ifindex == if_nametoindex(nicp->name)) {
+				for (i = 0; i < STORE_COUNTERS; i++)
+					if (ep->c[i] > c[i])
+						break;
+				if (i == STORE_COUNTERS) {
+					store_set_counters(&nicp->old, ep->c);
+					nicp->old.tv.tv_sec = ep->ms / 1000;
+					nicp->old.tv.tv_usec =
+					    (ep->ms % 1000) * 1000;
+					state_take_ewma(nicp, ep);
+				}
+			}
+			ep->ifindex = if_nametoindex(nicp->name);
+		}
+		ep->ms = ms;
+		(void) memcpy(ep->c, c, sizeof (c));
+	}
+	(void) flock(g_state_fd, LOCK_UN);
+}
 
-	/* Flip pointers to TCP stats */
-	usp = g_udp_old;
-	g_udp_old = g_udp_new;
-	g_udp_new = usp;
+/*
+ * state_open() -	Open (or create) the -P state file
+ */
+static void
+state_open()
+{
+	g_state_fd = open(g_state_file, O_RDWR | O_CREAT, 0644);
+	if (g_state_fd < 0)
+		die(1, "open: %s", g_state_file);
+	state_lock();
+	(void) flock(g_state_fd, LOCK_UN);
 }
+#endif /* OS_LINUX */
 
+#ifdef OS_LINUX
 /*
- * print_header - print the header line.
+ * print_diag() -	Print the -d line for the sample just printed, and
+ *			start again for the next
  */
 static void
-print_header(void)
+print_diag(FILE *fp)
 {
-#if DEBUG > 1
-	(void) printf("<<nic_count = %d>>\n", g_nicdata_count);
-#endif
-	switch (g_style) {
-	case STYLE_SUMMARY:
-		(void) printf("%8s %8s %14s %14s\n",
-		    "Time", "Int", g_runit_1, g_wunit_1);
-		break;
-	case STYLE_FULL:
-		(void) printf("%8s %8s %7s %7s %7s "
-		    "%7s %7s %7s %5s %6s\n",
-		    "Time", "Int", g_runit_1, g_wunit_1, "rPk/s",
-		    "wPk/s", "rAvs", "wAvs", "%Util", "Sat");
-		break;
-	case STYLE_FULL_UTIL:
-		(void) printf("%8s %8s %7s %7s %7s "
-		    "%7s %7s %7s %6s %6s\n",
-		    "Time", "Int", g_runit_1, g_wunit_1, "rPk/s",
-		    "wPk/s", "rAvs", "wAvs", "%rUtil", "%wUtil");
-		break;
-	case STYLE_EXTENDED:
-		update_timestr(NULL);
-		(void) printf("%-10s %7s %7s %7s %7s  "
-		    "%5s %5s %5s %5s %5s  %5s\n",
-		    g_timestr, g_runit_2, g_wunit_2, "RdPkt", "WrPkt",
-		    "IErr", "OErr", "Coll", "NoCP", "Defer", "%Util");
-		break;
-	case STYLE_EXTENDED_UTIL:
-		update_timestr(NULL);
-		(void) printf("%-10s %7s %7s %7s %7s  "
-		    "%5s %5s %5s %5s %5s %6s %6s\n",
-		    g_timestr, g_runit_2, g_wunit_2, "RdPkt", "WrPkt",
-		    "IErr", "OErr", "Coll", "NoCP", "Defer",
-		    "%rUtil", "%wUtil");
+	static uint64_t last_syscr = 0, last_syscw = 0, last_ioctls = 0;
+	uint64_t syscr, syscw;
+	struct rusage ru;
+	char buf[512], *p;
+	long now;
+	int n, ph;
+
+	syscr = last_syscr;
+	syscw = last_syscw;
+	if (g_self_io_fd >= 0 &&
+	    (n = pread(g_self_io_fd, buf, sizeof (buf) - 1, 0)) > 0) {
+		buf[n] = '\0';
+		if ((p = strstr(buf, "syscr:")) != NULL)
+			syscr = strtoull(p + 6, NULL, 10);
+		if ((p = strstr(buf, "syscw:")) != NULL)
+			syscw = strtoull(p + 6, NULL, 10);
+	}
+	(void) getrusage(RUSAGE_SELF, &ru);
+	now = (long)time(NULL);
+
+	switch (g_diag) {
+	case DIAG_JSON:
+		(void) fprintf(fp, "{\"time\":%ld", now);
+		for (ph = 0; ph < PH_COUNT; ph++)
+			(void) fprintf(fp, ",\"%s\":{\"wall_us\":%.1f,"
+			    "\"cpu_us\":%.1f}", g_phase_names[ph],
+			    g_phases[ph].wall / 1000.0,
+			    g_phases[ph].cpu / 1000.0);
+		(void) fprintf(fp, ",\"syscr\":%llu,\"syscw\":%llu,"
+		    "\"ioctls\":%llu,\"maxrss_kb\":%ld,\"late_us\":%.1f}\n",
+		    (unsigned long long)(syscr - last_syscr),
+		    (unsigned long long)(syscw - last_syscw),
+		    (unsigned long long)(g_ioctls - last_ioctls),
+		    ru.ru_maxrss, g_late / 1000.0);
 		break;
+	default:
+		if (g_opt_p) {
+			(void) fprintf(fp, "%ld:DIAG", now);
+			for (ph = 0; ph < PH_COUNT; ph++)
+				(void) fprintf(fp, ":%.1f:%.1f",
+				    g_phases[ph].wall / 1000.0,
+				    g_phases[ph].cpu / 1000.0);
+			(void) fprintf(fp, ":%llu:%llu:%llu:%ld:%.1f\n",
+			    (unsigned long long)(syscr - last_syscr),
+			    (unsigned long long)(syscw - last_syscw),
+			    (unsigned long long)(g_ioctls - last_ioctls),
+			    ru.ru_maxrss, g_late / 1000.0);
+			break;
+		}
+		(void) fprintf(fp, "DIAG us wall/cpu:");
+		for (ph = 0; ph < PH_COUNT; ph++)
+			(void) fprintf(fp, " %s %.0f/%.0f", g_phase_names[ph],
+			    g_phases[ph].wall / 1000.0,
+			    g_phases[ph].cpu / 1000.0);
+		(void) fprintf(fp, "; syscalls rd %llu wr %llu ioctl %llu; "
+		    "maxRSS %ldKB; late %.0fus\n",
+		    (unsigned long long)(syscr - last_syscr),
+		    (unsigned long long)(syscw - last_syscw),
+		    (unsigned long long)(g_ioctls - last_ioctls),
+		    ru.ru_maxrss, g_late / 1000.0);
 	}
+	(void) memset(g_phases, 0, sizeof (g_phases));
+	last_syscr = syscr;
+	last_syscw = syscw;
+	last_ioctls = g_ioctls;
 }
+#endif /* OS_LINUX */
 
-inline static double
-max(double d1, double d2)
+#ifdef OS_LINUX
+/*
+ * -E with an interface count times nicstat against made-up /proc files,
+ * so that how it scales can be seen without having the interfaces.
+ * They go in a directory of their own, used as if given with -X.
+ */
+static char *g_bench_files[] = {
+	"/proc/uptime", "/proc/net/snmp", "/proc/net/netstat", NULL
+};
+static char *g_bench_dirs[] = {
+	"/proc", "/proc/net", "/sys", "/sys/class", "/sys/class/net", NULL
+};
+
+/*
+ * bench_write_dev() -	Write the made-up PROC_NET_DEV_PATH for a round,
+ *			every counter having gone up since the last
+ */
+static void
+bench_write_dev(int round)
 {
-	if (d1 > d2)
-		return (d1);
-	return (d2);
+	FILE *fp;
+	unsigned long long r, w;
+	char name[32];
+	int i;
+
+	fp = fopen(proc_path(PROC_NET_DEV_PATH), "w");
+	if (fp == NULL)
+		die(1, "fopen: %s%s", g_bench_dir, PROC_NET_DEV_PATH);
+	(void) fputs(PROC_NET_DEV_HEADER, fp);
+	for (i = 0; i < g_bench_ifs; i++) {
+		r = (unsigned long long)(round + 1) * (1000 + i % 997);
+		w = (unsigned long long)(round + 1) * (500 + i % 499);
+		(void) snprintf(name, sizeof (name), "%s%d",
+		    i % 2 ? "veth" : "eth", i);
+		(void) fprintf(fp, "%6s:%8llu %7llu %4llu %4llu %4llu %5llu "
+		    "%10llu %9llu %8llu %7llu %4llu %4llu %4llu %5llu "
+		    "%7llu %10llu\n", name,
+		    r * 1000, r, r / 1000, r / 2000, 0ULL, 0ULL, 0ULL, r / 10,
+		    w * 1000, w, w / 1000, 0ULL, 0ULL, w / 3000, 0ULL, 0ULL);
+	}
+	if (fclose(fp) != 0)
+		die(1, "fclose: %s%s", g_bench_dir, PROC_NET_DEV_PATH);
 }
 
-inline static double
-min(double d1, double d2)
+/*
+ * bench_cleanup() -	Remove what bench_fixtures() made; run at exit,
+ *			however nicstat exits
+ */
+static void
+bench_cleanup()
 {
-	if (d1 < d2)
-		return (d1);
-	return (d2);
+	int i;
+
+	(void) unlink(proc_path(PROC_NET_DEV_PATH));
+	for (i = 0; g_bench_files[i] != NULL; i++)
+		(void) unlink(proc_path(g_bench_files[i]));
+	for (i = 0; g_bench_dirs[i] != NULL; i++)
+		;
+	while (--i >= 0)
+		(void) rmdir(proc_path(g_bench_dirs[i]));
+	(void) rmdir(g_bench_dir);
 }
 
 /*
- * print_stats - generate output
- *
- * This routine runs through the linked list of interfaces, prints out
- * statistics where appropriate, then moves the "new" stats to the "old"
- * stats, ready for next time.
+ * bench_fixtures() -	Make up a /proc with g_bench_ifs interfaces, in
+ *			$TMPDIR (or /tmp)
  */
 static void
-print_stats()
+bench_fixtures()
 {
-	struct nicdata *nicp;	/* ptr into g_nicdatap linked list */
-	double rbps;		/* read bytes per sec */
-	double wbps;		/* write bytes per sec */
-	double rkps;		/* read KB per sec */
-	double wkps;		/* write KB per sec */
-	double rpps;		/* read packets per sec */
-	double wpps;		/* write packets per sec */
-	double ravs;		/* read average packet size */
-	double wavs;		/* write average packet size */
-	double sats;		/* saturation value per sec */
-	double ierrs;
-	double oerrs;
-	double colls;
-	double nocps;
-	double defers;
-	double tdiff;		/* time difference between samples */
-	double util;		/* utilisation */
-	double rutil;		/* In (read) utilisation */
-	double wutil;		/* Out (write) utilisation */
-
-	if (g_tcp)
-		print_tcp();
-	if (g_udp)
-		print_udp();
+	char path[PATH_MAX], buf[8192], *tmp;
+	int i, in, out, n;
+
+	if ((tmp = getenv("TMPDIR")) == NULL || *tmp == '\0')
+		tmp = "/tmp";
+	(void) snprintf(path, sizeof (path), "%s/nicstat-bench.XXXXXX", tmp);
+	g_bench_dir = new_string(path);
+	if (mkdtemp(g_bench_dir) == NULL)
+		die(1, "mkdtemp: %s", path);
+	g_proc_root = g_bench_dir;
+	(void) atexit(bench_cleanup);
+	for (i = 0; g_bench_dirs[i] != NULL; i++)
+		if (mkdir(proc_path(g_bench_dirs[i]), 0700) < 0)
+			die(1, "mkdir: %s%s", g_bench_dir, g_bench_dirs[i]);
+
+	/* The rest are as they are, only not read per interface */
+	for (i = 0; g_bench_files[i] != NULL; i++) {
+		if ((in = open(g_bench_files[i], O_RDONLY, 0)) < 0)
+			die(1, "open: %s", g_bench_files[i]);
+		(void) snprintf(path, sizeof (path), "%s%s", g_bench_dir,
+		    g_bench_files[i]);
+		if ((out = open(path, O_WRONLY | O_CREAT, 0600)) < 0)
+			die(1, "open: %s", path);
+		while ((n = read(in, buf, sizeof (buf))) > 0)
+			if (write(out, buf, n) != n)
+				die(1, "write: %s", path);
+		(void) close(in);
+		(void) close(out);
+	}
+	bench_write_dev(0);
+}
 
-	/* Print header if needed */
-	if (! g_list)
-		if (g_tcp || g_udp || (g_line >= PAGE_SIZE)) {
-			g_line = 0;
-			print_header();
+/*
+ * run_bench() -	-E: take g_bench_samples samples back to back, with
+ *			the output thrown away, and report on stderr what
+ *			each phase cost.  The first sample, which finds
+ *			the interfaces, is reported on its own.
+ */
+static void
+run_bench()
+{
+	phasetime_t total[PH_COUNT], first[PH_COUNT];
+	phasetime_t t = { 0, 0 };
+	int64_t wall, cpu;
+	uint64_t allocs, first_allocs;
+	struct rusage ru;
+	int i, ph, ifs;
+
+	if (freopen("/dev/null", "w", stdout) == NULL)
+		die(1, "freopen: /dev/null");
+	(void) memset(total, 0, sizeof (total));
+	(void) memset(first, 0, sizeof (first));
+	first_allocs = 0;
+	allocs = g_allocs;
+	ifs = 0;
+	for (i = 0; i < g_bench_samples; i++) {
+		if (g_bench_ifs && i > 0)
+			bench_write_dev(i);
+		(void) memset(g_phases, 0, sizeof (g_phases));
+		update_stats();
+		if (g_nicdata_count <= 0)
+			die(0, "no matching interface");
+		if (i == 0)
+			ifs = g_nicdata_count;
+		phase_begin(&t);
+		if (g_store_dir)
+			store_sample();
+		if (g_state_file)
+			state_sample();
+		if (g_nsinks)
+			sink_sample();
+		phase_end(PH_RECORD, &t);
+		phase_begin(&t);
+		print_stats();
+		(void) fflush(stdout);
+		phase_end(PH_PRINT, &t);
+		if (i == 0) {
+			(void) memcpy(first, g_phases, sizeof (first));
+			first_allocs = g_allocs - allocs;
+			allocs = g_allocs;
+			continue;
 		}
+		for (ph = 0; ph < PH_COUNT; ph++) {
+			total[ph].wall += g_phases[ph].wall;
+			total[ph].cpu += g_phases[ph].cpu;
+		}
+	}
+	allocs = g_allocs - allocs;
+	(void) getrusage(RUSAGE_SELF, &ru);
+
+	(void) fprintf(stderr, "%d interfaces, %d samples after the first\n",
+	    ifs, g_bench_samples - 1);
+	(void) fprintf(stderr, "%-8s %12s %12s %10s %12s\n", "phase",
+	    "ns/sample", "cpu ns", "ns/if", "first ns");
+	wall = cpu = 0;
+	for (ph = 0; ph < PH_COUNT; ph++) {
+		wall += total[ph].wall;
+		cpu += total[ph].cpu;
+		(void) fprintf(stderr, "%-8s %12lld %12lld %10.1f %12lld\n",
+		    g_phase_names[ph],
+		    (long long)(total[ph].wall / (g_bench_samples - 1)),
+		    (long long)(total[ph].cpu / (g_bench_samples - 1)),
+		    (double)total[ph].wall / (g_bench_samples - 1) / ifs,
+		    (long long)first[ph].wall);
+	}
+	(void) fprintf(stderr, "%-8s %12lld %12lld %10.1f\n", "total",
+	    (long long)(wall / (g_bench_samples - 1)),
+	    (long long)(cpu / (g_bench_samples - 1)),
+	    (double)wall / (g_bench_samples - 1) / ifs);
+	(void) fprintf(stderr, "allocations: %.1f/sample, %llu in the first; "
+	    "maxRSS %ldKB\n", (double)allocs / (g_bench_samples - 1),
+	    (unsigned long long)first_allocs, ru.ru_maxrss);
+}
+#endif /* OS_LINUX */
 
-	for (nicp = g_nicdatap; nicp; nicp = nicp->next) {
-#ifdef OS_SOLARIS
-		if (! (nicp->flags & NIC_UP))
-			/* Link is not up */
-			continue;
-		if (g_nonlocal && (nicp->flags & NIC_LOOPBACK))
-			continue;
-#endif
-#ifdef OS_LINUX
-		if (! nicp->report)
-			continue;
-		nicp->report = 0;
-#endif
-		/* Calculate time difference */
 #ifdef OS_LINUX
-		if (nicp->old.tv.tv_sec == 0)
-			/* Not initialised, so numbers will be since boot */
-			nicp->old.tv.tv_sec = g_boot_time;
-#endif
-		tdiff = tv_diff(&nicp->new.tv, &nicp->old.tv);
-		if (tdiff == 0)
-			tdiff = 1;
-
-		/* Calculate per second values */
-		rbps = (nicp->new.rbytes - nicp->old.rbytes) / tdiff;
-		wbps = (nicp->new.wbytes - nicp->old.wbytes) / tdiff;
-		rpps = (nicp->new.rpackets - nicp->old.rpackets) / tdiff;
-		wpps = (nicp->new.wpackets - nicp->old.wpackets) / tdiff;
-		if (g_style == STYLE_EXTENDED ||
-		    g_style == STYLE_EXTENDED_UTIL ||
-		    g_style == STYLE_EXTENDED_PARSEABLE) {
-			ierrs = (nicp->new.ierr - nicp->old.ierr) / tdiff;
-			oerrs = (nicp->new.oerr - nicp->old.oerr) / tdiff;
-			colls = (nicp->new.coll - nicp->old.coll) / tdiff;
-			nocps = (nicp->new.nocp - nicp->old.nocp) / tdiff;
-			defers = (nicp->new.defer - nicp->old.defer) / tdiff;
-		} else if (g_style == STYLE_FULL ||
-		    g_style == STYLE_FULL_UTIL) {
-			if (rpps > 0)
-				ravs = rbps / rpps;
-			else
-				ravs = 0;
-			if (wpps > 0)
-				wavs = wbps / wpps;
-			else
-				wavs = 0;
-		}
-		if (g_style == STYLE_FULL ||
-		    g_style == STYLE_FULL_UTIL ||
-		    g_style == STYLE_PARSEABLE ||
-		    g_style == STYLE_EXTENDED_PARSEABLE)
-			sats = (nicp->new.sat - nicp->old.sat) / tdiff;
-		if (g_opt_m) {
-			/* report in Mbps */
-			rkps = rbps / 1024 / 128;
-			wkps = wbps / 1024 / 128;
-		} else {
-			/* original KB/sec */
-			rkps = rbps / 1024;
-			wkps = wbps / 1024;
+/*
+ * Replaying a -w store (-r).  The block headers of the chosen tier form
+ * a sparse index: each gives the block's interface and time span, so
+ * only the blocks of the interfaces and times asked for are decoded,
+ * straight from the mapped file.  Each interface's samples are then fed
+ * through the normal nicdata and print_stats() path, one tick of the
+ * interval at a time, exactly as if they had been sampled live.  With
+ * "dir:peak", each tick instead reports the highest rate of any one
+ * sample within it, from a coarser tier's rollup or, in the raw tier,
+ * from the samples themselves.
+ */
+typedef struct store_index {
+	const storehdr_t *hdr;		/* in the mapped file */
+} storeindex_t;
+
+typedef struct store_reader {
+	struct store_reader *next;
+	struct nicdata *nicp;
+	storeindex_t *blocks;		/* the interface's, oldest first */
+	int nblocks;
+	int cur;			/* block being decoded */
+	const uint8_t *p, *end;		/* rest of its payload */
+	int first;			/* next sample is a block's first */
+	int64_t ms, dms;		/* last decoded sample & deltas */
+	uint64_t c[STORE_COUNTERS];
+	int64_t dc[STORE_COUNTERS];
+	int peaks;			/* the tier stores peak rates */
+	uint64_t peak[STORE_COUNTERS];	/* ... for the last decoded */
+	uint64_t step_peak[STORE_COUNTERS]; /* highest within this tick */
+	int64_t skew;			/* ... and its -W skew */
+	int pending;			/* ms & c are not yet used */
+	int primed;			/* nicp has had a sample */
+} storereader_t;
+
+static char *g_replay_dir;		/* -r directory */
+static int g_replay_peak;		/* -r dir:peak */
+static int64_t g_replay_from;		/* -R range, ms (0 for open) */
+static int64_t g_replay_to;
+
+static inline int64_t
+unzigzag(uint64_t v)
+{
+	return ((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+}
+
+static const uint8_t *
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t *vp)
+{
+	uint64_t v;
+	int shift;
+
+	v = 0;
+	for (shift = 0; p < end && shift < 64; shift += 7) {
+		v |= (uint64_t)(*p & 0x7f) << shift;
+		if (! (*p++ & 0x80)) {
+			*vp = v;
+			return (p);
 		}
+	}
+	return (NULL);
+}
 
-		/* Calculate utilisation */
-		if (nicp->speed > 0) {
-			/*
-			 * The following have a mysterious "800", it is
-			 * 100 for the % conversion, and 8 for
-			 * bytes2bits.
-			 */
-			rutil = min(rbps * 800 / nicp->speed, 100);
-			wutil = min(wbps * 800 / nicp->speed, 100);
-			if (nicp->duplex == DUPLEX_FULL) {
-				/* Full duplex */
-				util = max(rutil, wutil);
-			} else {
-				/* Half Duplex */
-				util = min((rbps + wbps) * 800 / nicp->speed,
-				    100);
-			}
+/*
+ * store_decode() -	Decode a reader's next sample from its block
+ */
+static int
+store_decode(storereader_t *rp)
+{
+	const uint8_t *p;
+	uint64_t v;
+	int i;
+
+	p = rp->p;
+	if ((p = get_varint(p, rp->end, &v)) == NULL)
+		return (B_FALSE);
+	if (rp->first) {
+		rp->ms = (int64_t)v;
+		rp->dms = 0;
+	} else {
+		rp->dms += unzigzag(v);
+		rp->ms += rp->dms;
+	}
+	for (i = 0; i < STORE_COUNTERS; i++) {
+		if ((p = get_varint(p, rp->end, &v)) == NULL)
+			return (B_FALSE);
+		if (rp->first) {
+			rp->c[i] = v;
+			rp->dc[i] = 0;
 		} else {
-			util = 0;
-			rutil = 0;
-			wutil = 0;
+			rp->dc[i] += unzigzag(v);
+			rp->c[i] += rp->dc[i];
 		}
-		/* always print header if there are multiple NICs */
-		if (g_nicdata_count > 1)
-			g_line += PAGE_SIZE;
-		else
-			g_line++;
+	}
+	for (i = 0; rp->peaks && i < STORE_COUNTERS; i++)
+		if ((p = get_varint(p, rp->end, &rp->peak[i])) == NULL)
+			return (B_FALSE);
+	if ((p = get_varint(p, rp->end, &v)) == NULL)
+		return (B_FALSE);
+	rp->skew = unzigzag(v);
+	rp->p = p;
+	rp->first = B_FALSE;
+	return (B_TRUE);
+}
 
-		/* Skip zero lines */
-		if (g_skipzero && wpps == 0 && rpps == 0)
+/*
+ * store_next() -	Move a reader on to its next sample, across blocks;
+ *			returns false at the end of its data
+ */
+static int
+store_next(storereader_t *rp)
+{
+	const storehdr_t *hp;
+	const uint8_t *base;
+
+	for (;;) {
+		if (rp->p < rp->end && store_decode(rp))
+			return (rp->pending = B_TRUE);
+		if (++rp->cur >= rp->nblocks)
+			return (rp->pending = B_FALSE);
+		hp = rp->blocks[rp->cur].hdr;
+		base = (const uint8_t *)hp + sizeof (storehdr_t);
+		/* Skip a block that was torn, or reused while we read */
+		if (store_crc(0, base, hp->used) != hp->payload_crc)
 			continue;
+		rp->p = base;
+		rp->end = base + hp->used;
+		rp->first = B_TRUE;
+		rp->nicp->speed = hp->speed;
+		rp->nicp->duplex = hp->duplex;
+	}
+}
 
-		/* Print output line */
-		switch (g_style) {
-		case STYLE_SUMMARY:
-			update_timestr(&nicp->new.tv.tv_sec);
-			(void) printf("%s %8s %14.3f %14.3f\n",
-				g_timestr, nicp->name, rkps, wkps);
-			break;
-		case STYLE_FULL:
-			update_timestr(&nicp->new.tv.tv_sec);
-			(void) printf("%s %8s %7.*f %7.*f %7.*f %7.*f "
-				"%7.*f %7.*f %5.*f %6.*f\n",
-				g_timestr, nicp->name,
-				precision(rkps), rkps,
-				precision(wkps), wkps,
-				precision(rpps), rpps,
-				precision(wpps), wpps,
-				precision(ravs), ravs,
-				precision(wavs), wavs,
-				precision4(util), util,
-				precision(sats), sats);
-			break;
-		case STYLE_FULL_UTIL:
-			update_timestr(&nicp->new.tv.tv_sec);
-			(void) printf("%s %8s %7.*f %7.*f %7.*f %7.*f "
-				"%7.*f %7.*f %6.*f %6.*f\n",
-				g_timestr, nicp->name,
-				precision(rkps), rkps,
-				precision(wkps), wkps,
-				precision(rpps), rpps,
-				precision(wpps), wpps,
-				precision(ravs), ravs,
-				precision(wavs), wavs,
-				precision4(rutil), rutil,
-				precision4(wutil), wutil);
-			break;
-		case STYLE_PARSEABLE:
-			(void) printf("%ld:%s:%.*f:%.*f:%.*f:%.*f:"
-				"%.*f:%.*f\n",
-				nicp->new.tv.tv_sec, nicp->name,
-				precision_p(rkps), rkps,
-				precision_p(wkps), wkps,
-				precision_p(rpps), rpps,
-				precision_p(wpps), wpps,
-				precision4(util), util,
-				precision(sats), sats);
+/*
+ * store_advance() -	Give a reader's interface its latest sample at or
+ *			before time t; returns true if it is to be reported
+ */
+static int
+store_advance(storereader_t *rp, int64_t t)
+{
+	nicstats_t *sp;
+	uint64_t c[STORE_COUNTERS];
+	int64_t ms;
+	int i, updated;
+
+	updated = B_FALSE;
+	while (rp->pending && rp->ms <= t) {
+		sp = &rp->nicp->new;
+		ms = (int64_t)sp->tv.tv_sec * 1000 + sp->tv.tv_usec / 1000;
+		if (g_replay_peak && ! rp->peaks && ms && rp->ms > ms) {
+			/* Raw samples: the rate since the one before */
+			store_counters(sp, c);
+			for (i = 0; i < STORE_COUNTERS; i++)
+				rp->peak[i] = rp->c[i] >= c[i] ? (rp->c[i] -
+				    c[i]) * 1000 / (rp->ms - ms) : 0;
+		}
+		for (i = 0; g_replay_peak && i < STORE_COUNTERS; i++)
+			if (rp->peak[i] > rp->step_peak[i])
+				rp->step_peak[i] = rp->peak[i];
+		sp->tv.tv_sec = rp->ms / 1000;
+		sp->tv.tv_usec = (rp->ms % 1000) * 1000;
+		store_set_counters(sp, rp->c);
+		sp->skew = rp->skew;
+		updated = B_TRUE;
+		(void) store_next(rp);
+	}
+	if (! updated)
+		return (B_FALSE);
+	if (! rp->primed) {
+		/* The first sample is only a starting point */
+		rp->nicp->old = rp->nicp->new;
+		rp->primed = B_TRUE;
+		(void) memset(rp->step_peak, 0, sizeof (rp->step_peak));
+		return (B_FALSE);
+	}
+	if (g_replay_peak) {
+		/* Set old back so that the differences give the peaks */
+		sp = &rp->nicp->new;
+		ms = ((int64_t)sp->tv.tv_sec - rp->nicp->old.tv.tv_sec) * 1000 +
+		    (sp->tv.tv_usec - rp->nicp->old.tv.tv_usec) / 1000;
+		store_counters(sp, c);
+		/* (Unsigned, so this may wrap; the difference won't) */
+		for (i = 0; i < STORE_COUNTERS; i++)
+			c[i] -= rp->step_peak[i] * ms / 1000;
+		store_set_counters(&rp->nicp->old, c);
+		(void) memset(rp->step_peak, 0, sizeof (rp->step_peak));
+	}
+	rp->nicp->report = 1;
+	return (B_TRUE);
+}
+
+static int
+index_compare(const void *a, const void *b)
+{
+	const storehdr_t *ha = ((const storeindex_t *)a)->hdr;
+	const storehdr_t *hb = ((const storeindex_t *)b)->hdr;
+	int n;
+
+	if ((n = strncmp(ha->name, hb->name, sizeof (ha->name))) != 0)
+		return (n);
+	return (ha->seq < hb->seq ? -1 : ha->seq > hb->seq);
+}
+
+/*
+ * replay_store() -	Print the stored statistics of -R's time range at
+ *			every interval, from the coarsest tier that has
+ *			samples at least that often
+ */
+static void
+replay_store(int interval, int count)
+{
+	storetier_t *tp;
+	storefilehdr_t fh;
+	storeindex_t *index;
+	storereader_t *readers, *rp;
+	struct nicdata *lastp;
+	const uint8_t *map;
+	const storehdr_t *hp;
+	struct stat st;
+	off_t off;
+	char name[sizeof (hp->name) + 1];
+	int64_t t, from, to, step;
+	int fd, i, j, n, tier, printed;
+
+	store_crc_init();
+	for (tier = STORE_TIERS - 1; tier > 0; tier--)
+		if (g_store_tiers[tier].period_ms <= (uint32_t)interval * 1000)
 			break;
-		case STYLE_EXTENDED:
-			(void) printf("%-10s %7.*f %7.*f %7.*f %7.*f  "
-				"%5.*f %5.*f %5.*f %5.*f %5.*f  %5.*f\n",
-				nicp->name,
-				precision(rkps), rkps,
-				precision(wkps), wkps,
-				precision(rpps), rpps,
-				precision(wpps), wpps,
-				precision4(ierrs), ierrs,
-				precision4(oerrs), oerrs,
-				precision4(colls), colls,
-				precision4(nocps), nocps,
-				precision4(defers), defers,
-				precision4(util), util);
-			break;
-		case STYLE_EXTENDED_UTIL:
-			(void) printf("%-10s %7.*f %7.*f %7.*f %7.*f  "
-				"%5.*f %5.*f %5.*f %5.*f %5.*f %6.*f %6.*f\n",
-				nicp->name,
-				precision(rkps), rkps,
-				precision(wkps), wkps,
-				precision(rpps), rpps,
-				precision(wpps), wpps,
-				precision4(ierrs), ierrs,
-				precision4(oerrs), oerrs,
-				precision4(colls), colls,
-				precision4(nocps), nocps,
-				precision4(defers), defers,
-				precision4(rutil), rutil,
-				precision4(wutil), wutil);
+	tp = &g_store_tiers[tier];
+	fd = store_open_tier(g_replay_dir, tp, B_FALSE, &fh);
+	if (fstat(fd, &st) < 0)
+		die(1, "fstat: %s/%s.nst", g_replay_dir, tp->name);
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		die(1, "mmap: %s/%s.nst", g_replay_dir, tp->name);
+
+	/* Index the blocks of the interfaces and times wanted */
+	index = allocate(fh.nblocks * sizeof (storeindex_t));
+	n = 0;
+	for (i = 0; i < (int)fh.nblocks; i++) {
+		off = (off_t)(i + 1) * STORE_BLOCK_SIZE;
+		if (off + (off_t)sizeof (storehdr_t) > st.st_size)
 			break;
-		case STYLE_EXTENDED_PARSEABLE:
-			/*
-			 * Use same initial order as STYLE_PARSEABLE
-			 * for backward compatibility
-			 */
-			(void) printf("%ld:%s:%.*f:%.*f:%.*f:%.*f:"
-				"%.*f:%.*f:%.*f:%.*f:%.*f:%.*f:%.*f\n",
-				nicp->new.tv.tv_sec, nicp->name,
-				precision_p(rkps), rkps,
-				precision_p(wkps), wkps,
-				precision_p(rpps), rpps,
-				precision_p(wpps), wpps,
-				precision4(util), util,
-				precision(sats), sats,
-				precision(ierrs), ierrs,
-				precision(oerrs), oerrs,
-				precision(colls), colls,
-				precision(nocps), nocps,
-				precision(defers), defers);
-		}
+		hp = (const storehdr_t *)(map + off);
+		if (hp->magic != STORE_BLOCK_MAGIC ||
+		    hp->hdr_crc != store_hdr_crc((storehdr_t *)hp) ||
+		    hp->used > STORE_PAYLOAD || hp->nsamples == 0 ||
+		    off + (off_t)sizeof (storehdr_t) + hp->used > st.st_size)
+			continue;
+		if ((g_replay_from && hp->last_ms < g_replay_from) ||
+		    (g_replay_to && hp->first_ms > g_replay_to))
+			continue;
+		(void) memcpy(name, hp->name, sizeof (hp->name));
+		name[sizeof (hp->name)] = '\0';
+		if (if_is_ignored(name) ||
+		    (g_nonlocal && streql(name, "lo")))
+			continue;
+		index[n++].hdr = hp;
+	}
+	if (n == 0)
+		die(0, "%s: no matching samples", g_replay_dir);
+	qsort(index, n, sizeof (storeindex_t), index_compare);
 
-		/* Save the current values for next time */
-		nicp->old = nicp->new;
+	/* One reader per interface, over its run of blocks */
+	readers = NULL;
+	lastp = NULL;
+	from = INT64_MAX;
+	to = 0;
+	g_nicdata_count = 0;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && index_compare(&index[i],
+		    &index[j]) < 0 && strncmp(index[i].hdr->name,
+		    index[j].hdr->name, sizeof (hp->name)) == 0; j++)
+			;
+		rp = allocate(sizeof (storereader_t));
+		(void) memcpy(name, index[i].hdr->name, sizeof (hp->name));
+		name[sizeof (hp->name)] = '\0';
+		rp->nicp = find_nicdatap(&g_nicdatap, &lastp, name);
+		if (streql(name, "lo"))
+			rp->nicp->flags |= NIC_LOOPBACK;
+		rp->blocks = &index[i];
+		rp->nblocks = j - i;
+		rp->cur = -1;
+		rp->peaks = tp->period_ms != 0;
+		if (! store_next(rp))
+			continue;
+		from = min(from, rp->ms);
+		to = max(to, index[j - 1].hdr->last_ms);
+		rp->next = readers;
+		readers = rp;
+		g_nicdata_count++;
+	}
+	if (g_replay_from > from)
+		from = g_replay_from;
+	if (g_replay_to && g_replay_to < to)
+		to = g_replay_to;
+
+	step = (int64_t)interval * 1000;
+	printed = 0;
+	for (t = from; t <= to + step; t += step) {
+		n = 0;
+		g_sample_time = 0;
+		for (rp = readers; rp; rp = rp->next)
+			if (store_advance(rp, min(t, to))) {
+				n++;
+				/* The headers show when it was recorded */
+				g_sample_time = max(g_sample_time,
+				    rp->nicp->new.tv.tv_sec);
+			}
+		if (n == 0)
+			continue;
+		/* -W sinks go by the recorded time */
+		g_tick.tv_sec = g_sample_time;
+		if (g_nsinks)
+			sink_sample();
+		print_stats();
+		if (++printed == count)
+			break;
 	}
+	flush_output();
+	(void) munmap((void *)map, st.st_size);
+	(void) close(fd);
 }
 
-static void
-cont_handler(int sig_number)
+/*
+ * parse_time() -	A time for -R: seconds since the epoch, or "-N"
+ *			with an optional s, m, h or d suffix for that long
+ *			ago; returned in ms
+ */
+static int64_t
+parse_time(char *s)
 {
-	/* Re-set the signal handler */
-	(void) signal(sig_number, cont_handler);
-#if DEBUG > 0
-	(void) fprintf(stderr, "<< caught SIGCONT >>\n");
-#endif
-	g_caught_cont = 1;
+	char *end;
+	long long v;
+
+	v = strtoll(s, &end, 10);
+	if (end == s)
+		die(0, "-R: invalid time \"%s\"", s);
+	switch (*end) {
+	case 'd':
+		v *= 24;
+		/* FALLTHROUGH */
+	case 'h':
+		v *= 60;
+		/* FALLTHROUGH */
+	case 'm':
+		v *= 60;
+		/* FALLTHROUGH */
+	case 's':
+		end++;
+		break;
+	}
+	if (*end != '\0')
+		die(0, "-R: invalid time \"%s\"", s);
+	if (*s == '-')
+		v += time(NULL);
+	return ((int64_t)v * 1000);
 }
 
-#ifdef OS_SOLARIS
 /*
- * sleep_for - sleep until start_n + period
- *
- * This Solaris version uses gethrtime() and nanosleep()
+ * parse_range() -	Parse the "from[,to]" argument of -R
  */
 static void
-sleep_for(hrtime_t period, hrtime_t start_n)
+parse_range(char *arg)
 {
-	struct timespec pause_tv;
-	hrtime_t now_n, pause_n;
-	int status;
+	char *p;
 
-	pause_n = period;
-	do {
-		pause_tv.tv_sec = pause_n / NANOSEC;
-		pause_tv.tv_nsec = pause_n % NANOSEC;
-		status = nanosleep(&pause_tv, (struct timespec *)NULL);
-		if (status < 0)
-			if (errno == EINTR) {
-				now_n = gethrtime();
-				pause_n = start_n + period - now_n;
-				if (pause_n < 100)
-					/* Forget about it */
-					return;
-			} else {
-				die(1, "nanosleep", g_progname);
-			}
-	} while (status != 0);
+	if ((p = strchr(arg, ',')) != NULL) {
+		*p++ = '\0';
+		g_replay_to = parse_time(p);
+	}
+	if (*arg)
+		g_replay_from = parse_time(arg);
 }
-#endif /* OS_SOLARIS */
 
-#ifdef OS_LINUX
 /*
- * sleep_for - sleep until now + millisec
+ * parse_bench() -	Parse the "samples[:interfaces[:threads]]" argument
+ *			of -E
  */
-static inline void
-sleep_for(int period_ms, struct timeval *start_tv)
+static void
+parse_bench(char *arg)
 {
-	int status;
-	int done = 0;
-	struct timeval then;
-	int us;
-
-	then.tv_sec = 0;
-	do {
-		status = poll(NULL, 0, period_ms);
-		if (status < 0) {
-			if (errno != EINTR) {
-				perror("poll");
-				exit(1);
-			}
-			/* Interrupted - we are not done yet */
-			if (then.tv_sec == 0) {
-				then.tv_sec = start_tv->tv_sec +
-					(period_ms / 1000);
-				us = ((period_ms % 1000) * 1000) +
-					start_tv->tv_usec;
-				if (us > 1000000) {
-					/* Wrapped */
-					then.tv_sec++;
-					then.tv_usec = us - 1000000;
-				} else
-					then.tv_usec = us;
-			}
-			(void) gettimeofday(start_tv, NULL);
-			period_ms = (then.tv_sec - start_tv->tv_sec) * 1000;
-			period_ms += (then.tv_usec - start_tv->tv_usec) / 1000;
-			if (period_ms <= 0)
-				done = 1;
-		} else
-			done = 1;
-	} while (! done);
+	char *p, *q;
+
+	if ((p = strchr(arg, ':')) != NULL) {
+		*p++ = '\0';
+		if ((q = strchr(p, ':')) != NULL) {
+			*q++ = '\0';
+			g_netdev_threads = atoi(q);
+			if (g_netdev_threads <= 0)
+				usage();
+		}
+		g_bench_ifs = atoi(p);
+		if (g_bench_ifs <= 0)
+			usage();
+	}
+	g_bench_samples = atoi(arg);
+	if (g_bench_samples < 2)
+		die(0, "-E: need at least 2 samples");
 }
 #endif /* OS_LINUX */
 
-#ifdef OS_LINUX
+/*
+ * parse_ewma() -	Parse the "span[,span...]" argument of -L
+ */
 static void
-init_if_speed_list(char *speed_list)
+parse_ewma(char *arg)
 {
-	struct if_speed_list	*list_elem;
-	char			*speed_list_save_ptr;
-	char			*if_record;
-	char			name[32];
-	uint64_t		speed;
-	char			duplex_s[32];
-	int			tokens;
-
-	if_record = strtok_r(speed_list, ",", &speed_list_save_ptr);
-	while (if_record) {
-		duplex_s[0] = '\0';
-		tokens = sscanf(if_record, "%31[^:]:%llu%31s",
-			name, &speed, duplex_s);
-		if (tokens == 0)
-			continue;
-		if (speed <= 0)
-			die(0, "invalid speed for -S %s", name, if_record);
-		if (name == NULL)
-			die(0, "invalid -S argument");
-
-		list_elem = allocate(sizeof (struct if_speed_list));
-		list_elem->name = new_string(name);
-		/* speed is in megabits/second */
-		list_elem->speed = speed * 1000000;
-		/* Do we have a duplex suffix? */
-		switch (duplex_s[0]) {
-		case 'h':
-		case 'H':
-			list_elem->duplex = DUPLEX_HALF;
-			break;
-		case 'f':
-		case 'F':
-		case '\0':	/* Not specified - default is full */
-			list_elem->duplex = DUPLEX_FULL;
-			break;
-		default:
-			list_elem->duplex = DUPLEX_UNKNOWN;
-		}
-#if DEBUG > 0
-		fprintf(stderr, "<< %s - %llu mbps, duplex = %d >>\n",
-			name, speed, list_elem->duplex);
-#endif
-		list_elem->next = g_if_speed_list;
-		g_if_speed_list = list_elem;
-
-		if_record = strtok_r(NULL, ",", &speed_list_save_ptr);
+	char **spans, *endp;
+	int n, i;
+
+	spans = split(arg, ",", &n);
+	if (n == 0 || n > EWMA_SPANS)
+		die(0, "-L: give 1 to %d spans", EWMA_SPANS);
+	for (i = 0; i < n; i++) {
+		g_ewma_spans[i] = strtol(spans[i], &endp, 10);
+		if (*endp != '\0' || g_ewma_spans[i] <= 0)
+			die(0, "-L: span \"%s\" must be a positive number of "
+			    "intervals", spans[i]);
 	}
+	g_ewma_nspans = n;
+	g_ewma = B_TRUE;
 }
-#endif /* OS_LINUX */
 
 /*
- * split - Split a string of delimited fields, returning an array of char *
- *
- * NOTE: the input string gets modified by this routine
+ * parse_top() -	Parse the "n[:key]" argument of -T
  */
-static char **
-split(char *string, char *delim, int *nitems)
+static void
+parse_top(char *arg)
 {
-	int ndelim, i;
+	static struct {
+		char *name;
+		topkey_t key;
+	} keys[] = {
+		{ "bytes",	TOP_BYTES },
+		{ "util",	TOP_UTIL },
+		{ "pps",	TOP_PPS },
+		{ "errors",	TOP_ERRORS },
+		{ "sat",	TOP_SAT },
+		{ NULL,		TOP_BYTES }
+	};
 	char *p;
-	char *lasts;
-	char **ptrs;
-
-	/* How many delimiters do we have? */
-	ndelim = 0;
-	for (p = string; *p; p++)
-		if (*p == *delim)
-			ndelim++;
+	int i;
 
-	/* We need that many ptrs + 2 (max) */
-	ptrs = allocate((ndelim + 2) * sizeof (char *));
-
-	/* Tokenize */
-	i = 0;
-	ptrs[i] = strtok_r(string, delim, &lasts);
-	while (ptrs[i])
-		ptrs[++i] = strtok_r(NULL, delim, &lasts);
-	*nitems = i;
-	return (ptrs);
+	g_top_n = atoi(arg);
+	if (g_top_n <= 0)
+		die(0, "-T %s: count must be positive", arg);
+	if ((p = strchr(arg, ':')) == NULL)
+		return;
+	for (i = 0; keys[i].name; i++)
+		if (streql(p + 1, keys[i].name)) {
+			g_top_key = keys[i].key;
+			return;
+		}
+	die(0, "-T %s: key must be one of bytes, util, pps, errors or sat",
+	    arg);
 }
 
 static char *
@@ -2466,6 +9130,10 @@ list_ifs()
 	else
 		(void) printf("Int      Loopback   Mbit/s Duplex State\n");
 	for (p = g_nicdatap; p; p = p->next) {
+#ifdef OS_LINUX
+		if (! p->report)
+			continue;
+#endif
 		if (if_is_ignored(p->name))
 			continue;
 		loopback = p->flags & NIC_LOOPBACK;
@@ -2481,7 +9149,7 @@ list_ifs()
 		else {
 			speed = (p->speed) / 1000000;
 			(void) printf("%-12s   No %8llu   %4s  %4s",
-				p->name, speed, duplex_to_string(p->duplex),
+				p->name, (unsigned long long) speed, duplex_to_string(p->duplex),
 				if_up ? "up" : "down");
 		}
 #ifdef OS_SOLARIS
@@ -2557,6 +9225,74 @@ init_dladm()
 }
 #endif /* USE_DLADM */
 
+#if defined(FUZZ) && defined(OS_LINUX)
+/*
+ * LLVMFuzzerTestOneInput() -	Parse data as the /proc file chosen by FUZZ
+ */
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	static struct nicdata fuzz_nic;
+	static char *buf = NULL;
+	static size_t bufsiz = 0;
+#if FUZZ == FUZZ_NET_DEV
+	struct nicdata *nicp;
+#endif
+	struct timeval now_tv;
+	int irq;
+
+	if (g_progname == NULL) {
+		g_progname = "nicstat";
+		g_tcp = B_TRUE;
+		g_udp = B_TRUE;
+		g_opt_x = B_TRUE;
+		init_tcp();
+		init_udp();
+		fuzz_nic.name = "fuzz0";
+		for (irq = 0; irq < 64; irq++)
+			irq_claim(&fuzz_nic, irq);
+	}
+	if (size + 1 > bufsiz) {
+		bufsiz = size + 1;
+		buf = realloc(buf, bufsiz);
+		if (buf == NULL)
+			die(1, "realloc");
+	}
+	(void) memcpy(buf, data, size);
+	buf[size] = '\0';
+	(void) gettimeofday(&now_tv, NULL);
+
+#if FUZZ == FUZZ_NET_DEV
+	(void) parse_net_dev(buf, &now_tv);
+	/* Start each input with no interfaces */
+	while ((nicp = g_nicdatap) != NULL) {
+		g_nicdatap = nicp->next;
+		free(nicp->name);
+		free(nicp);
+	}
+	if (g_nic_hash != NULL)
+		(void) memset(g_nic_hash, 0,
+		    g_nic_hash_size * sizeof (struct nicdata *));
+	g_nic_hash_count = 0;
+#elif FUZZ == FUZZ_SNMP
+	load_snmp(buf);
+#elif FUZZ == FUZZ_NETSTAT
+	load_netstat(buf);
+#elif FUZZ == FUZZ_UDP
+	g_usock_new.count = 0;
+	parse_udp_socks(buf, AF_INET6, &g_usock_new);
+	udp_sock_hash(&g_usock_new);
+#elif FUZZ == FUZZ_SOFTNET
+	parse_softnet(buf);
+#elif FUZZ == FUZZ_INTERRUPTS
+	parse_interrupts(buf, size);
+#else
+#error	"FUZZ must be one of the FUZZ_* parsers"
+#endif
+	return (0);
+}
+#else /* FUZZ && OS_LINUX */
+
 /*
  * Main Program
  */
@@ -2571,6 +9307,9 @@ main(int argc, char **argv)
 	int loop;		/* current loop number */
 	int option;		/* command line switch */
 	int tracked_ifs;
+	char **if_names;
+	char *hist_arg = NULL;
+	int i;
 	int time_is_up;
 #ifdef OS_SOLARIS
 	hrtime_t period_n;	/* period of each iteration in nanoseconds */
@@ -2579,10 +9318,12 @@ main(int argc, char **argv)
 	hrtime_t pause_n;	/* time until start of next iteration, nsec */
 	kid_t kc_id;
 #else /* OS_SOLARIS */
-	int net_dev;		/* file descriptor for stats file */
 	int pause_m;		/* time to pause, milliseconds */
 	struct timeval start;	/* start point of an iteration */
 	struct timeval now;
+	struct timeval due;	/* when we asked to wake, for -d */
+	phasetime_t t = { 0, 0 };	/* -d */
+	char *p;
 #endif /* OS_SOLARIS */
 #if DEBUG > 1
 	struct timeval debug_now;
@@ -2591,7 +9332,7 @@ main(int argc, char **argv)
 	/* defaults */
 	interval = INTERVAL;
 	loop_max = LOOP_MAX;
-	g_line = PAGE_SIZE;
+	g_output.line = PAGE_SIZE;
 	loop = 0;
 	g_style = STYLE_FULL;
 	g_skipzero = B_FALSE;
@@ -2618,12 +9359,80 @@ main(int argc, char **argv)
 			usage();
 			break;
 		case 'i':
-			g_tracked = split(optarg, ",", &tracked_ifs);
-			g_someif = tracked_ifs > 0;
+			if_names = split(optarg, ",", &tracked_ifs);
+			compile_if_patterns(&g_if_match, if_names);
+#ifdef OS_LINUX
+			sysfs_select(if_names);
+#endif
+			if (tracked_ifs > 0)
+				g_someif = B_TRUE;
 			break;
 		case 's':
 			g_style = STYLE_SUMMARY;
 			break;
+		case 'T':
+			parse_top(optarg);
+			break;
+		case 'H':
+			g_hist = B_TRUE;
+			hist_arg = optarg;
+			break;
+		case 'L':
+			parse_ewma(optarg);
+			break;
+		case 'g':
+			parse_group(optarg);
+			break;
+		case 'w':
+			parse_store(optarg);
+			break;
+#ifdef OS_LINUX
+		case 'r':
+			if ((p = strrchr(optarg, ':')) != NULL &&
+			    streql(p, ":peak")) {
+				*p = '\0';
+				g_replay_peak = B_TRUE;
+			}
+			g_replay_dir = optarg;
+			break;
+		case 'R':
+			parse_range(optarg);
+			break;
+		case 'o':
+			parse_sink(optarg);
+			break;
+		case 'P':
+			g_state_file = optarg;
+			break;
+		case 'd':
+			if (streql(optarg, "text"))
+				g_diag = DIAG_TEXT;
+			else if (streql(optarg, "json"))
+				g_diag = DIAG_JSON;
+			else
+				usage();
+			break;
+		case 'X':
+			g_proc_root = optarg;
+			break;
+		case 'E':
+			parse_bench(optarg);
+			break;
+		case 'Q':
+			g_uring_wanted = B_TRUE;
+			break;
+		case 'B':
+			g_collector_name = optarg;
+			break;
+		case 'W':
+			g_align = B_TRUE;
+			break;
+		case 'A':
+			g_async = atoi(optarg);
+			if (g_async <= 0)
+				usage();
+			break;
+#endif
 		case 'v':
 			g_verbose = B_TRUE;
 			break;
@@ -2643,6 +9452,38 @@ main(int argc, char **argv)
 			if (g_style == STYLE_FULL)
 				g_style = STYLE_NONE;
 			break;
+#ifdef OS_LINUX
+		case 'D':
+			g_udp = g_udp_sock = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+		case 'C':
+			g_softnet = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+		case 'I':
+			g_irq = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+		case 'c':
+			g_coalesce = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+		case 'q':
+			g_qdisc = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+		case 'b':
+			g_bond = B_TRUE;
+			if (g_style == STYLE_FULL)
+				g_style = STYLE_NONE;
+			break;
+#endif
 		case 'x':
 			g_opt_x = B_TRUE;
 			break;
@@ -2682,7 +9523,8 @@ main(int argc, char **argv)
 	if (g_opt_p) {
 		if (g_opt_x)
 			g_style = STYLE_EXTENDED_PARSEABLE;
-		else if (! g_tcp && ! g_udp)
+		else if (! g_tcp && ! g_udp && ! g_softnet && ! g_irq &&
+		    ! g_coalesce && ! g_qdisc && ! g_bond)
 			g_style = STYLE_PARSEABLE;
 		/* Always output KB in the parseable format */
 		g_opt_m = B_FALSE;
@@ -2697,6 +9539,12 @@ main(int argc, char **argv)
 		case STYLE_EXTENDED:
 			g_style = STYLE_EXTENDED_UTIL;
 		}
+	g_output.fp = stdout;
+	g_output.style = g_style;
+	g_output.ewma = g_ewma;
+#ifdef OS_LINUX
+	g_output.skew = g_align;
+#endif
 	if (g_opt_m) {
 		g_runit_1 = "rMbps";
 		g_wunit_1 = "wMbps";
@@ -2715,6 +9563,26 @@ main(int argc, char **argv)
 		else
 			g_forever = 1;
 	}
+	for (i = 0; i < g_ewma_nspans; i++)
+		g_ewma_alpha[i] = 1 - exp(-1.0 / g_ewma_spans[i]);
+
+#ifdef OS_LINUX
+	if (g_nsinks)
+		open_sinks(interval);
+	if (g_replay_dir) {
+		/* Not sampling, but reading what -w recorded */
+		if (g_tcp || g_udp || g_softnet || g_irq || g_coalesce ||
+		    g_qdisc || g_bond || g_list || g_store_dir)
+			die(0, "-r: only interface statistics are recorded");
+		g_async = 0;		/* nothing to keep up with */
+		if (g_hist)
+			init_hists(hist_arg);
+		replay_store(interval, (argc - optind) >= 2 ? loop_max : 0);
+		if (g_hist)
+			finish_hists();
+		return (0);
+	}
+#endif
 
 #ifdef OS_SOLARIS
 	/* Open Kstat */
@@ -2749,20 +9617,53 @@ main(int argc, char **argv)
 	/* Get time when we started */
 	start_n = gethrtime();
 #else /* OS_SOLARIS */
-	/* Open the file we got stats from (in Linux) */
-	net_dev = open(PROC_NET_DEV_PATH, O_RDONLY, 0);
-	if (net_dev < 0)
-		die(1, "open: %s", PROC_NET_DEV_PATH);
+	g_timing = g_diag || g_bench_samples;
+	if (g_bench_ifs)
+		bench_fixtures();
+
+	/* Choose where to get interface stats from (in Linux) */
+	collector_select();
 	if (g_tcp || g_udp) {
-		g_snmp = fopen(PROC_NET_SNMP_PATH, "r");
-		if (! g_snmp)
-			die(1, "fopen: %s", PROC_NET_SNMP_PATH);
+		g_snmp_fd = open(proc_path(PROC_NET_SNMP_PATH), O_RDONLY, 0);
+		if (g_snmp_fd < 0)
+			die(1, "open: %s", PROC_NET_SNMP_PATH);
 	}
 	if (g_tcp) {
-		g_netstat = fopen(PROC_NET_NETSTAT_PATH, "r");
-		if (! g_netstat)
-			die(1, "fopen: %s", PROC_NET_NETSTAT_PATH);
+		g_netstat_fd = open(proc_path(PROC_NET_NETSTAT_PATH),
+		    O_RDONLY, 0);
+		if (g_netstat_fd < 0)
+			die(1, "open: %s", PROC_NET_NETSTAT_PATH);
+	}
+	if (g_udp_sock) {
+		g_udp_fd = open(proc_path(PROC_NET_UDP_PATH), O_RDONLY, 0);
+		if (g_udp_fd < 0)
+			die(1, "open: %s", PROC_NET_UDP_PATH);
+		/* No IPv6 is OK */
+		g_udp6_fd = open(proc_path(PROC_NET_UDP6_PATH), O_RDONLY, 0);
+	}
+	if (g_softnet) {
+		g_softnet_fd = open(proc_path(PROC_NET_SOFTNET_PATH),
+		    O_RDONLY, 0);
+		if (g_softnet_fd < 0)
+			die(1, "open: %s", PROC_NET_SOFTNET_PATH);
+	}
+	if (g_irq || g_coalesce) {
+		g_interrupts_fd = open(proc_path(PROC_INTERRUPTS_PATH),
+		    O_RDONLY, 0);
+		if (g_interrupts_fd < 0)
+			die(1, "open: %s", PROC_INTERRUPTS_PATH);
 	}
+	if (g_qdisc || g_bond) {
+		rtnl_open();
+		rtnl_events_open();
+	}
+
+	if (g_uring_wanted)
+#ifdef USE_URING
+		uring_open();
+#else
+		diag(0, "-Q: built without io_uring, reading /proc without");
+#endif
 
 	/* Get boot-time */
 	g_boot_time = fetch_boot_time();
@@ -2776,10 +9677,39 @@ main(int argc, char **argv)
 	 * Set up signal handling
 	 */
 	(void) signal(SIGCONT, cont_handler);
+	if (g_store_dir)
+		store_open();
+#ifdef OS_LINUX
+	if (g_state_file)
+		state_open();
+	if (g_bench_samples) {
+		run_bench();
+		return (0);
+	}
+	if (g_diag)
+		/* Not fatal; the system call counts are left out */
+		g_self_io_fd = open(PROC_SELF_IO_PATH, O_RDONLY, 0);
+	due.tv_sec = 0;
+	due.tv_usec = 0;
+	if (g_async)
+		async_start();
+#endif
+	if (g_hist) {
+		init_hists(hist_arg);
+		(void) signal(SIGUSR1, hist_handler);
+		(void) signal(SIGINT, hist_handler);
+		(void) signal(SIGTERM, hist_handler);
+	}
 
 	if (g_verbose) {
-		(void) printf("nicstat version " NICSTAT_VERSION "\n");
+		(void) fprintf(g_output.fp,
+		    "nicstat version " NICSTAT_VERSION "\n");
 	}
+#ifdef OS_LINUX
+	if (g_align)
+		/* The first sample is due now, the rest on ticks */
+		(void) clock_gettime(CLOCK_REALTIME, &g_tick);
+#endif
 
 	/*
 	 * Main Loop
@@ -2793,6 +9723,13 @@ main(int argc, char **argv)
 		fprintf(stderr, "        pre-op = %ld.%06ld\n",
 			debug_now.tv_sec, debug_now.tv_usec);
 #endif
+#ifdef OS_LINUX
+		if (g_diag && due.tv_sec != 0) {
+			(void) gettimeofday(&now, NULL);
+			g_late = (int64_t)(now.tv_sec - due.tv_sec) *
+			    1000000000 + (now.tv_usec - due.tv_usec) * 1000;
+		}
+#endif
 
 		/*
 		 * Fetch data and update statistics
@@ -2801,7 +9738,7 @@ main(int argc, char **argv)
 		update_nicdata_list();
 		update_stats();
 #else
-		update_stats(net_dev);
+		update_stats();
 #endif
 
 		/* Check we matched some NICs */
@@ -2817,17 +9754,42 @@ main(int argc, char **argv)
 		}
 
 		/*
-		 * Print statistics
+		 * Record, then print statistics
 		 */
+#ifdef OS_LINUX
+		if (g_diag)
+			phase_begin(&t);
+#endif
+		if (g_store_dir)
+			store_sample();
+#ifdef OS_LINUX
+		if (g_state_file)
+			state_sample();
+		if (g_nsinks)
+			sink_sample();
+		if (g_diag) {
+			phase_end(PH_RECORD, &t);
+			phase_begin(&t);
+		}
+#endif
 		print_stats();
+#ifdef OS_LINUX
+		if (g_state_file && g_ewma)
+			state_ewma();
+		if (g_diag) {
+			phase_end(PH_PRINT, &t);
+			print_diag(g_output.fp);
+		}
+#endif
+		if (g_hist)
+			check_hist_signals();
 
 		/* end point */
 		if (! g_forever)
 			if (++loop == loop_max) break;
 
 		/* flush output */
-		if (fflush(stdout) != 0)
-			die(1, "fflush(stdout)");
+		flush_output();
 
 		/*
 		 * have a kip
@@ -2837,6 +9799,11 @@ main(int argc, char **argv)
 		pause_n = start_n + period_n - end_n;
 		time_is_up = pause_n <= 0 || pause_n < (period_n / 4);
 #else /* OS_SOLARIS */
+		if (g_align) {
+			sleep_aligned(interval);
+			due.tv_sec = g_tick.tv_sec;
+			continue;
+		}
 		(void) gettimeofday(&now, NULL);
 		start.tv_sec += interval;
 		pause_m = (start.tv_sec - now.tv_sec) * 1000;
@@ -2887,12 +9854,24 @@ main(int argc, char **argv)
 			die(1, "kstat_chain_update");
 		g_new_kstat_chain = (kc_id != 0);
 #else /* OS_SOLARIS */
+		if (g_diag) {
+			due = now;
+			due.tv_sec += pause_m / 1000;
+			due.tv_usec += (pause_m % 1000) * 1000;
+			if (due.tv_usec >= 1000000) {
+				due.tv_sec++;
+				due.tv_usec -= 1000000;
+			}
+		}
 		if (pause_m > 0)
 			sleep_for(pause_m, &now);
 #endif /* OS_SOLARIS */
 	}
 
 
+	if (g_hist)
+		finish_hists();
+
 	/*
 	 * Close Kstat & socket
 	 */
@@ -2903,3 +9882,4 @@ main(int argc, char **argv)
 
 	return (0);
 }
+#endif /* FUZZ && OS_LINUX */